@@ -0,0 +1,248 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Allocation Tracker -
+// --------------------------------------------------------------------------
+/*
+ * Every thread names what it is allocating with a kind, set around the lexer, the reader, env
+ * frames, printed strings and evaluation, and with the frame being evaluated, set when a fn or a
+ * top level form is entered. The xmalloc hooks file each allocation under that pair and remember
+ * its size by address, so its xfree takes it off the live totals again.
+ *
+ * The hooks serialize on one lock and allocate with plain malloc, tracking is for finding out where
+ * memory goes, not for production runs.
+ */
+#define KATIE_ALLOCS_REPORT_TAGS 32
+
+Katie_Allocs katie_allocs = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+#ifdef KATIE_ALLOCS
+static char *katie_alloc_kind_to_cstring[Katie_AllocKind_Count] = {
+    [Katie_AllocKind_Other] = "other",     [Katie_AllocKind_Tokens] = "tokens",
+    [Katie_AllocKind_AstNode] = "ast node", [Katie_AllocKind_Value] = "value",
+    [Katie_AllocKind_Env] = "env",         [Katie_AllocKind_String] = "string",
+};
+
+static __thread u32 alloc_kind;
+static __thread u32 alloc_frame;
+
+u32 katie_alloc_kind_push(Katie_AllocKind kind) {
+    u32 saved = alloc_kind;
+    alloc_kind = kind;
+    return saved;
+}
+
+void katie_alloc_kind_pop(u32 saved) {
+    alloc_kind = saved;
+}
+
+u32 katie_alloc_frame_push(u32 frame) {
+    u32 saved = alloc_frame;
+    alloc_frame = frame;
+    return saved;
+}
+
+void katie_alloc_frame_pop(u32 saved) {
+    alloc_frame = saved;
+}
+
+static void *allocs_xcalloc(usize count, usize size) {
+    void *ptr = calloc(count, size);
+    if (!ptr) die("calloc");
+    return ptr;
+}
+
+static u32 allocs_hash(void *ptr) {
+    u64 h = (u64)(uintptr_t)ptr * 0x9e3779b97f4a7c15ull;
+    return (u32)(h >> 32);
+}
+
+static u32 allocs_tag(Katie_Allocs *a, u32 kind, u32 frame) {
+    usize at = (usize)frame * Katie_AllocKind_Count + kind;
+
+    if (at >= a->tag_index_capacity) {
+        u32 capacity = a->tag_index_capacity ? a->tag_index_capacity : 256;
+        u32 *index;
+
+        while (capacity <= at)
+            capacity *= 2;
+        index = allocs_xcalloc(capacity, sizeof(u32));
+        if (a->tag_index) memcpy(index, a->tag_index, a->tag_index_capacity * sizeof(u32));
+        free(a->tag_index);
+        a->tag_index = index;
+        a->tag_index_capacity = capacity;
+    }
+
+    if (!a->tag_index[at]) {
+        if (a->tags_count == a->tags_capacity) {
+            a->tags_capacity = a->tags_capacity ? a->tags_capacity * 2 : 64;
+            a->tags = realloc(a->tags, a->tags_capacity * sizeof(Katie_AllocTag));
+            if (!a->tags) die("realloc");
+        }
+        memset(&a->tags[a->tags_count], 0, sizeof(Katie_AllocTag));
+        a->tags[a->tags_count].kind = kind;
+        a->tags[a->tags_count].frame = frame;
+        a->tag_index[at] = a->tags_count++;
+    }
+    return a->tag_index[at];
+}
+
+static void allocs_insert(Katie_AllocEntry *entries, u32 capacity, Katie_AllocEntry entry) {
+    u32 slot = allocs_hash(entry.ptr) & (capacity - 1);
+    while (entries[slot].ptr)
+        slot = (slot + 1) & (capacity - 1);
+    entries[slot] = entry;
+}
+
+static void allocs_grow(Katie_Allocs *a) {
+    u32 capacity = a->entries_capacity ? a->entries_capacity * 2 : 4096;
+    Katie_AllocEntry *entries = allocs_xcalloc(capacity, sizeof(Katie_AllocEntry));
+
+    for (u32 i = 0; i < a->entries_capacity; ++i) {
+        if (a->entries[i].ptr) allocs_insert(entries, capacity, a->entries[i]);
+    }
+    free(a->entries);
+    a->entries = entries;
+    a->entries_capacity = capacity;
+}
+
+/* Takes a freed allocation off the live totals, false when it was never tracked */
+static bool allocs_remove(Katie_Allocs *a, void *ptr) {
+    u32 mask = a->entries_capacity - 1;
+    u32 hole, slot, home;
+    Katie_AllocTag *tag;
+
+    if (!a->entries_capacity) return false;
+    for (hole = allocs_hash(ptr) & mask; a->entries[hole].ptr != ptr; hole = (hole + 1) & mask) {
+        if (!a->entries[hole].ptr) return false;
+    }
+
+    tag = &a->tags[a->entries[hole].tag];
+    tag->live -= 1;
+    tag->live_bytes -= a->entries[hole].size;
+    a->live_bytes -= a->entries[hole].size;
+    a->entries_count -= 1;
+
+    /* backward shift, as in env_remove */
+    slot = hole;
+    for (;;) {
+        slot = (slot + 1) & mask;
+        if (!a->entries[slot].ptr) break;
+
+        home = allocs_hash(a->entries[slot].ptr) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            a->entries[hole] = a->entries[slot];
+            hole = slot;
+        }
+    }
+    a->entries[hole].ptr = NULL;
+    return true;
+}
+
+static void allocs_on_alloc(void *ptr, usize size) {
+    Katie_Allocs *a = &katie_allocs;
+    Katie_AllocEntry entry = {.ptr = ptr, .size = size};
+    Katie_AllocTag *tag;
+
+    pthread_mutex_lock(&a->lock);
+    allocs_remove(a, ptr); /* left behind by a plain free() */
+    if ((a->entries_count + 1) * 4 > a->entries_capacity * 3) allocs_grow(a);
+
+    entry.tag = allocs_tag(a, alloc_kind, alloc_frame);
+    allocs_insert(a->entries, a->entries_capacity, entry);
+    a->entries_count += 1;
+
+    tag = &a->tags[entry.tag];
+    tag->allocs += 1;
+    tag->bytes += size;
+    tag->live += 1;
+    tag->live_bytes += size;
+    if (tag->live_bytes > tag->peak_bytes) tag->peak_bytes = tag->live_bytes;
+    a->live_bytes += size;
+    if (a->live_bytes > a->peak_bytes) a->peak_bytes = a->live_bytes;
+    pthread_mutex_unlock(&a->lock);
+}
+
+static void allocs_on_free(void *ptr) {
+    pthread_mutex_lock(&katie_allocs.lock);
+    allocs_remove(&katie_allocs, ptr);
+    pthread_mutex_unlock(&katie_allocs.lock);
+}
+
+static int allocs_compare_tags(const void *lhs, const void *rhs) {
+    u64 l = ((Katie_AllocTag const *)lhs)->peak_bytes;
+    u64 r = ((Katie_AllocTag const *)rhs)->peak_bytes;
+    return l < r ? 1 : l > r ? -1 : 0;
+}
+
+static void allocs_report_tags(FILE *stream) {
+    Katie_Allocs *a = &katie_allocs;
+    Katie_AllocTag *tags;
+    u32 count;
+    u64 allocs = 0, bytes = 0, live = 0;
+
+    pthread_mutex_lock(&a->lock);
+    basic_on_alloc = NULL;
+    basic_on_free = NULL;
+    a->is_enabled = false;
+    count = a->tags_count ? a->tags_count - 1 : 0;
+    tags = allocs_xcalloc(count ? count : 1, sizeof(Katie_AllocTag));
+    if (count) memcpy(tags, a->tags + 1, count * sizeof(Katie_AllocTag));
+    pthread_mutex_unlock(&a->lock);
+
+    qsort(tags, count, sizeof(Katie_AllocTag), allocs_compare_tags);
+    fprintf(stream, "  %-8s %10s %12s %10s %12s %12s  %s\n", "kind", "allocs", "bytes", "live",
+            "live bytes", "peak bytes", "site");
+    for (u32 i = 0; i < count; ++i) {
+        String site;
+
+        allocs += tags[i].allocs;
+        bytes += tags[i].bytes;
+        live += tags[i].live;
+        if (i >= KATIE_ALLOCS_REPORT_TAGS) continue;
+
+        site = tags[i].frame ? katie_profile_append_label(make_string_empty(), tags[i].frame)
+                             : append_cstring(make_string_empty(), "-");
+        fprintf(stream, "  %-8s %10llu %12llu %10llu %12llu %12llu  %s\n",
+                katie_alloc_kind_to_cstring[tags[i].kind], (unsigned long long)tags[i].allocs,
+                (unsigned long long)tags[i].bytes, (unsigned long long)tags[i].live,
+                (unsigned long long)tags[i].live_bytes, (unsigned long long)tags[i].peak_bytes,
+                site);
+        free_string(site);
+    }
+    if (count > KATIE_ALLOCS_REPORT_TAGS)
+        fprintf(stream, "  ... %u more tags\n", count - KATIE_ALLOCS_REPORT_TAGS);
+
+    fprintf(stream, "  %-8s %10llu %12llu %10llu %12llu %12llu\n", "total",
+            (unsigned long long)allocs, (unsigned long long)bytes, (unsigned long long)live,
+            (unsigned long long)a->live_bytes, (unsigned long long)a->peak_bytes);
+    free(tags);
+}
+#endif
+
+/* Installs the xmalloc hooks, false when they were compiled out */
+bool katie_allocs_start(void) {
+#ifdef KATIE_ALLOCS
+    Katie_Allocs *a = &katie_allocs;
+
+    a->tags_count = 1;
+    a->tags_capacity = 64;
+    a->tags = allocs_xcalloc(a->tags_capacity, sizeof(Katie_AllocTag));
+    basic_on_alloc = allocs_on_alloc;
+    basic_on_free = allocs_on_free;
+    a->is_enabled = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Stops tracking and prints the tags which held the most memory at their peak */
+void katie_allocs_report(FILE *stream) {
+    fprintf(stream, "allocs:\n");
+#ifdef KATIE_ALLOCS
+    allocs_report_tags(stream);
+#else
+    fprintf(stream, "  tracking compiled out, build with -DAllocs\n");
+#endif
+}
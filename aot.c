@@ -0,0 +1,433 @@
+#include "katie.h"
+
+#include <math.h>
+
+// --------------------------------------------------------------------------
+//                          - Ahead of Time -
+// --------------------------------------------------------------------------
+/*
+ * `katie --emit-c module.kat` reads and optimizes the module as a run of it would, then writes a
+ * C program with three parts: a fn per `fn` form, its bytecode translated instruction by
+ * instruction into C with the stack slots as locals, a builder allocating the optimized module
+ * node by node, and a table tying the two together.
+ *
+ * The program builds and resolves its module, compiles the bytecode of every fn form as the
+ * first call would and hands it the C translation, which katie_run_code then runs in place of
+ * the bytecode. Both sides find the fn forms with aot_fn_forms, so the nth translation belongs
+ * to the nth form. A bytecode compiler that changed since the C was emitted leaves that fn to
+ * the interpreter rather than running C of a different bytecode.
+ *
+ * The C calls the helpers of the interpreter, so it behaves exactly as the bytecode would; what
+ * it gains is the dispatch, the stack traffic, and constants the C compiler can see.
+ */
+static char *aot_filepath; /* of the module the running program was emitted from */
+
+static char *aot_special_names[] = {
+    [Katie_Special_Def] = "Katie_Special_Def", [Katie_Special_Let] = "Katie_Special_Let",
+    [Katie_Special_If] = "Katie_Special_If",   [Katie_Special_Do] = "Katie_Special_Do",
+    [Katie_Special_Fn] = "Katie_Special_Fn",   [Katie_Special_Defn] = "Katie_Special_Defn",
+};
+
+/* `fn` forms which evaluate to a closure, depth first in source order */
+static void aot_fn_forms(KatieVal *val, Array(KatieVal *) * forms) {
+    Array(KatieVal *) list;
+
+    if (val->kind != KatieValKind_List) return;
+    list = val->as.list;
+
+    if (array_length(list) == 3 && list[0]->kind == KatieValKind_Special &&
+        list[0]->as.special == Katie_Special_Fn && list[1]->kind == KatieValKind_List &&
+        KATIE_FN_SITE(list[0])->info) {
+        array_push((*forms), val);
+    }
+    array_for_each(list, i) { aot_fn_forms(list[i], forms); }
+}
+
+/* `(fn x number)` of a number known when the C was emitted, so the C compiler folds it in */
+static inline KatieVal *aot_arith_const(Katie *ctx, KatieVal *fn, KatieVal *x, i64 number,
+                                        KatieVal *number_val) {
+    i64 result;
+
+    if (x->kind == KatieValKind_Number) {
+        if (vm_is_native(fn, native_op_add) &&
+            !__builtin_add_overflow(x->as.number, number, &result))
+            return alloc_number(result);
+        if (vm_is_native(fn, native_op_sub) &&
+            !__builtin_sub_overflow(x->as.number, number, &result))
+            return alloc_number(result);
+    }
+    return vm_arith_const(ctx, fn, x, number_val);
+}
+
+// --------------------------------------------------------------------------
+//                          - Program -
+// --------------------------------------------------------------------------
+KatieVal *katie_aot_list(usize count, ...) {
+    Array(KatieVal *) list;
+    va_list args;
+
+    array_reserve(list, count);
+    va_start(args, count);
+    for (usize i = 0; i < count; ++i) {
+        array_push(list, va_arg(args, KatieVal *));
+    }
+    va_end(args);
+    return alloc_list(list);
+}
+
+KatieVal *katie_aot_symbol(char *name, usize row, usize col) {
+    KatieVal *val = alloc_symbol(name, strlen(name));
+    KATIE_SYMBOL_SITE(val)->filepath = aot_filepath;
+    KATIE_SYMBOL_SITE(val)->pos = (TokenPos){.row = row, .col = col};
+    return val;
+}
+
+KatieVal *katie_aot_fn(usize row, usize col) {
+    KatieVal *val = alloc_special(Katie_Special_Fn);
+    KATIE_FN_SITE(val)->filepath = aot_filepath;
+    KATIE_FN_SITE(val)->pos = (TokenPos){.row = row, .col = col};
+    return val;
+}
+
+KatieVal *katie_aot_bignum(char *digits, bool is_negative) {
+    BigNum bignum = bignum_from_text(digits, strlen(digits));
+    bignum.negative = is_negative && !bignum_is_zero(bignum);
+    return alloc_bignum(bignum);
+}
+
+/* Runs the module of a program `--emit-c` wrote, as `katie module.kat` would */
+int katie_aot_main(Katie_AotProgram *program) {
+    Katie k;
+    Katie_Module *module;
+    Array(KatieVal *) forms;
+
+    aot_filepath = program->source_filepath;
+    module = program->build();
+    katie_resolve_module(module);
+
+    init_array(forms);
+    aot_fn_forms(module, &forms);
+    if (array_length(forms) == program->fn_count) {
+        array_for_each(forms, i) {
+            Array(KatieVal *) list = forms[i]->as.list;
+            Katie_Code *code = katie_fn_code(KATIE_FN_SITE(list[0])->info, list[1], list[2]);
+            if (array_length(code->ops) == program->fns[i].ops_length)
+                code->jit = program->fns[i].run;
+        }
+    } else {
+        eprintln("warning: %s has %zu fns, %u were compiled, running the interpreter",
+                 aot_filepath, array_length(forms), program->fn_count);
+    }
+    free_array(forms);
+
+    init_katie_ctx(&k);
+    katie_take_module(&k, module);
+    deinit_katie_ctx(&k);
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+//                          - Emit -
+// --------------------------------------------------------------------------
+static void emit_c_string(FILE *stream, char *text, usize length) {
+    fputc('"', stream);
+    for (usize i = 0; i < length; ++i) {
+        u8 c = (u8)text[i];
+        if (c == '"' || c == '\\') fprintf(stream, "\\%c", c);
+        else if (c < ' ' || c > '~') fprintf(stream, "\\%03o", c);
+        else fputc(c, stream);
+    }
+    fputc('"', stream);
+}
+
+/* Whether every node is one the reader or the optimizer makes, NULL if so */
+static KatieVal *emit_c_unsupported(KatieVal *val) {
+    switch (val->kind) {
+    case KatieValKind_List:
+        array_for_each(val->as.list, i) {
+            KatieVal *unsupported = emit_c_unsupported(val->as.list[i]);
+            if (unsupported) return unsupported;
+        }
+        return NULL;
+
+    case KatieValKind_Bool:
+    case KatieValKind_Number:
+    case KatieValKind_BigNum:
+    case KatieValKind_Float:
+    case KatieValKind_String:
+    case KatieValKind_Nil:
+    case KatieValKind_Special:
+    case KatieValKind_Symbol: return NULL;
+    default: return val;
+    }
+}
+
+static void emit_c_indent(FILE *stream, u32 depth) {
+    fprintf(stream, "%*s", (int)(4 * depth), "");
+}
+
+static void emit_c_val(FILE *stream, KatieVal *val, u32 depth) {
+    switch (val->kind) {
+    case KatieValKind_List:
+        fprintf(stream, "katie_aot_list(%zu", array_length(val->as.list));
+        array_for_each(val->as.list, i) {
+            fprintf(stream, ",\n");
+            emit_c_indent(stream, depth + 1);
+            emit_c_val(stream, val->as.list[i], depth + 1);
+        }
+        fprintf(stream, ")");
+        return;
+
+    case KatieValKind_Bool:
+        fprintf(stream, "alloc_bool(%s)", val->as._bool ? "true" : "false");
+        return;
+    case KatieValKind_Nil: fprintf(stream, "alloc_nil()"); return;
+
+    case KatieValKind_Number:
+        if (val->as.number == I64_MIN) fprintf(stream, "alloc_number(I64_MIN)");
+        else fprintf(stream, "alloc_number(INT64_C(%ld))", val->as.number);
+        return;
+
+    case KatieValKind_BigNum: {
+        BigNum magnitude = val->as.bignum;
+        String digits = make_string_empty();
+
+        magnitude.negative = false;
+        digits = bignum_append_string(digits, magnitude);
+        fprintf(stream, "katie_aot_bignum(\"%s\", %s)", digits,
+                val->as.bignum.negative ? "true" : "false");
+        free_string(digits);
+        return;
+    }
+
+    case KatieValKind_Float:
+        if (isnan(val->as._float)) fprintf(stream, "alloc_float(NAN)");
+        else if (isinf(val->as._float))
+            fprintf(stream, "alloc_float(%sINFINITY)", val->as._float < 0 ? "-" : "");
+        else fprintf(stream, "alloc_float(%a)", val->as._float);
+        return;
+
+    case KatieValKind_String:
+        fprintf(stream, "alloc_string(make_string(");
+        emit_c_string(stream, val->as.string, string_length(val->as.string));
+        fprintf(stream, ", %zu))", string_length(val->as.string));
+        return;
+
+    case KatieValKind_Special:
+        if (val->as.special == Katie_Special_Fn) {
+            fprintf(stream, "katie_aot_fn(%zu, %zu)", KATIE_FN_SITE(val)->pos.row,
+                    KATIE_FN_SITE(val)->pos.col);
+        } else {
+            fprintf(stream, "alloc_special(%s)", aot_special_names[val->as.special]);
+        }
+        return;
+
+    case KatieValKind_Symbol:
+        fprintf(stream, "katie_aot_symbol(");
+        emit_c_string(stream, val->as.symbol.name, string_length(val->as.symbol.name));
+        fprintf(stream, ", %zu, %zu)", KATIE_SYMBOL_SITE(val)->pos.row,
+                KATIE_SYMBOL_SITE(val)->pos.col);
+        return;
+
+    default: Unreachable();
+    }
+}
+
+/* Stack depth before each instruction, jumps only go forward to where a branch joins */
+static Array(u32) emit_c_depths(Katie_Code *code) {
+    Array(u32) depths;
+    u32 depth = 0;
+
+    array_reserve(depths, array_length(code->ops));
+    array_length(depths) = array_length(code->ops);
+    array_for_each(depths, i) { depths[i] = U32_MAX; }
+
+    for (u32 ip = 0; ip < array_length(code->ops); ip += 1 + katie_op_operands[code->ops[ip]]) {
+        if (depths[ip] != U32_MAX) depth = depths[ip];
+        depths[ip] = depth;
+
+        switch (code->ops[ip]) {
+        case Katie_Op_Const:
+        case Katie_Op_Nil:
+        case Katie_Op_Load:
+        case Katie_Op_LoadLocal:
+        case Katie_Op_MakeFn:
+        case Katie_Op_Eval: depth += 1; break;
+        case Katie_Op_Pop:
+        case Katie_Op_ArithConst:
+        case Katie_Op_Return: depth -= 1; break;
+        case Katie_Op_Call: depth -= code->ops[ip + 1]; break;
+        case Katie_Op_Jump: depths[code->ops[ip + 1]] = depth; break;
+        case Katie_Op_JumpIfFalse:
+            depth -= 1;
+            depths[code->ops[ip + 1]] = depth;
+            break;
+        case Katie_Op_CompareJump:
+            depth -= 3;
+            depths[code->ops[ip + 1]] = depth;
+            break;
+        default: break;
+        }
+    }
+    return depths;
+}
+
+static void emit_c_fn(FILE *stream, u32 index, Katie_Code *code) {
+    u32 *ops = code->ops;
+    Array(u32) depths = emit_c_depths(code);
+    Array(bool) is_target;
+
+    array_reserve(is_target, array_length(code->ops));
+    array_length(is_target) = array_length(code->ops);
+    array_for_each(is_target, i) { is_target[i] = false; }
+    for (u32 ip = 0; ip < array_length(ops); ip += 1 + katie_op_operands[ops[ip]]) {
+        if (ops[ip] == Katie_Op_Jump || ops[ip] == Katie_Op_JumpIfFalse ||
+            ops[ip] == Katie_Op_CompareJump)
+            is_target[ops[ip + 1]] = true;
+    }
+
+    fprintf(stream,
+            "static KatieVal *aot_fn_%u(Katie *ctx, KatieVal **stack, KatieVal **vals,\n"
+            "                           Katie_JitExit *exit) {\n",
+            index);
+    fprintf(stream, "    KatieVal *s0");
+    for (u32 i = 1; i < code->max_stack; ++i) {
+        fprintf(stream, ", *s%u", i);
+    }
+    fprintf(stream, ";\n\n    (void)exit;\n");
+
+    for (u32 ip = 0; ip < array_length(ops); ip += 1 + katie_op_operands[ops[ip]]) {
+        u32 top = depths[ip] - 1; /* slot of the top, when there is one */
+        u32 operand = ops[ip + (katie_op_operands[ops[ip]] > 0)];
+
+        if (is_target[ip]) fprintf(stream, "op_%u:\n", ip);
+        switch (ops[ip]) {
+        case Katie_Op_Const: fprintf(stream, "    s%u = vals[%u];\n", top + 1, operand); break;
+        case Katie_Op_Nil: fprintf(stream, "    s%u = alloc_nil();\n", top + 1); break;
+        case Katie_Op_Load:
+            fprintf(stream, "    s%u = vm_load(ctx, vals[%u]);\n", top + 1, operand);
+            break;
+        case Katie_Op_LoadLocal:
+            fprintf(stream, "    s%u = vm_load_local(ctx, vals[%u]);\n", top + 1, operand);
+            break;
+        case Katie_Op_Def:
+            fprintf(stream, "    katie_define(ctx, ctx->env, vals[%u]->as.symbol, s%u);\n",
+                    operand, top);
+            break;
+        case Katie_Op_Pop: break;
+        case Katie_Op_Jump: fprintf(stream, "    goto op_%u;\n", operand); break;
+        case Katie_Op_JumpIfFalse:
+            fprintf(stream,
+                    "    if (s%u->kind != KatieValKind_Bool || !s%u->as._bool) goto op_%u;\n",
+                    top, top, operand);
+            break;
+
+        case Katie_Op_Call:
+            if (operand == 0) {
+                fprintf(stream, "    s%u = katie_apply(ctx, s%u, 0, stack);\n", top, top);
+                break;
+            }
+            fprintf(stream, "    {\n        KatieVal *argv[] = {");
+            for (u32 i = 0; i < operand; ++i) {
+                fprintf(stream, "%ss%u", i ? ", " : "", top - operand + 1 + i);
+            }
+            fprintf(stream, "};\n        s%u = katie_apply(ctx, s%u, %u, argv);\n    }\n",
+                    top - operand, top - operand, operand);
+            break;
+
+        case Katie_Op_MakeFn:
+            fprintf(stream, "    s%u = katie_make_closure(ctx, vals[%u]);\n", top + 1, operand);
+            break;
+        case Katie_Op_Eval:
+            fprintf(stream, "    s%u = katie_eval(ctx, vals[%u]);\n", top + 1, operand);
+            break;
+        case Katie_Op_Return: fprintf(stream, "    return s%u;\n", top); break;
+
+        case Katie_Op_ArithConst:
+            fprintf(stream,
+                    "    s%u = aot_arith_const(ctx, s%u, s%u, INT64_C(%ld), vals[%u]);\n",
+                    top - 1, top - 1, top, code->vals[operand]->as.number, operand);
+            break;
+        case Katie_Op_LoadLocalArith:
+            fprintf(stream,
+                    "    s%u = aot_arith_const(ctx, s%u, vm_load_local(ctx, vals[%u]), "
+                    "INT64_C(%ld), vals[%u]);\n",
+                    top, top, operand, code->vals[ops[ip + 2]]->as.number, ops[ip + 2]);
+            break;
+        case Katie_Op_CompareJump:
+            fprintf(stream, "    if (!vm_compare(ctx, s%u, s%u, s%u)) goto op_%u;\n", top - 2,
+                    top - 1, top, operand);
+            break;
+
+        default: Unreachable();
+        }
+    }
+    fprintf(stream, "}\n\n");
+
+    free_array(depths);
+    free_array(is_target);
+}
+
+/* Writes the C program of a module to `stream`, returns the exit status */
+int katie_emit_c(FILE *stream, char *source_filepath) {
+    String source = file_as_string(source_filepath);
+    Katie_Module *module;
+    Array(KatieVal *) forms;
+    Array(Katie_Code *) codes;
+    KatieVal *unsupported;
+
+    if (!source) {
+        eprintln("error: failed to open: %s", source_filepath);
+        return EXIT_FAILURE;
+    }
+    module = katie_read_source(source_filepath, source, Katie_OptimizeLevel_Program, NULL);
+    free_string(source);
+    if (!module) {
+        eprintln("error: failed to read: %s", source_filepath);
+        return EXIT_FAILURE;
+    }
+    unsupported = emit_c_unsupported(module);
+    if (unsupported) {
+        eprintln("error: %s: a %s can not be emitted as C", source_filepath,
+                 katie_val_kind_to_cstring[unsupported->kind]);
+        dealloc_val(module);
+        return EXIT_FAILURE;
+    }
+
+    init_array(forms);
+    init_array(codes);
+    aot_fn_forms(module, &forms);
+
+    fprintf(stream, "/* Generated by `katie --emit-c %s`, build: AOT=file.c ./build.sh aot */\n",
+            source_filepath);
+    fprintf(stream, "#include \"runtime.c\"\n\n");
+
+    array_for_each(forms, i) {
+        Array(KatieVal *) list = forms[i]->as.list;
+        Katie_Code *code = katie_fn_code(KATIE_FN_SITE(list[0])->info, list[1], list[2]);
+        array_push(codes, code);
+        emit_c_fn(stream, (u32)i, code);
+    }
+
+    fprintf(stream, "static Katie_Module *aot_build(void) {\n    return ");
+    emit_c_val(stream, module, 1);
+    fprintf(stream, ";\n}\n\n");
+
+    fprintf(stream, "static Katie_AotFn aot_fns[] = {\n");
+    array_for_each(codes, i) {
+        fprintf(stream, "    {aot_fn_%zu, %zu},\n", i, array_length(codes[i]->ops));
+    }
+    if (array_is_empty(codes)) fprintf(stream, "    {NULL, 0},\n");
+    fprintf(stream, "};\n\n");
+
+    fprintf(stream, "static Katie_AotProgram aot_program = {\n    .source_filepath = ");
+    emit_c_string(stream, source_filepath, strlen(source_filepath));
+    fprintf(stream, ",\n    .build = aot_build,\n    .fns = aot_fns,\n    .fn_count = %zu,\n};\n\n",
+            array_length(codes));
+    fprintf(stream, "int main(void) {\n    return katie_aot_main(&aot_program);\n}\n");
+
+    free_array(forms);
+    free_array(codes);
+    dealloc_val(module);
+    return 0;
+}
@@ -10,18 +10,53 @@ void die(const char *fmt) {
     exit(1);
 }
 
+#ifdef Bench
+u64 basic_alloc_count, basic_alloc_bytes;
+
+static void basic_count_alloc(usize size) {
+    __atomic_fetch_add(&basic_alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&basic_alloc_bytes, size, __ATOMIC_RELAXED);
+}
+#else
+#define basic_count_alloc(size)
+#endif
+
+#ifdef BASIC_ALLOC_HOOKS
+void (*basic_on_alloc)(void *ptr, usize size);
+void (*basic_on_free)(void *ptr);
+
+#define basic_hook_alloc(ptr, size)                                                                \
+    if (basic_on_alloc) basic_on_alloc(ptr, size)
+#define basic_hook_free(ptr)                                                                       \
+    if (basic_on_free && (ptr)) basic_on_free(ptr)
+#else
+#define basic_hook_alloc(ptr, size)
+#define basic_hook_free(ptr)
+#endif
+
 void *xmalloc(usize size) {
     void *ptr = malloc(size);
     if (!ptr) die("malloc");
+    basic_count_alloc(size);
+    basic_hook_alloc(ptr, size);
     return ptr;
 }
 
 void *xrealloc(void *ptr, usize size) {
-    void *_ptr = realloc(ptr, size);
+    void *_ptr;
+    basic_hook_free(ptr);
+    _ptr = realloc(ptr, size);
     if (!_ptr) die("realloc");
+    basic_count_alloc(size);
+    basic_hook_alloc(_ptr, size);
     return _ptr;
 }
 
+void xfree(void *ptr) {
+    basic_hook_free(ptr);
+    free(ptr);
+}
+
 void m_puts(char *cstring) {
     while (*cstring)
         putc(*cstring++, stdout);
@@ -83,9 +118,10 @@ void report_assertion_failure(char *prefix, const char *filename, usize line_num
 String string_reserve(usize cap) {
     StringHeader *h;
 
-    h = (StringHeader *)malloc(sizeof(StringHeader) + cap + 1);
+    h = (StringHeader *)xmalloc(sizeof(StringHeader) + cap + 1);
     h->length = 0;
     h->capacity = cap;
+    ((String)(h + 1))[0] = '\0';
 
     return (String)(h + 1);
 }
@@ -104,20 +140,27 @@ String make_string(char *str, usize len) {
 
 String string_reset(String s) {
     string_length(s) = 0;
+    s[0] = '\0';
     return s;
 }
 
-String append_string_length(String s, char *str, usize len) {
+/* Grows `s` so that at least `len` more bytes fit after its length */
+String string_make_room(String s, usize len) {
     usize cap;
     usize rem = string_capacity(s) - string_length(s);
 
     if (rem < len) {
         StringHeader *h = STRING_HEADER(s);
-        cap = h->capacity + len + (1 << 6);
+        cap = 2 * h->capacity + len + (1 << 6); /* geometric, appends stay amortized O(1) */
         h = (StringHeader *)xrealloc(h, sizeof(StringHeader) + cap + 1);
         h->capacity = cap;
         s = (String)(h + 1);
     }
+    return s;
+}
+
+String append_string_length(String s, char *str, usize len) {
+    s = string_make_room(s, len);
 
     memcpy(&s[string_length(s)], str, len);
     string_length(s) += len;
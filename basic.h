@@ -2,6 +2,7 @@
 #define __basic_h__
 
 #include <assert.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -80,6 +81,20 @@ typedef ptrdiff_t isize;
 void die(const char *fmt);
 void *xmalloc(usize size);
 void *xrealloc(void *ptr, usize size);
+void xfree(void *ptr);
+
+#if !defined(Release) || defined(Allocs)
+#define BASIC_ALLOC_HOOKS
+/* Told of every xmalloc, xrealloc and xfree while set, a realloc frees `ptr` then allocates */
+extern void (*basic_on_alloc)(void *ptr, usize size);
+extern void (*basic_on_free)(void *ptr);
+#endif
+
+#ifdef Bench
+/* Every allocation made through xmalloc and xrealloc so far, by every thread */
+extern u64 basic_alloc_count, basic_alloc_bytes;
+#endif
+
 void m_puts(char *cstring);
 
 // --------------------------------------------------------------------------
@@ -226,7 +241,7 @@ struct ArrayHeader {
 #define Array(Type) Type *
 #define array_length(a) ARRAY_HEADER(a)->length
 #define array_capacity(a) ARRAY_HEADER(a)->capacity
-#define free_array(a) free(ARRAY_HEADER(a))
+#define free_array(a) xfree(ARRAY_HEADER(a))
 #define array_is_empty(a) (array_length(a) == 0)
 #define array_for_each(a, counter)                                                                 \
     for (usize(counter) = 0; (counter) < array_length(a); ++(counter))
@@ -251,7 +266,7 @@ struct ArrayHeader {
             memmove(nh, h, sizeof(ArrayHeader) + sizeof(*(a)) * array_length(a));                  \
             nh->capacity = ARRAY_GROW_FORMULA(array_length(a));                                    \
             nh->length = h->length;                                                                \
-            free(h);                                                                               \
+            xfree(h);                                                                              \
             *__array = (void *)(nh + 1);                                                           \
         }                                                                                          \
         a[array_length(a)] = VAL;                                                                  \
@@ -278,7 +293,7 @@ void main(void) {
 typedef char *String;
 
 #define STRING_HEADER(s) ((StringHeader *)(s)-1)
-#define free_string(s) free(STRING_HEADER(s))
+#define free_string(s) xfree(STRING_HEADER(s))
 #define string_length(s) (STRING_HEADER(s)->length)
 #define string_capacity(s) (STRING_HEADER(s)->capacity)
 #define string_for_each(s, i) for (usize i = 0; i < string_length(s); ++i)
@@ -295,6 +310,7 @@ String string_reserve(usize cap);
 String make_string_empty();
 String make_string(char *str, usize len);
 String string_reset(String s);
+String string_make_room(String s, usize len);
 String append_string_length(String s, char *str, usize len);
 bool are_strings_equal(String lhs, String rhs);
 bool are_strings_equal_length(String lhs, char *rhs, usize rhs_length);
@@ -0,0 +1,160 @@
+#include "katie.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------
+//                          - Batch -
+// --------------------------------------------------------------------------
+/*
+ * `katie --batch requests.txt` evaluates a stream of requests, one per line or, with
+ * --length-prefixed, each framed by a u32 big endian length as with --serve. `-` reads stdin.
+ * Every request runs in the same context, so definitions persist, and answers with exactly one
+ * line: the printed results of its forms separated by spaces, or `error: <message>`.
+ *
+ * The input buffer, the source buffer and the reader's tokens are reused from one request to the
+ * next, answers accumulate in the context output and are written out in large chunks.
+ */
+#define KATIE_BATCH_READ_SIZE (64u << 10)
+#define KATIE_BATCH_FLUSH_SIZE (64u << 10)
+
+typedef struct Katie_Batch Katie_Batch;
+struct Katie_Batch {
+    Katie ctx;
+    Katie_Reader reader;
+    String source;                  /* NUL terminated copy of the current request */
+    Array(Katie_Module *) retained; /* modules the context may still refer to */
+};
+
+/* Values a def or a fn form leaves behind point into the module they were read from */
+static bool batch_is_retained(KatieVal *val) {
+    if (val->kind == KatieValKind_Special)
+        return val->as.special == Katie_Special_Def || val->as.special == Katie_Special_Fn;
+    if (val->kind != KatieValKind_List) return false;
+
+    array_for_each(val->as.list, i) {
+        if (batch_is_retained(val->as.list[i])) return true;
+    }
+    return false;
+}
+
+static void batch_eval(Katie_Batch *b, char *text, usize length) {
+    Katie *ctx = &b->ctx;
+    usize begin = string_length(ctx->output);
+    Katie_Module *module;
+
+    b->source = append_string_length(string_reset(b->source), text, length);
+    katie_reset_reader(&b->reader, b->source);
+    module = katie_read_module(&b->reader);
+    if (!module) {
+        ctx->output = append_cstring(ctx->output, "error: syntax error\n");
+        return;
+    }
+    katie_optimize_module(module, Katie_OptimizeLevel_Module);
+    katie_resolve_module(module);
+
+    if (katie_try_eval_module(ctx, module)) {
+        usize end = string_length(ctx->output);
+        if (end == begin) {
+            ctx->output = append_cstring(ctx->output, "\n");
+        } else {
+            for (usize i = begin; i + 1 < end; ++i) { /* one line per request */
+                if (ctx->output[i] == '\n') ctx->output[i] = ' ';
+            }
+        }
+    } else {
+        string_length(ctx->output) = begin;
+        ctx->output = append_cstring(ctx->output, "error: ");
+        ctx->output = append_string_length(ctx->output, ctx->error, string_length(ctx->error));
+        ctx->output = append_cstring(ctx->output, "\n");
+    }
+
+    if (batch_is_retained(module)) {
+        array_push(b->retained, module);
+    } else {
+        dealloc_val(module);
+    }
+
+    if (string_length(ctx->output) >= KATIE_BATCH_FLUSH_SIZE) katie_flush_output(ctx, stdout);
+}
+
+/* Evaluates every complete request of `in`, returns how many bytes were consumed */
+static usize batch_eval_requests(Katie_Batch *b, String in, bool is_length_prefixed,
+                                 bool is_end) {
+    usize begin = 0, length = string_length(in);
+
+    while (begin < length) {
+        if (is_length_prefixed) {
+            u8 *header = (u8 *)in + begin;
+            u32 size;
+
+            if (length - begin < 4) break;
+            size = (u32)header[0] << 24 | (u32)header[1] << 16 | (u32)header[2] << 8 | header[3];
+            if (length - begin - 4 < size) break;
+
+            batch_eval(b, in + begin + 4, size);
+            begin += 4 + (usize)size;
+        } else {
+            char *newline = memchr(in + begin, '\n', length - begin);
+            usize end = newline ? (usize)(newline - in) : length;
+
+            if (!newline && !is_end) break;
+            batch_eval(b, in + begin, end - begin);
+            begin = newline ? end + 1 : end;
+        }
+    }
+    return begin;
+}
+
+int katie_batch(char *input_filepath, bool is_length_prefixed) {
+    Katie_Batch b;
+    String in;
+    usize consumed;
+    bool is_truncated;
+    int fd = 0;
+
+    if (strcmp(input_filepath, "-") != 0) {
+        fd = open(input_filepath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            perror(input_filepath);
+            return EXIT_FAILURE;
+        }
+    }
+
+    init_katie_ctx(&b.ctx);
+    katie_init_reader(&b.reader, "<batch>", "", NULL);
+    b.source = make_string_empty();
+    init_array(b.retained);
+    in = string_reserve(KATIE_BATCH_READ_SIZE);
+
+    for (;;) {
+        isize received;
+
+        in = string_make_room(in, KATIE_BATCH_READ_SIZE);
+        received = read(fd, in + string_length(in), KATIE_BATCH_READ_SIZE);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            die("read");
+        }
+        string_length(in) += (usize)received;
+
+        consumed = batch_eval_requests(&b, in, is_length_prefixed, received == 0);
+        memmove(in, in + consumed, string_length(in) - consumed);
+        string_length(in) -= consumed;
+
+        if (received == 0) break;
+    }
+
+    is_truncated = string_length(in) != 0;
+    katie_flush_output(&b.ctx, stdout);
+    if (is_truncated) eprintln("error: truncated request at the end of the input");
+
+    if (fd != 0) close(fd);
+    free_string(in);
+    free_string(b.source);
+    array_for_each(b.retained, i) { dealloc_val(b.retained[i]); }
+    free_array(b.retained);
+    katie_deinit_reader(&b.reader);
+    deinit_katie_ctx(&b.ctx);
+    return is_truncated ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+
+#include "basic.c"
+#include "bignum.c"
+#include "env.c"
+#include "resolve.c"
+#include "optimize.c"
+#include "stats.c"
+#include "profile.c"
+#include "trace.c"
+#include "allocs.c"
+#include "katie.c"
+#include "vm.c"
+#include "jit.c"
+#include "pool.c"
+#include "native.c"
+#include "seq.c"
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+
+#include <time.h>
+
+// --------------------------------------------------------------------------
+//                          - Bench -
+// --------------------------------------------------------------------------
+/*
+ * `katie-bench` times the lexer, reader, eval, print and end to end phases over a generated
+ * corpus and writes one tab separated row per benchmark and phase, so runs of two commits can be
+ * diffed. Allocations count every xmalloc and xrealloc of a run. `katie-bench env` compares the
+ * env table against the stb_ds maps it replaced, `katie-bench corpus DIR` writes the corpus out.
+ */
+#define BENCH_MIN_RUNS 10
+#define BENCH_MAX_RUNS 1000
+#define BENCH_TARGET_NS 250000000ull /* per benchmark and phase */
+
+/* Previous KatieEnv layout, a stb_ds string hashmap per frame */
+typedef struct Bench_StbEntry Bench_StbEntry;
+struct Bench_StbEntry {
+    char *key;
+    KatieVal *value;
+};
+
+static volatile uintptr bench_sink;
+
+static u64 bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static void bench_report(char *name, usize bindings, f64 katie_ns, f64 stb_ns) {
+    printf("%-12s bindings=%-6zu katie=%8.2f ns/op  stb_ds=%8.2f ns/op  speedup=%5.2fx\n", name,
+           bindings, katie_ns, stb_ns, stb_ns / katie_ns);
+}
+
+/* Inserts `n` bindings into a fresh frame, `rounds` times over */
+static void bench_env_insert(Katie_Symbol *symbols, usize n, usize rounds, KatieVal *val) {
+    u64 start;
+    f64 katie_ns, stb_ns;
+
+    start = bench_now_ns();
+    for (usize r = 0; r < rounds; ++r) {
+        KatieEnv *env = alloc_env(NULL);
+        for (usize i = 0; i < n; ++i)
+            env_put(env, symbols[i], val);
+        bench_sink += env->count;
+        dealloc_env(env);
+    }
+    katie_ns = (f64)(bench_now_ns() - start) / (f64)(rounds * n);
+
+    start = bench_now_ns();
+    for (usize r = 0; r < rounds; ++r) {
+        Bench_StbEntry *entries = NULL;
+        for (usize i = 0; i < n; ++i)
+            shput(entries, symbols[i].name, val);
+        bench_sink += shlenu(entries);
+        shfree(entries);
+    }
+    stb_ns = (f64)(bench_now_ns() - start) / (f64)(rounds * n);
+
+    bench_report("env/insert", n, katie_ns, stb_ns);
+}
+
+/* Looks every binding of an `n` binding frame up in a shuffled order, `rounds` times over */
+static void bench_env_lookup(Katie_Symbol *symbols, usize n, usize rounds, KatieVal *val) {
+    KatieEnv *env = alloc_env(NULL);
+    Bench_StbEntry *entries = NULL;
+    Array(usize) order;
+    u64 start, seed = 0x9e3779b97f4a7c15ull;
+    f64 katie_ns, stb_ns;
+
+    array_reserve(order, n);
+    for (usize i = 0; i < n; ++i) {
+        array_push(order, i);
+        env_put(env, symbols[i], val);
+        shput(entries, symbols[i].name, val);
+    }
+    for (usize i = n; i > 1; --i) {
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        swap(order[i - 1], order[seed % i], usize);
+    }
+
+    start = bench_now_ns();
+    for (usize r = 0; r < rounds; ++r) {
+        for (usize i = 0; i < n; ++i)
+            bench_sink += (uintptr)env_lookup(env, symbols[order[i]]);
+    }
+    katie_ns = (f64)(bench_now_ns() - start) / (f64)(rounds * n);
+
+    start = bench_now_ns();
+    for (usize r = 0; r < rounds; ++r) {
+        for (usize i = 0; i < n; ++i)
+            bench_sink += (uintptr)shget(entries, symbols[order[i]].name);
+    }
+    stb_ns = (f64)(bench_now_ns() - start) / (f64)(rounds * n);
+
+    bench_report("env/lookup", n, katie_ns, stb_ns);
+
+    free_array(order);
+    shfree(entries);
+    dealloc_env(env);
+}
+
+static void bench_env(void) {
+    usize sizes[] = {4, 8, 16, 64, 1024, 16384};
+    usize max_size = sizes[array_sizeof(sizes, usize) - 1];
+    Array(Katie_Symbol) symbols;
+    KatieVal *val = alloc_number(1);
+    char name[32];
+
+    array_reserve(symbols, max_size);
+    for (usize i = 0; i < max_size; ++i) {
+        sprintf(name, "binding-%zu", i);
+        array_push(symbols, katie_intern_cstring(name));
+    }
+
+    for (usize i = 0; i < array_sizeof(sizes, usize); ++i) {
+        usize rounds = 4000000 / sizes[i];
+        bench_env_insert(symbols, sizes[i], rounds, val);
+        bench_env_lookup(symbols, sizes[i], rounds * 4, val);
+    }
+
+    free_array(symbols);
+}
+
+// ------------------------------ Corpus -----------------------------------
+
+static String bench_deep_recursion(void) {
+    return append_cstring(make_string_empty(),
+                          "(def depth (fn (n) (if (= n 0) 0 (+ 1 (depth (- n 1))))))\n"
+                          "(depth 2000)\n(depth 2000)\n(depth 2000)\n");
+}
+
+static String bench_wide_lists(void) {
+    String source = make_string_empty();
+    char buf[32];
+
+    for (int line = 0; line < 20; ++line) {
+        source = append_cstring(source, "(list");
+        for (int i = 0; i < 1000; ++i) {
+            sprintf(buf, " %d", line * 1000 + i);
+            source = append_cstring(source, buf);
+        }
+        source = append_cstring(source, ")\n");
+    }
+    return source;
+}
+
+static String bench_many_globals(void) {
+    String source = make_string_empty();
+    char buf[64];
+
+    for (int i = 0; i < 2000; ++i) {
+        sprintf(buf, "(def global-%d %d)\n", i, i);
+        source = append_cstring(source, buf);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        sprintf(buf, "(+ global-%d global-%d)\n", i, 1999 - i);
+        source = append_cstring(source, buf);
+    }
+    return source;
+}
+
+static String bench_large_literals(void) {
+    String source = make_string_empty();
+    char buf[32];
+
+    for (int line = 0; line < 200; ++line) {
+        for (int i = 0; i < 30; ++i) { /* 300 digit integers read as bignums */
+            sprintf(buf, "%010d", line * 7919 + i * 104729 + 1);
+            source = append_cstring(source, buf);
+        }
+        sprintf(buf, "\n%d.%06d\n", line, line * 4001 % 1000000);
+        source = append_cstring(source, buf);
+    }
+    return source;
+}
+
+static String bench_closures(void) {
+    String source = append_cstring(make_string_empty(),
+                                   "(def adder (fn (x) (fn (y) (+ x y))))\n"
+                                   "(def compose (fn (f g) (fn (x) (f (g x)))))\n");
+    char buf[96];
+
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(buf, "((compose (adder %d) (adder 1)) %d)\n", i, i);
+        source = append_cstring(source, buf);
+    }
+    return source;
+}
+
+typedef struct Bench_Source Bench_Source;
+struct Bench_Source {
+    char *name;
+    String (*generate)(void);
+};
+
+static Bench_Source bench_corpus[] = {
+    {"deep-recursion", bench_deep_recursion}, {"wide-lists", bench_wide_lists},
+    {"many-globals", bench_many_globals},     {"large-literals", bench_large_literals},
+    {"closures", bench_closures},
+};
+
+/* Writes every source of the corpus to `dir` as <name>.kat, the training runs of PGO builds */
+static void bench_write_corpus(char *dir) {
+    for (usize i = 0; i < array_sizeof(bench_corpus, Bench_Source); ++i) {
+        String source = bench_corpus[i].generate();
+        char filepath[4096];
+        FILE *file;
+
+        snprintf(filepath, sizeof(filepath), "%s/%s.kat", dir, bench_corpus[i].name);
+        file = fopen(filepath, "w");
+        if (!file) die(filepath);
+        fwrite(source, 1, string_length(source), file);
+        fclose(file);
+        free_string(source);
+    }
+}
+
+// ------------------------------ Phases -----------------------------------
+
+typedef struct Bench_Case Bench_Case;
+struct Bench_Case {
+    char *name;
+    String source;             /* pristine, the lexer ends lines in the copies it scans */
+    String lexed_source;       /* text of `tokens` */
+    Array(Token) tokens;       /* lexed once, input of the reader phase */
+    Katie_Module *module;      /* read once, input of the eval phase */
+    Array(KatieVal *) results; /* of one evaluation, input of the print phase */
+};
+
+typedef struct Bench_Sample Bench_Sample;
+struct Bench_Sample {
+    u64 ns, allocs, bytes;
+};
+
+static void bench_sample_begin(Bench_Sample *sample) {
+    sample->allocs = basic_alloc_count;
+    sample->bytes = basic_alloc_bytes;
+    sample->ns = bench_now_ns();
+}
+
+static void bench_sample_end(Bench_Sample *sample) {
+    sample->ns = bench_now_ns() - sample->ns;
+    sample->allocs = basic_alloc_count - sample->allocs;
+    sample->bytes = basic_alloc_bytes - sample->bytes;
+}
+
+static String bench_copy_source(Bench_Case *c) {
+    return make_string(c->source, string_length(c->source));
+}
+
+static Bench_Sample bench_phase_lex(Bench_Case *c) {
+    Bench_Sample sample;
+    String source = bench_copy_source(c);
+    Katie_Lexer l;
+    Array(Token) tokens;
+
+    bench_sample_begin(&sample);
+    katie_init_lexer(&l, c->name, source);
+    tokens = katie_lexer_slurp_tokens(&l);
+    bench_sample_end(&sample);
+
+    free_array(tokens);
+    free_string(source);
+    return sample;
+}
+
+static Bench_Sample bench_phase_read(Bench_Case *c) {
+    Bench_Sample sample;
+    Katie_Reader r = {.source_filepath = c->name, .src = c->lexed_source, .tokens = c->tokens};
+    Katie_Module *module;
+
+    bench_sample_begin(&sample);
+    module = katie_read_module(&r);
+    katie_optimize_module(module, Katie_OptimizeLevel_Program);
+    katie_resolve_module(module);
+    bench_sample_end(&sample);
+
+    dealloc_val(module);
+    return sample;
+}
+
+static Bench_Sample bench_phase_eval(Bench_Case *c) {
+    Bench_Sample sample;
+    Array(KatieVal *) results;
+    Katie ctx;
+
+    init_katie_ctx(&ctx);
+    array_reserve(results, array_length(c->module->as.list) + 1);
+
+    bench_sample_begin(&sample);
+    array_for_each(c->module->as.list, i) {
+        array_push(results, katie_eval(&ctx, c->module->as.list[i]));
+    }
+    bench_sample_end(&sample);
+
+    /* values are never freed, the first run's stay valid for the print phase */
+    if (!c->results) c->results = results;
+    else free_array(results);
+    deinit_katie_ctx(&ctx);
+    return sample;
+}
+
+static Bench_Sample bench_phase_print(Bench_Case *c) {
+    Bench_Sample sample;
+    String output = make_string_empty();
+
+    bench_sample_begin(&sample);
+    array_for_each(c->results, i) {
+        output = katie_value_as_string(output, c->results[i]);
+        output = append_cstring(output, "\n");
+    }
+    bench_sample_end(&sample);
+
+    bench_sink += string_length(output);
+    free_string(output);
+    return sample;
+}
+
+static Bench_Sample bench_phase_e2e(Bench_Case *c) {
+    Bench_Sample sample;
+    String source = bench_copy_source(c);
+    Katie_Module *module;
+    Katie ctx;
+
+    bench_sample_begin(&sample);
+    init_katie_ctx(&ctx);
+    module = katie_read_source(c->name, source, Katie_OptimizeLevel_Program, NULL);
+    katie_eval_module(&ctx, module);
+    bench_sink += string_length(ctx.output);
+    deinit_katie_ctx(&ctx);
+    dealloc_val(module);
+    bench_sample_end(&sample);
+
+    free_string(source);
+    return sample;
+}
+
+static int bench_compare_u64(const void *lhs, const void *rhs) {
+    u64 a = *(const u64 *)lhs, b = *(const u64 *)rhs;
+    return a < b ? -1 : a > b;
+}
+
+/* Runs `phase` until the time budget is spent, then reports its median and p99 */
+static void bench_run_phase(Bench_Case *c, char *phase_name, Bench_Sample (*phase)(Bench_Case *)) {
+    Array(u64) times;
+    u64 total_ns = 0, allocs = 0, bytes = 0;
+    usize runs, p99;
+
+    array_reserve(times, BENCH_MAX_RUNS);
+    while (array_length(times) < BENCH_MIN_RUNS ||
+           (array_length(times) < BENCH_MAX_RUNS && total_ns < BENCH_TARGET_NS)) {
+        Bench_Sample sample = phase(c);
+        array_push(times, sample.ns);
+        total_ns += sample.ns;
+        allocs += sample.allocs;
+        bytes += sample.bytes;
+    }
+
+    runs = array_length(times);
+    qsort(times, runs, sizeof(u64), bench_compare_u64);
+    p99 = (runs * 99 + 99) / 100 - 1;
+    printf("%s\t%s\t%zu\t%llu\t%llu\t%llu\t%llu\n", c->name, phase_name, runs,
+           (unsigned long long)times[runs / 2], (unsigned long long)times[p99],
+           (unsigned long long)(allocs / runs), (unsigned long long)(bytes / runs));
+    fflush(stdout);
+    free_array(times);
+}
+
+static void bench_phases(void) {
+    printf("benchmark\tphase\truns\tmedian_ns\tp99_ns\tallocs\tbytes\n");
+    for (usize i = 0; i < array_sizeof(bench_corpus, Bench_Source); ++i) {
+        Bench_Case c = {.name = bench_corpus[i].name, .source = bench_corpus[i].generate()};
+        String source = bench_copy_source(&c);
+        Katie_Lexer l;
+
+        c.lexed_source = bench_copy_source(&c);
+        katie_init_lexer(&l, c.name, c.lexed_source);
+        c.tokens = katie_lexer_slurp_tokens(&l);
+        c.module = katie_read_source(c.name, source, Katie_OptimizeLevel_Program, NULL);
+        c.results = NULL;
+        if (!c.module) die(c.name);
+
+        bench_run_phase(&c, "lex", bench_phase_lex);
+        bench_run_phase(&c, "read", bench_phase_read);
+        bench_run_phase(&c, "eval", bench_phase_eval);
+        bench_run_phase(&c, "print", bench_phase_print);
+        bench_run_phase(&c, "e2e", bench_phase_e2e);
+
+        free_array(c.results);
+        dealloc_val(c.module);
+        free_array(c.tokens);
+        free_string(c.lexed_source);
+        free_string(source);
+        free_string(c.source);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "env")) {
+        bench_env();
+    } else if (argc > 2 && !strcmp(argv[1], "corpus")) {
+        bench_write_corpus(argv[2]);
+    } else {
+        bench_phases();
+    }
+    return 0;
+}
@@ -0,0 +1,467 @@
+#include "bignum.h"
+
+// --------------------------------------------------------------------------
+//                          - Magnitude -
+// --------------------------------------------------------------------------
+/* Helpers working on raw little endian limb buffers. Lengths are in limbs. */
+
+static usize mag_trim(u32 *a, usize n) {
+    while (n && a[n - 1] == 0)
+        n--;
+    return n;
+}
+
+static int mag_compare(u32 *a, usize na, u32 *b, usize nb) {
+    if (na != nb) return na < nb ? -1 : 1;
+    while (na--) {
+        if (a[na] != b[na]) return a[na] < b[na] ? -1 : 1;
+    }
+    return 0;
+}
+
+/* `r` must have room for max(na, nb) + 1 limbs, returns the trimmed length */
+static usize mag_add(u32 *r, u32 *a, usize na, u32 *b, usize nb) {
+    u64 carry = 0;
+    usize i;
+
+    if (na < nb) {
+        swap(a, b, u32 *);
+        swap(na, nb, usize);
+    }
+
+    for (i = 0; i < nb; ++i) {
+        carry += (u64)a[i] + b[i];
+        r[i] = (u32)carry;
+        carry >>= 32;
+    }
+    for (; i < na; ++i) {
+        carry += a[i];
+        r[i] = (u32)carry;
+        carry >>= 32;
+    }
+    r[i] = (u32)carry;
+
+    return mag_trim(r, na + 1);
+}
+
+/* r[0..rn) += a[0..na), the sum must fit in `rn` limbs */
+static void mag_add_into(u32 *r, usize rn, u32 *a, usize na) {
+    u64 carry = 0;
+    usize i;
+
+    Debug_Assert(rn >= na);
+    for (i = 0; i < na; ++i) {
+        carry += (u64)r[i] + a[i];
+        r[i] = (u32)carry;
+        carry >>= 32;
+    }
+    for (; carry && i < rn; ++i) {
+        carry += r[i];
+        r[i] = (u32)carry;
+        carry >>= 32;
+    }
+    Debug_Assert(carry == 0);
+}
+
+/* r[0..rn) -= a[0..na), requires r >= a */
+static void mag_sub_into(u32 *r, usize rn, u32 *a, usize na) {
+    u64 borrow = 0, d;
+    usize i;
+
+    Debug_Assert(rn >= na);
+    for (i = 0; i < na; ++i) {
+        d = (u64)r[i] - a[i] - borrow;
+        r[i] = (u32)d;
+        borrow = d >> 63;
+    }
+    for (; borrow && i < rn; ++i) {
+        d = (u64)r[i] - borrow;
+        r[i] = (u32)d;
+        borrow = d >> 63;
+    }
+    Debug_Assert(borrow == 0);
+}
+
+static void mag_mul_schoolbook(u32 *r, u32 *a, usize na, u32 *b, usize nb) {
+    u64 t, carry;
+
+    memset(r, 0, (na + nb) * sizeof(u32));
+    for (usize i = 0; i < na; ++i) {
+        carry = 0;
+        for (usize j = 0; j < nb; ++j) {
+            t = (u64)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (u32)t;
+            carry = t >> 32;
+        }
+        r[i + nb] = (u32)carry;
+    }
+}
+
+/* Writes exactly na + nb limbs into `r`, which must not alias the operands */
+static void mag_mul(u32 *r, u32 *a, usize na, u32 *b, usize nb) {
+    usize m, na0, nb0, nsa, nsb, n1;
+    u32 *sa, *sb, *z1;
+
+    if (na < nb) {
+        swap(a, b, u32 *);
+        swap(na, nb, usize);
+    }
+
+    if (nb < BIGNUM_KARATSUBA_THRESHOLD) {
+        mag_mul_schoolbook(r, a, na, b, nb);
+        return;
+    }
+
+    m = (na + 1) / 2;
+
+    /* Unbalanced operands: only split `a`, r = a0 * b + (a1 * b) << m */
+    if (nb <= m) {
+        u32 *t = xmalloc((na - m + nb) * sizeof(u32));
+        mag_mul(r, a, m, b, nb);
+        memset(r + m + nb, 0, (na - m) * sizeof(u32));
+        mag_mul(t, a + m, na - m, b, nb);
+        mag_add_into(r + m, na + nb - m, t, na - m + nb);
+        xfree(t);
+        return;
+    }
+
+    /* a = a1 * B^m + a0, b = b1 * B^m + b0
+     * r = z2 * B^2m + (z1 - z2 - z0) * B^m + z0, z1 = (a0 + a1) * (b0 + b1) */
+    na0 = mag_trim(a, m);
+    nb0 = mag_trim(b, m);
+
+    mag_mul(r, a, na0, b, nb0);
+    memset(r + na0 + nb0, 0, (2 * m - na0 - nb0) * sizeof(u32));
+    mag_mul(r + 2 * m, a + m, na - m, b + m, nb - m);
+
+    sa = xmalloc((m + 1) * sizeof(u32));
+    sb = xmalloc((m + 1) * sizeof(u32));
+    nsa = mag_add(sa, a, na0, a + m, na - m);
+    nsb = mag_add(sb, b, nb0, b + m, nb - m);
+
+    n1 = nsa + nsb;
+    z1 = xmalloc((n1 ? n1 : 1) * sizeof(u32));
+    mag_mul(z1, sa, nsa, sb, nsb);
+    mag_sub_into(z1, n1, r, mag_trim(r, 2 * m));
+    mag_sub_into(z1, n1, r + 2 * m, mag_trim(r + 2 * m, na + nb - 2 * m));
+    mag_add_into(r + m, na + nb - m, z1, mag_trim(z1, n1));
+
+    xfree(z1);
+    xfree(sb);
+    xfree(sa);
+}
+
+/* a[0..n) /= d in place, returns the remainder */
+static u32 mag_divmod_small(u32 *a, usize n, u32 d) {
+    u64 rem = 0;
+    while (n--) {
+        rem = (rem << 32) | a[n];
+        a[n] = (u32)(rem / d);
+        rem %= d;
+    }
+    return (u32)rem;
+}
+
+/* a[0..n) = a * mul + add, `a` must have room for n + 1 limbs, returns the new length */
+static usize mag_mul_add_small(u32 *a, usize n, u32 mul, u32 add) {
+    u64 carry = add;
+    for (usize i = 0; i < n; ++i) {
+        carry += (u64)a[i] * mul;
+        a[i] = (u32)carry;
+        carry >>= 32;
+    }
+    if (carry) a[n++] = (u32)carry;
+    return n;
+}
+
+static int count_leading_zeros_u32(u32 x) {
+    int n = 0;
+    if (x == 0) return 32;
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+
+/* Knuth's algorithm D. `q` gets na - nb + 1 limbs, requires na >= nb >= 2 */
+static void mag_div(u32 *q, u32 *a, usize na, u32 *b, usize nb) {
+    u32 *un, *vn;
+    u64 num, qhat, rhat, p;
+    i64 t, k;
+    int s;
+
+    s = count_leading_zeros_u32(b[nb - 1]);
+    vn = xmalloc(nb * sizeof(u32));
+    un = xmalloc((na + 1) * sizeof(u32));
+
+    for (usize i = nb - 1; i > 0; --i)
+        vn[i] = (b[i] << s) | (s ? (u32)((u64)b[i - 1] >> (32 - s)) : 0);
+    vn[0] = b[0] << s;
+
+    un[na] = s ? (u32)((u64)a[na - 1] >> (32 - s)) : 0;
+    for (usize i = na - 1; i > 0; --i)
+        un[i] = (a[i] << s) | (s ? (u32)((u64)a[i - 1] >> (32 - s)) : 0);
+    un[0] = a[0] << s;
+
+    for (usize j = na - nb + 1; j-- > 0;) {
+        num = ((u64)un[j + nb] << 32) | un[j + nb - 1];
+        qhat = num / vn[nb - 1];
+        rhat = num % vn[nb - 1];
+
+        while (qhat >> 32 || qhat * vn[nb - 2] > ((rhat << 32) | un[j + nb - 2])) {
+            qhat -= 1;
+            rhat += vn[nb - 1];
+            if (rhat >> 32) break;
+        }
+
+        k = 0;
+        for (usize i = 0; i < nb; ++i) {
+            p = qhat * vn[i];
+            t = (i64)un[i + j] - k - (i64)(p & 0xffffffff);
+            un[i + j] = (u32)t;
+            k = (i64)(p >> 32) - (t >> 32);
+        }
+        t = (i64)un[j + nb] - k;
+        un[j + nb] = (u32)t;
+
+        q[j] = (u32)qhat;
+        if (t < 0) {
+            u64 carry = 0;
+            q[j] -= 1;
+            for (usize i = 0; i < nb; ++i) {
+                carry += (u64)un[i + j] + vn[i];
+                un[i + j] = (u32)carry;
+                carry >>= 32;
+            }
+            un[j + nb] += (u32)carry;
+        }
+    }
+
+    xfree(un);
+    xfree(vn);
+}
+
+// --------------------------------------------------------------------------
+//                          - Big Number -
+// --------------------------------------------------------------------------
+static BigNum bignum_alloc(usize limb_count) {
+    BigNum a;
+    a.negative = false;
+    array_reserve(a.limbs, limb_count);
+    array_length(a.limbs) = limb_count;
+    return a;
+}
+
+static BigNum bignum_normalize(BigNum a) {
+    array_length(a.limbs) = mag_trim(a.limbs, array_length(a.limbs));
+    if (array_is_empty(a.limbs)) a.negative = false;
+    return a;
+}
+
+BigNum bignum_from_i64(i64 number) {
+    BigNum a = bignum_alloc(2);
+    u64 mag = number < 0 ? (u64)(-(number + 1)) + 1 : (u64)number;
+
+    a.limbs[0] = (u32)mag;
+    a.limbs[1] = (u32)(mag >> 32);
+    a.negative = number < 0;
+    return bignum_normalize(a);
+}
+
+/* Parses an unsigned literal as scanned by the lexer, with an optional 0b, 0o or 0x prefix */
+BigNum bignum_from_text(char *text, usize text_length) {
+    BigNum a;
+    usize n = 0, i = 0;
+    u32 base = 10, digit;
+
+    if (text_length > 2 && text[0] == '0') {
+        switch (text[1]) {
+        case 'b': base = 2; break;
+        case 'o': base = 8; break;
+        case 'x': base = 16; break;
+        default: break;
+        }
+        if (base != 10) i = 2;
+    }
+
+    /* a digit carries at most four bits */
+    a = bignum_alloc(text_length / 8 + 2);
+    for (; i < text_length; ++i) {
+        if (!is_hex_digit(text[i])) break;
+        digit = hex_digit_to_int(text[i]);
+        if (digit >= base) break;
+        n = mag_mul_add_small(a.limbs, n, base, digit);
+    }
+
+    array_length(a.limbs) = n;
+    return bignum_normalize(a);
+}
+
+BigNum bignum_copy(BigNum a) {
+    BigNum r = bignum_alloc(array_length(a.limbs));
+    memcpy(r.limbs, a.limbs, array_length(a.limbs) * sizeof(u32));
+    r.negative = a.negative;
+    return r;
+}
+
+void bignum_free(BigNum a) {
+    free_array(a.limbs);
+}
+
+bool bignum_is_zero(BigNum a) {
+    return array_is_empty(a.limbs);
+}
+
+bool bignum_fits_i64(BigNum a, i64 *out) {
+    u64 mag;
+    usize n = array_length(a.limbs);
+
+    if (n > 2) return false;
+    mag = (n > 0 ? a.limbs[0] : 0) | (n > 1 ? (u64)a.limbs[1] << 32 : 0);
+
+    if (!a.negative) {
+        if (mag > (u64)I64_MAX) return false;
+        *out = (i64)mag;
+    } else {
+        if (mag > (u64)I64_MAX + 1) return false;
+        *out = (mag == (u64)I64_MAX + 1) ? I64_MIN : -(i64)mag;
+    }
+    return true;
+}
+
+int bignum_compare(BigNum a, BigNum b) {
+    int cmp;
+    if (a.negative != b.negative) return a.negative ? -1 : 1;
+    cmp = mag_compare(a.limbs, array_length(a.limbs), b.limbs, array_length(b.limbs));
+    return a.negative ? -cmp : cmp;
+}
+
+BigNum bignum_add(BigNum a, BigNum b) {
+    BigNum r;
+    usize na = array_length(a.limbs), nb = array_length(b.limbs);
+
+    if (a.negative == b.negative) {
+        r = bignum_alloc((na > nb ? na : nb) + 1);
+        array_length(r.limbs) = mag_add(r.limbs, a.limbs, na, b.limbs, nb);
+        r.negative = a.negative;
+        return bignum_normalize(r);
+    }
+
+    if (mag_compare(a.limbs, na, b.limbs, nb) < 0) {
+        swap(a, b, BigNum);
+        swap(na, nb, usize);
+    }
+
+    r = bignum_copy(a);
+    mag_sub_into(r.limbs, na, b.limbs, nb);
+    return bignum_normalize(r);
+}
+
+BigNum bignum_sub(BigNum a, BigNum b) {
+    b.negative = !b.negative;
+    return bignum_add(a, b);
+}
+
+BigNum bignum_mul(BigNum a, BigNum b) {
+    BigNum r;
+    usize na = array_length(a.limbs), nb = array_length(b.limbs);
+
+    r = bignum_alloc(na + nb);
+    mag_mul(r.limbs, a.limbs, na, b.limbs, nb);
+    r.negative = a.negative != b.negative;
+    return bignum_normalize(r);
+}
+
+BigNum bignum_div(BigNum a, BigNum b) {
+    BigNum q;
+    usize na = array_length(a.limbs), nb = array_length(b.limbs);
+
+    Assert_Message(nb != 0, "division by zero");
+
+    if (mag_compare(a.limbs, na, b.limbs, nb) < 0) return bignum_alloc(0);
+
+    if (nb == 1) {
+        q = bignum_copy(a);
+        mag_divmod_small(q.limbs, na, b.limbs[0]);
+    } else {
+        q = bignum_alloc(na - nb + 1);
+        mag_div(q.limbs, a.limbs, na, b.limbs, nb);
+    }
+
+    q.negative = a.negative != b.negative;
+    return bignum_normalize(q);
+}
+
+/* Rounds once, to nearest even: the top 64 bits plus a sticky bit for any lower one set decide
+ * the 53 bit mantissa, which is then scaled by multiplying powers of 2 (no libm). */
+f64 bignum_to_f64(BigNum a) {
+    usize n = array_length(a.limbs);
+    usize bits, shift, limb, off;
+    u64 top, mantissa, rest;
+    u32 w0, w1, w2;
+    bool sticky;
+    f64 result, scale;
+
+    if (n == 0) return 0;
+    bits = 32 * n - (usize)__builtin_clz(a.limbs[n - 1]);
+    if (bits <= 64) {
+        top = a.limbs[0] | (n > 1 ? (u64)a.limbs[1] << 32 : 0);
+        result = (f64)top; /* a single correctly rounded conversion */
+        return a.negative ? -result : result;
+    }
+
+    /* bits [shift, shift + 64) */
+    shift = bits - 64;
+    limb = shift / 32;
+    off = shift % 32;
+    w0 = a.limbs[limb];
+    w1 = a.limbs[limb + 1];
+    w2 = limb + 2 < n ? a.limbs[limb + 2] : 0;
+    top = off ? ((u64)w2 << 32 | w1) << (32 - off) | w0 >> off : (u64)w1 << 32 | w0;
+    sticky = off && (w0 & ((1u << off) - 1)) != 0;
+    for (usize i = 0; i < limb && !sticky; ++i)
+        sticky = a.limbs[i] != 0;
+
+    mantissa = top >> 11;
+    rest = top & 0x7ff;
+    if (rest > 0x400 || (rest == 0x400 && (sticky || (mantissa & 1)))) mantissa += 1;
+    shift += 11; /* a carry out to 2^53 stays exact */
+
+    result = (f64)mantissa;
+    for (scale = 2.0; shift; shift >>= 1, scale *= scale) {
+        if (shift & 1) result *= scale; /* overflows to infinity only when the value does */
+    }
+    return a.negative ? -result : result;
+}
+
+String bignum_append_string(String s, BigNum a) {
+    BigNum t;
+    Array(u32) chunks;
+    usize n;
+    char buf[16];
+
+    if (bignum_is_zero(a)) return append_cstring(s, "0");
+    if (a.negative) s = append_cstring(s, "-");
+
+    /* peel off base 10^9 chunks, least significant first */
+    t = bignum_copy(a);
+    n = array_length(t.limbs);
+    init_array(chunks);
+    while (n) {
+        array_push(chunks, mag_divmod_small(t.limbs, n, 1000000000u));
+        n = mag_trim(t.limbs, n);
+    }
+
+    n = array_length(chunks);
+    sprintf(buf, "%u", chunks[n - 1]);
+    s = append_cstring(s, buf);
+    while (--n) {
+        sprintf(buf, "%09u", chunks[n - 1]);
+        s = append_cstring(s, buf);
+    }
+
+    free_array(chunks);
+    bignum_free(t);
+    return s;
+}
@@ -0,0 +1,52 @@
+#ifndef __bignum_h__
+#define __bignum_h__
+
+#include "basic.h"
+
+// --------------------------------------------------------------------------
+//                          - Big Number -
+// --------------------------------------------------------------------------
+
+#if 0 // BigNum Example
+void main(void) {
+    BigNum a = bignum_from_i64(I64_MAX);
+    BigNum b = bignum_mul(a, a);
+
+    String s = bignum_append_string(make_string_empty(), b);
+    printf("%s\n", s);
+
+    free_string(s);
+    bignum_free(a);
+    bignum_free(b);
+}
+#endif
+
+/* Limbs are stored little endian in base 2^32, without leading zero limbs.
+ * Zero is represented by an empty limb array and is never negative. */
+typedef struct BigNum BigNum;
+struct BigNum {
+    bool negative;
+    Array(u32) limbs;
+};
+
+/* Operands with fewer limbs than this are multiplied with the schoolbook method */
+#define BIGNUM_KARATSUBA_THRESHOLD 32
+
+BigNum bignum_from_i64(i64 number);
+BigNum bignum_from_text(char *text, usize text_length);
+BigNum bignum_copy(BigNum a);
+void bignum_free(BigNum a);
+
+bool bignum_is_zero(BigNum a);
+bool bignum_fits_i64(BigNum a, i64 *out);
+int bignum_compare(BigNum a, BigNum b);
+
+BigNum bignum_add(BigNum a, BigNum b);
+BigNum bignum_sub(BigNum a, BigNum b);
+BigNum bignum_mul(BigNum a, BigNum b);
+BigNum bignum_div(BigNum a, BigNum b); /* truncates towards zero, `b` must be non zero */
+f64 bignum_to_f64(BigNum a);
+
+String bignum_append_string(String s, BigNum a);
+
+#endif
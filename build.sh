@@ -5,16 +5,28 @@ set -eu
 : ${CC=clang}
 : ${CFLAGS=}
 : ${LDFLAGS=}
+: ${DISPATCH=threaded}
+: ${AOT=}
+: ${PGO_DIR=pgo}
+: ${PGO_RUNS=5}
 
-TARGET="katie"
 CFLAGS="$CFLAGS -std=c99"
+# -rdynamic exports the libkatie.h API from katie itself, for the modules load-native opens
+LDFLAGS="$LDFLAGS -pthread -ldl -rdynamic"
 
 panic() {
     printf "%s\n" "$1"
     exit 1
 }
 
+is_clang() {
+    $CC --version 2>/dev/null | grep -q clang
+}
+
 build_katie() {
+    TARGET="katie"
+    SOURCE="main.c"
+
     case $1 in
     debug)
         #EXTRAFLAGS="-Wall -Wextra -pedantic -ggdb -DDebug -fsanitize=address"
@@ -25,22 +37,154 @@ build_katie() {
         EXTRAFLAGS="-O3 -DRelease"
         ;;
 
+    lto)
+        if is_clang; then
+            EXTRAFLAGS="-O3 -DRelease -flto=thin"
+        else
+            EXTRAFLAGS="-O3 -DRelease -flto=auto"
+        fi
+        ;;
+
+    pgo-gen)
+        if is_clang; then
+            EXTRAFLAGS="-O3 -DRelease -fprofile-instr-generate=$PGO_DIR/katie-%p.profraw"
+        else
+            EXTRAFLAGS="-O3 -DRelease -fprofile-generate=$PGO_DIR -fprofile-update=prefer-atomic"
+        fi
+        ;;
+
+    pgo-use)
+        if is_clang; then
+            EXTRAFLAGS="-O3 -DRelease -fprofile-instr-use=$PGO_DIR/katie.profdata"
+        else
+            EXTRAFLAGS="-O3 -DRelease -fprofile-use=$PGO_DIR -fprofile-correction"
+        fi
+        ;;
+
+    bench)
+        EXTRAFLAGS="-O3 -DRelease -DBench"
+        TARGET="katie-bench"
+        SOURCE="bench.c"
+        ;;
+
+    client)
+        EXTRAFLAGS="-O2 -DRelease"
+        TARGET="katie-client"
+        SOURCE="client.c"
+        ;;
+
+    lib)
+        EXTRAFLAGS="-O3 -DRelease -fPIC -fvisibility=hidden -c"
+        TARGET="libkatie.o"
+        SOURCE="libkatie.c"
+        ;;
+
+    aot)
+        [[ -n $AOT ]] || panic "AOT=<file.c> is required, write one with katie --emit-c"
+        EXTRAFLAGS="-O3 -DRelease -I."
+        TARGET="${AOT%.c}"
+        SOURCE="$AOT"
+        LDFLAGS="$LDFLAGS -lm"
+        ;;
+
     *)
         panic "Build mode unsupported!"
     esac
 
+    case $DISPATCH in
+    threaded) ;;
+    switch) EXTRAFLAGS="$EXTRAFLAGS -DSwitchDispatch" ;;
+    *) panic "Dispatch unsupported!"
+    esac
+
     set -x
-    $CC $CFLAGS $EXTRAFLAGS $LDFLAGS main.c -o $TARGET
+    $CC $CFLAGS $EXTRAFLAGS $LDFLAGS $SOURCE -o $TARGET
     set +x
 }
 
+# The bench corpus, written out by katie-bench, is what PGO builds are trained and measured on
+write_corpus() {
+    build_katie bench
+    rm -rf "$PGO_DIR/corpus"
+    mkdir -p "$PGO_DIR/corpus"
+    ./katie-bench corpus "$PGO_DIR/corpus"
+}
+
+run_corpus() {
+    for source in "$PGO_DIR"/corpus/*.kat; do
+        "$1" "$source" >/dev/null
+        "$1" -b "$source" >/dev/null
+    done
+}
+
+# Median wall time in ms of PGO_RUNS runs of the corpus
+time_corpus() {
+    for ((i = 0; i < PGO_RUNS; ++i)); do
+        start=$(date +%s%N)
+        run_corpus "$1"
+        echo $((($(date +%s%N) - start) / 1000))
+    done | sort -n | awk '{ t[NR] = $1 } END { printf "%.1f\n", t[int((NR + 1) / 2)] / 1000 }'
+}
+
+train_pgo() {
+    write_corpus
+    rm -f "$PGO_DIR"/*.profraw "$PGO_DIR"/*.profdata "$PGO_DIR"/*.gcda
+    build_katie pgo-gen
+    run_corpus ./katie
+    if is_clang; then
+        llvm-profdata merge -output="$PGO_DIR/katie.profdata" "$PGO_DIR"/katie-*.profraw
+    fi
+}
+
+report_pgo() {
+    [[ -d "$PGO_DIR/corpus" ]] || write_corpus
+    cp katie "$PGO_DIR/katie-pgo"
+    build_katie release
+    mv katie "$PGO_DIR/katie-release"
+    mv "$PGO_DIR/katie-pgo" katie
+
+    release_ms=$(time_corpus "$PGO_DIR/katie-release")
+    pgo_ms=$(time_corpus ./katie)
+    awk -v r="$release_ms" -v p="$pgo_ms" \
+        'BEGIN { printf "corpus: release %.1f ms, pgo %.1f ms, speedup %.2fx\n", r, p, r / p }'
+}
+
+# Only the KATIE_API functions of libkatie.h stay global, in the archive as in the shared object
+package_lib() {
+    set -x
+    objcopy --localize-hidden libkatie.o
+    ar rcs libkatie.a libkatie.o
+    $CC -shared $LDFLAGS libkatie.o -o libkatie.so
+    rm libkatie.o
+    set +x
+}
+
+# Each modules/NAME.c becomes modules/libNAME.so, modules/NAME.kat must print modules/NAME.out
+test_modules() {
+    for source in modules/*.c; do
+        name=$(basename "$source" .c)
+        set -x
+        $CC $CFLAGS -O2 -fPIC -shared "$source" -o "modules/lib$name.so"
+        set +x
+        ./katie "modules/$name.kat" 2>&1 | diff -u "modules/$name.out" - ||
+            panic "modules: $name failed"
+    done
+    printf "modules: ok\n"
+}
+
 if [[ $# -eq 0 ]]; then
     build_katie debug
     exit 0
 fi
 
 if [[ $# -eq 1 ]]; then
-    build_katie $1
+    case $1 in
+    pgo-gen) train_pgo ;;
+    pgo-use) build_katie pgo-use && report_pgo ;;
+    lib) build_katie lib && package_lib ;;
+    modules) build_katie release && test_modules ;;
+    *) build_katie $1 ;;
+    esac
     exit 0
 else
     panic "Too many arguments"
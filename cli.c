@@ -327,7 +327,8 @@ int cli_parse_args(Cli *cli) {
     positionals_idx = 0;
 
     while (argv_idx < cli->argc) {
-        if (*cli->argv[argv_idx] != '-') { /* Positional arg */
+        /* Positional arg, a lone '-' conventionally names stdin */
+        if (*cli->argv[argv_idx] != '-' || !strcmp(cli->argv[argv_idx], "-")) {
             if (positionals_idx >= cli->positionals_count) {
                 cli_report_warning(cli, "warning: ignoring '%s'\n", cli->argv[argv_idx]);
             } else {
@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+
+#include "basic.c"
+#include "cli.c"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------
+//                          - Eval Client -
+// --------------------------------------------------------------------------
+/*
+ * Sends one request to a `katie --serve` socket and prints the answer, see server.c for the
+ * framing. The source comes from --eval or else from stdin.
+ */
+#define KATIE_SERVE_OK 0
+
+static void client_write_all(int fd, char *bytes, usize length) {
+    while (length) {
+        isize sent = write(fd, bytes, length);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            die("write");
+        }
+        bytes += sent;
+        length -= (usize)sent;
+    }
+}
+
+static bool client_read_all(int fd, char *bytes, usize length) {
+    while (length) {
+        isize received = read(fd, bytes, length);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            die("read");
+        }
+        if (received == 0) return false;
+        bytes += received;
+        length -= (usize)received;
+    }
+    return true;
+}
+
+static String client_slurp_stdin(void) {
+    String source = make_string_empty();
+    char buf[16384];
+    usize received;
+
+    while ((received = fread(buf, 1, sizeof(buf), stdin)) > 0)
+        source = append_string_length(source, buf, received);
+    if (ferror(stdin)) die("stdin");
+    return source;
+}
+
+static int client_connect(char *socket_path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        eprintln("error: socket path too long: %s", socket_path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) die("socket");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    char *socket_path;
+    char *eval_source = NULL;
+    String source, response;
+    u8 header[4];
+    u32 length;
+    bool is_ok;
+    int fd;
+
+    Cli_Flag positionals[] = {
+        Flag_CString_Positional(&socket_path, "SOCKET", "socket of a katie --serve process")};
+
+    Cli_Flag optionals[] = {
+        Flag_CString(&eval_source, "e", "eval", "evaluate the given source instead of stdin"),
+    };
+
+    Cli cli = create_cli(argc, argv, "katie-client", positionals,
+                         array_sizeof(positionals, Cli_Flag), optionals,
+                         array_sizeof(optionals, Cli_Flag));
+
+    cli_parse_args(&cli);
+    if (cli_has_error(&cli)) {
+        exit(EXIT_FAILURE);
+    }
+
+    fd = client_connect(socket_path);
+    if (fd < 0) exit(EXIT_FAILURE);
+
+    source = eval_source ? make_string(eval_source, strlen(eval_source)) : client_slurp_stdin();
+    length = (u32)string_length(source);
+    header[0] = (u8)(length >> 24);
+    header[1] = (u8)(length >> 16);
+    header[2] = (u8)(length >> 8);
+    header[3] = (u8)length;
+    client_write_all(fd, (char *)header, sizeof(header));
+    client_write_all(fd, source, length);
+    shutdown(fd, SHUT_WR);
+
+    if (!client_read_all(fd, (char *)header, sizeof(header))) {
+        eprintln("error: server closed the connection");
+        exit(EXIT_FAILURE);
+    }
+    length = (u32)header[0] << 24 | (u32)header[1] << 16 | (u32)header[2] << 8 | (u32)header[3];
+    response = string_reserve(length);
+    if (length == 0 || !client_read_all(fd, response, length)) {
+        eprintln("error: truncated response");
+        exit(EXIT_FAILURE);
+    }
+
+    is_ok = (u8)response[0] == KATIE_SERVE_OK;
+    if (is_ok) {
+        fwrite(response + 1, 1, length - 1, stdout);
+    } else {
+        fprintf(stderr, "error: %.*s\n", (int)(length - 1), response + 1);
+    }
+
+    close(fd);
+    free_string(source);
+    free_string(response);
+    return is_ok ? 0 : EXIT_FAILURE;
+}
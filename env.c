@@ -0,0 +1,245 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Symbols -
+// --------------------------------------------------------------------------
+/*
+ * Every symbol name is interned once into a dense id, its hash is computed at that point and
+ * carried along with the id, so environments never hash or compare strings.
+ */
+typedef struct Katie_SymbolTable Katie_SymbolTable;
+struct Katie_SymbolTable {
+    pthread_mutex_t lock;        /* shared by every context */
+    Array(Katie_Symbol) symbols; /* indexed by id, id 0 is KATIE_SYMBOL_NONE */
+    Katie_SymbolId *index;       /* open addressing table of ids, 0 marks an empty slot */
+    u32 index_capacity;
+};
+
+static Katie_SymbolTable katie_symbols = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static u32 katie_hash_text(char *text, usize length) {
+    u32 hash = 2166136261u; /* FNV-1a */
+    for (usize i = 0; i < length; ++i) {
+        hash ^= (u8)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void symbol_table_grow(Katie_SymbolTable *t) {
+    u32 capacity = t->index_capacity ? t->index_capacity * 2 : 256;
+    Katie_SymbolId *index = xmalloc(capacity * sizeof(Katie_SymbolId));
+
+    memset(index, 0, capacity * sizeof(Katie_SymbolId));
+    for (usize id = 1; id < array_length(t->symbols); ++id) {
+        u32 slot = t->symbols[id].hash & (capacity - 1);
+        while (index[slot])
+            slot = (slot + 1) & (capacity - 1);
+        index[slot] = (Katie_SymbolId)id;
+    }
+
+    if (t->index) xfree(t->index);
+    t->index = index;
+    t->index_capacity = capacity;
+}
+
+Katie_Symbol katie_intern(char *text, usize length) {
+    Katie_SymbolTable *t = &katie_symbols;
+    Katie_Symbol symbol;
+    Katie_SymbolId id;
+    u32 hash, slot;
+
+    hash = katie_hash_text(text, length);
+    pthread_mutex_lock(&t->lock);
+
+    if (!t->symbols) {
+        init_array(t->symbols);
+        array_push(t->symbols, ((Katie_Symbol){.name = NULL, .id = KATIE_SYMBOL_NONE}));
+    }
+
+    /* keep the load factor at most one half */
+    if (2 * array_length(t->symbols) >= t->index_capacity) symbol_table_grow(t);
+
+    slot = hash & (t->index_capacity - 1);
+    while ((id = t->index[slot])) {
+        if (t->symbols[id].hash == hash &&
+            are_strings_equal_length(t->symbols[id].name, text, length)) {
+            symbol = t->symbols[id];
+            pthread_mutex_unlock(&t->lock);
+            return symbol;
+        }
+        slot = (slot + 1) & (t->index_capacity - 1);
+    }
+
+    symbol.name = make_string(text, length);
+    symbol.id = (Katie_SymbolId)array_length(t->symbols);
+    symbol.hash = hash;
+    array_push(t->symbols, symbol);
+    t->index[slot] = symbol.id;
+
+    pthread_mutex_unlock(&t->lock);
+    return symbol;
+}
+
+Katie_Symbol katie_symbol_from_id(Katie_SymbolId id) {
+    Katie_Symbol symbol;
+
+    pthread_mutex_lock(&katie_symbols.lock);
+    Debug_Assert(id != KATIE_SYMBOL_NONE && id < array_length(katie_symbols.symbols));
+    symbol = katie_symbols.symbols[id];
+    pthread_mutex_unlock(&katie_symbols.lock);
+    return symbol;
+}
+
+Katie_Symbol katie_intern_cstring(char *cstring) {
+    return katie_intern(cstring, strlen(cstring));
+}
+
+// --------------------------------------------------------------------------
+//                          - Env -
+// --------------------------------------------------------------------------
+/*
+ * Frames with at most KATIE_ENV_SMALL_CAPACITY bindings live in the inline `small` array and are
+ * searched linearly. Bigger frames switch to an open addressing table with linear probing, a
+ * power of two capacity and a load factor of at most 3/4. Deletion shifts the following
+ * entries of a probe run back, so the table never needs tombstones.
+ */
+KatieEnv *alloc_env(KatieEnv *outer) {
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_Env);
+    KatieEnv *env = xmalloc(sizeof(KatieEnv));
+    katie_alloc_kind_pop(kindSave);
+    env->entries = env->small;
+    env->count = 0;
+    env->capacity = KATIE_ENV_SMALL_CAPACITY;
+    env->is_hashed = false;
+    env->outer = outer;
+    return env;
+}
+
+void dealloc_env(KatieEnv *env) {
+    if (env->is_hashed) xfree(env->entries);
+    if (env->outer) dealloc_env(env->outer);
+    xfree(env);
+}
+
+static inline KatieEnv_Entry *env_find_entry(KatieEnv *env, Katie_Symbol key) {
+    KatieEnv_Entry *entry;
+    u32 mask, slot;
+
+    if (!env->is_hashed) {
+        for (u32 i = 0; i < env->count; ++i) {
+            if (env->entries[i].key == key.id) return &env->entries[i];
+        }
+        return NULL;
+    }
+
+    mask = env->capacity - 1;
+    slot = key.hash & mask;
+    for (;;) {
+        entry = &env->entries[slot];
+        if (entry->key == key.id) return entry;
+        if (entry->key == KATIE_SYMBOL_NONE) return NULL;
+        slot = (slot + 1) & mask;
+    }
+}
+
+static void env_insert_hashed(KatieEnv_Entry *entries, u32 capacity, KatieEnv_Entry entry) {
+    u32 slot = entry.hash & (capacity - 1);
+    while (entries[slot].key != KATIE_SYMBOL_NONE)
+        slot = (slot + 1) & (capacity - 1);
+    entries[slot] = entry;
+}
+
+static void env_rehash(KatieEnv *env, u32 capacity) {
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_Env);
+    KatieEnv_Entry *entries = xmalloc(capacity * sizeof(KatieEnv_Entry));
+    katie_alloc_kind_pop(kindSave);
+
+    memset(entries, 0, capacity * sizeof(KatieEnv_Entry));
+    if (!env->is_hashed) {
+        for (u32 i = 0; i < env->count; ++i)
+            env_insert_hashed(entries, capacity, env->entries[i]);
+    } else {
+        for (u32 i = 0; i < env->capacity; ++i) {
+            if (env->entries[i].key != KATIE_SYMBOL_NONE)
+                env_insert_hashed(entries, capacity, env->entries[i]);
+        }
+        xfree(env->entries);
+    }
+
+    env->entries = entries;
+    env->capacity = capacity;
+    env->is_hashed = true;
+}
+
+KatieVal *env_find_1level(KatieEnv *env, Katie_Symbol key) {
+    KatieEnv_Entry *entry = env_find_entry(env, key);
+    return entry ? entry->value : NULL;
+}
+
+KatieVal *env_lookup(KatieEnv *env, Katie_Symbol key) {
+    KatieEnv_Entry *entry;
+
+    do {
+        katie_stat_add(env_depth, 1);
+        entry = env_find_entry(env, key);
+        if (entry) return entry->value;
+        env = env->outer;
+    } while (env);
+
+    return NULL;
+}
+
+void env_put(KatieEnv *env, Katie_Symbol key, KatieVal *val) {
+    KatieEnv_Entry *entry = env_find_entry(env, key);
+
+    if (entry) {
+        entry->value = val;
+        return;
+    }
+
+    if (!env->is_hashed) {
+        if (env->count < KATIE_ENV_SMALL_CAPACITY) {
+            env->entries[env->count++] =
+                (KatieEnv_Entry){.key = key.id, .hash = key.hash, .value = val};
+            return;
+        }
+        env_rehash(env, 2 * KATIE_ENV_SMALL_CAPACITY);
+    } else if (4 * (env->count + 1) > 3 * env->capacity) {
+        env_rehash(env, 2 * env->capacity);
+    }
+
+    env_insert_hashed(env->entries, env->capacity,
+                      (KatieEnv_Entry){.key = key.id, .hash = key.hash, .value = val});
+    env->count += 1;
+}
+
+bool env_remove(KatieEnv *env, Katie_Symbol key) {
+    KatieEnv_Entry *entry = env_find_entry(env, key);
+    u32 mask, hole, slot, home;
+
+    if (!entry) return false;
+    env->count -= 1;
+
+    if (!env->is_hashed) {
+        *entry = env->entries[env->count];
+        return true;
+    }
+
+    /* backward shift: pull every entry of the probe run which may legally sit in the hole */
+    mask = env->capacity - 1;
+    hole = (u32)(entry - env->entries);
+    slot = hole;
+    for (;;) {
+        slot = (slot + 1) & mask;
+        if (env->entries[slot].key == KATIE_SYMBOL_NONE) break;
+
+        home = env->entries[slot].hash & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            env->entries[hole] = env->entries[slot];
+            hole = slot;
+        }
+    }
+    env->entries[hole].key = KATIE_SYMBOL_NONE;
+    return true;
+}
@@ -0,0 +1,536 @@
+#include "katie.h"
+
+#include <sys/mman.h>
+
+// --------------------------------------------------------------------------
+//                          - JIT -
+// --------------------------------------------------------------------------
+/*
+ * A template JIT: every bytecode instruction of a hot fn becomes a fixed sequence of x86-64, with
+ * the machine's stack pointer in a register and the stack itself still the one katie_run_code
+ * allocated. Most instructions are calls of the same helpers the interpreter uses, only the
+ * superinstructions and branches are inline: fixnum adds, subtracts and comparisons, and the
+ * truthiness test.
+ *
+ * An inline fast path that meets anything else, a float, an overflow or a rebound `+`, deopts: it
+ * stores the offset of its instruction and the stack pointer and returns, and the interpreter
+ * runs the rest of the call from that instruction, whose operands are still on the stack. Fns
+ * which keep deopting go back to the interpreter for good.
+ *
+ * The natives called from the inline fast paths are not counted by --stats.
+ *
+ * Registers, all callee saved so helper calls keep them:
+ *   rbx  ctx
+ *   r12  stack pointer, the next free slot
+ *   r13  vals of the code
+ *   r15  the Katie_JitExit
+ */
+Katie_Jit katie_jit;
+
+#ifdef KATIE_JIT
+typedef enum Katie_JitReg {
+    Katie_JitReg_Rax = 0,
+    Katie_JitReg_Rcx = 1,
+    Katie_JitReg_Rdx = 2,
+    Katie_JitReg_Rbx = 3,
+    Katie_JitReg_Rsi = 6,
+    Katie_JitReg_Rdi = 7,
+    Katie_JitReg_R12 = 12,
+    Katie_JitReg_R13 = 13,
+    Katie_JitReg_R14 = 14,
+    Katie_JitReg_R15 = 15,
+} Katie_JitReg;
+
+/* Condition codes of jcc */
+typedef enum Katie_JitCond {
+    Katie_JitCond_O = 0x0,
+    Katie_JitCond_E = 0x4,
+    Katie_JitCond_NE = 0x5,
+    Katie_JitCond_L = 0xc,
+    Katie_JitCond_GE = 0xd,
+    Katie_JitCond_LE = 0xe,
+    Katie_JitCond_G = 0xf,
+} Katie_JitCond;
+
+#define JIT_SP Katie_JitReg_R12
+#define JIT_VALS Katie_JitReg_R13
+#define JIT_CTX Katie_JitReg_Rbx
+#define JIT_EXIT Katie_JitReg_R15
+
+#define JIT_KIND offsetof(KatieVal, kind)
+#define JIT_NUMBER offsetof(KatieVal, as.number)
+#define JIT_BOOL offsetof(KatieVal, as._bool)
+#define JIT_PROC offsetof(KatieVal, as.native.proc)
+
+/* A rel32 to patch once the offset it jumps to is known */
+typedef struct Katie_JitFixup Katie_JitFixup;
+struct Katie_JitFixup {
+    u32 at;       /* of the rel32 */
+    u32 target;   /* bytecode offset */
+    bool is_deopt; /* to a stub deoptimizing at `target` rather than to its code */
+};
+
+typedef struct Katie_JitAsm Katie_JitAsm;
+struct Katie_JitAsm {
+    Array(u8) bytes;
+    Array(u32) op_at; /* native offset of each instruction, by bytecode offset */
+    Array(Katie_JitFixup) fixups;
+};
+
+static void jit_byte(Katie_JitAsm *a, u8 byte) {
+    array_push(a->bytes, byte);
+}
+
+static void jit_u32(Katie_JitAsm *a, u32 value) {
+    for (int i = 0; i < 4; ++i)
+        jit_byte(a, (u8)(value >> (8 * i)));
+}
+
+static void jit_u64(Katie_JitAsm *a, u64 value) {
+    for (int i = 0; i < 8; ++i)
+        jit_byte(a, (u8)(value >> (8 * i)));
+}
+
+static u32 jit_here(Katie_JitAsm *a) {
+    return (u32)array_length(a->bytes);
+}
+
+/* REX prefix, left out when it would be empty */
+static void jit_rex(Katie_JitAsm *a, bool is_wide, int reg, int base) {
+    u8 rex = 0x40 | (is_wide ? 0x08 : 0) | (reg >= 8 ? 0x04 : 0) | (base >= 8 ? 0x01 : 0);
+    if (rex != 0x40) jit_byte(a, rex);
+}
+
+/* ModRM of `[base + disp32]`, r12 as a base needs a SIB byte */
+static void jit_mem(Katie_JitAsm *a, int reg, int base, i32 disp) {
+    jit_byte(a, (u8)(0x80 | (reg & 7) << 3 | (base & 7)));
+    if ((base & 7) == 4) jit_byte(a, 0x24);
+    jit_u32(a, (u32)disp);
+}
+
+static void jit_modrm_reg(Katie_JitAsm *a, int reg, int rm) {
+    jit_byte(a, (u8)(0xc0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+/* mov dst, [base + disp] */
+static void jit_load(Katie_JitAsm *a, int dst, int base, i32 disp) {
+    jit_rex(a, true, dst, base);
+    jit_byte(a, 0x8b);
+    jit_mem(a, dst, base, disp);
+}
+
+/* mov [base + disp], src */
+static void jit_store(Katie_JitAsm *a, int base, i32 disp, int src, bool is_wide) {
+    jit_rex(a, is_wide, src, base);
+    jit_byte(a, 0x89);
+    jit_mem(a, src, base, disp);
+}
+
+static void jit_mov(Katie_JitAsm *a, int dst, int src) {
+    jit_rex(a, true, src, dst);
+    jit_byte(a, 0x89);
+    jit_modrm_reg(a, src, dst);
+}
+
+static void jit_mov_imm(Katie_JitAsm *a, int dst, u64 imm) {
+    jit_rex(a, true, 0, dst);
+    jit_byte(a, (u8)(0xb8 + (dst & 7)));
+    jit_u64(a, imm);
+}
+
+/* add dst, imm, a negative imm subtracts */
+static void jit_add_imm(Katie_JitAsm *a, int dst, i32 imm) {
+    jit_rex(a, true, 0, dst);
+    jit_byte(a, 0x81);
+    jit_modrm_reg(a, 0, dst);
+    jit_u32(a, (u32)imm);
+}
+
+/* add, sub or cmp of two registers, by the opcode of its `r/m, reg` form */
+static void jit_alu(Katie_JitAsm *a, u8 opcode, int dst, int src) {
+    jit_rex(a, true, src, dst);
+    jit_byte(a, opcode);
+    jit_modrm_reg(a, src, dst);
+}
+
+#define jit_add(a, dst, src) jit_alu(a, 0x01, dst, src)
+#define jit_sub(a, dst, src) jit_alu(a, 0x29, dst, src)
+#define jit_cmp(a, dst, src) jit_alu(a, 0x39, dst, src)
+
+/* cmp dword [base + disp], imm */
+static void jit_cmp_mem32(Katie_JitAsm *a, int base, i32 disp, u32 imm) {
+    jit_rex(a, false, 0, base);
+    jit_byte(a, 0x81);
+    jit_mem(a, 7, base, disp);
+    jit_u32(a, imm);
+}
+
+/* cmp byte [base + disp], imm */
+static void jit_cmp_mem8(Katie_JitAsm *a, int base, i32 disp, u8 imm) {
+    jit_rex(a, false, 0, base);
+    jit_byte(a, 0x80);
+    jit_mem(a, 7, base, disp);
+    jit_byte(a, imm);
+}
+
+/* cmp qword [base + disp], reg */
+static void jit_cmp_mem(Katie_JitAsm *a, int base, i32 disp, int reg) {
+    jit_rex(a, true, reg, base);
+    jit_byte(a, 0x39);
+    jit_mem(a, reg, base, disp);
+}
+
+static void jit_push(Katie_JitAsm *a, int reg) {
+    jit_rex(a, false, 0, reg);
+    jit_byte(a, (u8)(0x50 + (reg & 7)));
+}
+
+static void jit_pop(Katie_JitAsm *a, int reg) {
+    jit_rex(a, false, 0, reg);
+    jit_byte(a, (u8)(0x58 + (reg & 7)));
+}
+
+static void jit_call(Katie_JitAsm *a, void (*fn)(void)) {
+    jit_mov_imm(a, Katie_JitReg_Rax, (u64)(uintptr_t)fn);
+    jit_byte(a, 0xff);
+    jit_modrm_reg(a, 2, Katie_JitReg_Rax);
+}
+
+#define JIT_CALL(a, fn) jit_call(a, (void (*)(void))(fn))
+
+/* Emits a jcc, or a jmp when `cond` is negative, returns the offset of its rel32 */
+static u32 jit_jump(Katie_JitAsm *a, int cond) {
+    if (cond < 0) {
+        jit_byte(a, 0xe9);
+    } else {
+        jit_byte(a, 0x0f);
+        jit_byte(a, (u8)(0x80 | cond));
+    }
+    jit_u32(a, 0);
+    return jit_here(a) - 4;
+}
+
+/* Points the rel32 at `at` to the current offset */
+static void jit_land(Katie_JitAsm *a, u32 at) {
+    u32 rel = jit_here(a) - (at + 4);
+    memcpy(&a->bytes[at], &rel, 4);
+}
+
+static void jit_jump_to(Katie_JitAsm *a, int cond, u32 target, bool is_deopt) {
+    Katie_JitFixup fixup = {.at = jit_jump(a, cond), .target = target, .is_deopt = is_deopt};
+    array_push(a->fixups, fixup);
+}
+
+#define jit_deopt_if(a, cond, ip) jit_jump_to(a, cond, ip, true)
+
+static void jit_epilogue(Katie_JitAsm *a) {
+    jit_pop(a, Katie_JitReg_R15);
+    jit_pop(a, Katie_JitReg_R14);
+    jit_pop(a, Katie_JitReg_R13);
+    jit_pop(a, Katie_JitReg_R12);
+    jit_pop(a, Katie_JitReg_Rbx);
+    jit_byte(a, 0xc3);
+}
+
+/* Pushes rax on the machine's stack */
+static void jit_push_result(Katie_JitAsm *a) {
+    jit_store(a, JIT_SP, 0, Katie_JitReg_Rax, true);
+    jit_add_imm(a, JIT_SP, 8);
+}
+
+/* Calls helper(ctx, vals[index]) */
+static void jit_call_val(Katie_JitAsm *a, void (*helper)(void), u32 index) {
+    jit_mov(a, Katie_JitReg_Rdi, JIT_CTX);
+    jit_load(a, Katie_JitReg_Rsi, JIT_VALS, (i32)(index * sizeof(KatieVal *)));
+    jit_call(a, helper);
+}
+
+static void jit_define(Katie *ctx, KatieVal *symbol, KatieVal *val) {
+    katie_define(ctx, ctx->env, symbol->as.symbol, val);
+}
+
+static KatieVal *jit_load_local(Katie *ctx, KatieVal *symbol) {
+    return vm_load_local(ctx, symbol);
+}
+
+static KatieVal *jit_load_global(Katie *ctx, KatieVal *symbol) {
+    return vm_load(ctx, symbol);
+}
+
+/*
+ * `(fn x number)` with fn in rcx and x in rdx, the sum or difference ends up in rax. Deopts
+ * unless fn is the builtin + or -, x a fixnum and the result fits in one.
+ */
+static void jit_arith_const(Katie_JitAsm *a, u32 ip, i64 number) {
+    u32 to_sub, to_done;
+
+    jit_cmp_mem32(a, Katie_JitReg_Rcx, JIT_KIND, KatieValKind_NativeFunction);
+    jit_deopt_if(a, Katie_JitCond_NE, ip);
+    jit_cmp_mem32(a, Katie_JitReg_Rdx, JIT_KIND, KatieValKind_Number);
+    jit_deopt_if(a, Katie_JitCond_NE, ip);
+    jit_load(a, Katie_JitReg_Rax, Katie_JitReg_Rdx, JIT_NUMBER);
+    jit_mov_imm(a, Katie_JitReg_Rsi, (u64)number);
+
+    jit_mov_imm(a, Katie_JitReg_Rdi, (u64)(uintptr_t)native_op_add);
+    jit_cmp_mem(a, Katie_JitReg_Rcx, JIT_PROC, Katie_JitReg_Rdi);
+    to_sub = jit_jump(a, Katie_JitCond_NE);
+    jit_add(a, Katie_JitReg_Rax, Katie_JitReg_Rsi);
+    jit_deopt_if(a, Katie_JitCond_O, ip);
+    to_done = jit_jump(a, -1);
+
+    jit_land(a, to_sub);
+    jit_mov_imm(a, Katie_JitReg_Rdi, (u64)(uintptr_t)native_op_sub);
+    jit_cmp_mem(a, Katie_JitReg_Rcx, JIT_PROC, Katie_JitReg_Rdi);
+    jit_deopt_if(a, Katie_JitCond_NE, ip);
+    jit_sub(a, Katie_JitReg_Rax, Katie_JitReg_Rsi);
+    jit_deopt_if(a, Katie_JitCond_O, ip);
+
+    jit_land(a, to_done);
+    jit_mov(a, Katie_JitReg_Rdi, Katie_JitReg_Rax);
+    JIT_CALL(a, alloc_number);
+}
+
+/* `(fn a b)` of the top three, jumps to `target` unless true. Deopts unless fn is a builtin
+ * comparison and both operands fixnums. */
+static void jit_compare_jump(Katie_JitAsm *a, u32 ip, u32 target, u32 next) {
+    struct {
+        Katie_Proc proc;
+        Katie_JitCond is_false;
+    } comparisons[] = {
+        {native_op_lt, Katie_JitCond_GE},
+        {native_op_gt, Katie_JitCond_LE},
+        {native_op_le, Katie_JitCond_G},
+        {native_op_ge, Katie_JitCond_L},
+    };
+
+    jit_load(a, Katie_JitReg_Rcx, JIT_SP, -24);
+    jit_cmp_mem32(a, Katie_JitReg_Rcx, JIT_KIND, KatieValKind_NativeFunction);
+    jit_deopt_if(a, Katie_JitCond_NE, ip);
+    jit_load(a, Katie_JitReg_Rax, JIT_SP, -16);
+    jit_cmp_mem32(a, Katie_JitReg_Rax, JIT_KIND, KatieValKind_Number);
+    jit_deopt_if(a, Katie_JitCond_NE, ip);
+    jit_load(a, Katie_JitReg_Rdx, JIT_SP, -8);
+    jit_cmp_mem32(a, Katie_JitReg_Rdx, JIT_KIND, KatieValKind_Number);
+    jit_deopt_if(a, Katie_JitCond_NE, ip);
+
+    jit_load(a, Katie_JitReg_Rax, Katie_JitReg_Rax, JIT_NUMBER);
+    jit_load(a, Katie_JitReg_Rdx, Katie_JitReg_Rdx, JIT_NUMBER);
+    jit_load(a, Katie_JitReg_Rsi, Katie_JitReg_Rcx, JIT_PROC);
+
+    for (usize i = 0; i < array_sizeof(comparisons, comparisons[0]); ++i) {
+        u32 to_next;
+
+        jit_mov_imm(a, Katie_JitReg_Rdi, (u64)(uintptr_t)comparisons[i].proc);
+        jit_cmp(a, Katie_JitReg_Rsi, Katie_JitReg_Rdi);
+        to_next = jit_jump(a, Katie_JitCond_NE);
+        jit_add_imm(a, JIT_SP, -24);
+        jit_cmp(a, Katie_JitReg_Rax, Katie_JitReg_Rdx);
+        jit_jump_to(a, comparisons[i].is_false, target, false);
+        jit_jump_to(a, -1, next, false);
+        jit_land(a, to_next);
+    }
+    jit_deopt_if(a, -1, ip);
+}
+
+static void jit_op(Katie_JitAsm *a, Katie_Code *code, u32 ip) {
+    u32 *operands = &code->ops[ip + 1];
+
+    switch ((Katie_Op)code->ops[ip]) {
+    case Katie_Op_Const:
+        jit_load(a, Katie_JitReg_Rax, JIT_VALS, (i32)(operands[0] * sizeof(KatieVal *)));
+        jit_push_result(a);
+        break;
+
+    case Katie_Op_Nil:
+        JIT_CALL(a, alloc_nil);
+        jit_push_result(a);
+        break;
+
+    case Katie_Op_Load:
+        jit_call_val(a, (void (*)(void))jit_load_global, operands[0]);
+        jit_push_result(a);
+        break;
+
+    case Katie_Op_LoadLocal:
+        jit_call_val(a, (void (*)(void))jit_load_local, operands[0]);
+        jit_push_result(a);
+        break;
+
+    case Katie_Op_Def:
+        jit_load(a, Katie_JitReg_Rdx, JIT_SP, -8);
+        jit_call_val(a, (void (*)(void))jit_define, operands[0]);
+        break;
+
+    case Katie_Op_Pop: jit_add_imm(a, JIT_SP, -8); break;
+
+    case Katie_Op_Jump: jit_jump_to(a, -1, operands[0], false); break;
+
+    case Katie_Op_JumpIfFalse:
+        jit_add_imm(a, JIT_SP, -8);
+        jit_load(a, Katie_JitReg_Rax, JIT_SP, 0);
+        jit_cmp_mem32(a, Katie_JitReg_Rax, JIT_KIND, KatieValKind_Bool);
+        jit_jump_to(a, Katie_JitCond_NE, operands[0], false);
+        jit_cmp_mem8(a, Katie_JitReg_Rax, JIT_BOOL, 0);
+        jit_jump_to(a, Katie_JitCond_E, operands[0], false);
+        break;
+
+    case Katie_Op_Call:
+        jit_add_imm(a, JIT_SP, -(i32)(operands[0] * sizeof(KatieVal *)));
+        jit_mov(a, Katie_JitReg_Rdi, JIT_CTX);
+        jit_load(a, Katie_JitReg_Rsi, JIT_SP, -8);
+        jit_mov_imm(a, Katie_JitReg_Rdx, operands[0]);
+        jit_mov(a, Katie_JitReg_Rcx, JIT_SP);
+        JIT_CALL(a, katie_apply);
+        jit_store(a, JIT_SP, -8, Katie_JitReg_Rax, true);
+        break;
+
+    case Katie_Op_MakeFn:
+        jit_call_val(a, (void (*)(void))katie_make_closure, operands[0]);
+        jit_push_result(a);
+        break;
+
+    case Katie_Op_Eval:
+        jit_call_val(a, (void (*)(void))katie_eval, operands[0]);
+        jit_push_result(a);
+        break;
+
+    case Katie_Op_Return:
+        jit_load(a, Katie_JitReg_Rax, JIT_SP, -8);
+        jit_epilogue(a);
+        break;
+
+    case Katie_Op_ArithConst:
+        jit_load(a, Katie_JitReg_Rcx, JIT_SP, -16);
+        jit_load(a, Katie_JitReg_Rdx, JIT_SP, -8);
+        jit_arith_const(a, ip, code->vals[operands[0]]->as.number);
+        jit_store(a, JIT_SP, -16, Katie_JitReg_Rax, true);
+        jit_add_imm(a, JIT_SP, -8);
+        break;
+
+    case Katie_Op_LoadLocalArith:
+        jit_call_val(a, (void (*)(void))jit_load_local, operands[0]);
+        jit_mov(a, Katie_JitReg_Rdx, Katie_JitReg_Rax);
+        jit_load(a, Katie_JitReg_Rcx, JIT_SP, -8);
+        jit_arith_const(a, ip, code->vals[operands[1]]->as.number);
+        jit_store(a, JIT_SP, -8, Katie_JitReg_Rax, true);
+        break;
+
+    case Katie_Op_CompareJump: jit_compare_jump(a, ip, operands[0], ip + 2); break;
+
+    default: Unreachable();
+    }
+}
+
+/* Assembles the code, every deopt stub and the shared exit after the instructions */
+static void jit_assemble(Katie_JitAsm *a, Katie_Code *code) {
+    u32 to_exit;
+    Array(u32) exits;
+
+    jit_push(a, Katie_JitReg_Rbx);
+    jit_push(a, Katie_JitReg_R12);
+    jit_push(a, Katie_JitReg_R13);
+    jit_push(a, Katie_JitReg_R14); /* unused, keeps the stack 16 byte aligned for calls */
+    jit_push(a, Katie_JitReg_R15);
+    jit_mov(a, JIT_CTX, Katie_JitReg_Rdi);
+    jit_mov(a, JIT_SP, Katie_JitReg_Rsi);
+    jit_mov(a, JIT_VALS, Katie_JitReg_Rdx);
+    jit_mov(a, JIT_EXIT, Katie_JitReg_Rcx);
+
+    for (u32 ip = 0; ip < array_length(code->ops); ip += 1 + katie_op_operands[code->ops[ip]]) {
+        a->op_at[ip] = jit_here(a);
+        jit_op(a, code, ip);
+    }
+
+    init_array(exits);
+    array_for_each(a->fixups, i) {
+        Katie_JitFixup *fixup = &a->fixups[i];
+
+        if (!fixup->is_deopt) {
+            u32 rel = a->op_at[fixup->target] - (fixup->at + 4);
+            memcpy(&a->bytes[fixup->at], &rel, 4);
+            continue;
+        }
+        jit_land(a, fixup->at);
+        jit_byte(a, 0xb8); /* mov eax, ip */
+        jit_u32(a, fixup->target);
+        to_exit = jit_jump(a, -1);
+        array_push(exits, to_exit);
+    }
+
+    array_for_each(exits, i) { jit_land(a, exits[i]); }
+    jit_store(a, JIT_EXIT, offsetof(Katie_JitExit, ip), Katie_JitReg_Rax, false);
+    jit_store(a, JIT_EXIT, offsetof(Katie_JitExit, sp), JIT_SP, true);
+    jit_epilogue(a);
+    free_array(exits);
+}
+
+/* Copies the assembled code into pages which are then only executable */
+static Katie_JitFn jit_install(Katie_JitAsm *a, usize *size) {
+    long page = sysconf(_SC_PAGESIZE);
+    Katie_JitFn fn;
+    void *mem;
+
+    *size = (array_length(a->bytes) + (usize)page - 1) / (usize)page * (usize)page;
+    mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+
+    memcpy(mem, a->bytes, array_length(a->bytes));
+    if (mprotect(mem, *size, PROT_READ | PROT_EXEC) < 0) {
+        munmap(mem, *size);
+        return NULL;
+    }
+    memcpy(&fn, &mem, sizeof(fn));
+    return fn;
+}
+#endif
+
+bool katie_jit_start(u32 threshold) {
+#ifdef KATIE_JIT
+    katie_jit.threshold = threshold > 0 ? threshold : 1;
+    katie_jit.is_enabled = true;
+    return true;
+#else
+    (void)threshold;
+    return false;
+#endif
+}
+
+/* Compiles the code once it got hot, NULL if it can't be, it is then interpreted as before */
+Katie_JitFn katie_jit_compile(Katie_Code *code) {
+#ifdef KATIE_JIT
+    Katie_JitAsm a;
+    Katie_JitFn fn;
+    usize size = 0;
+
+    init_array(a.bytes);
+    init_array(a.fixups);
+    array_reserve(a.op_at, array_length(code->ops) + 1);
+    array_length(a.op_at) = array_length(code->ops);
+
+    jit_assemble(&a, code);
+    fn = jit_install(&a, &size);
+
+    free_array(a.bytes);
+    free_array(a.fixups);
+    free_array(a.op_at);
+    if (!fn) return NULL;
+
+    code->jit_size = size;
+    __atomic_store_n(&code->jit, fn, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&katie_jit.compiled, 1, __ATOMIC_RELAXED);
+    return fn;
+#else
+    (void)code;
+    return NULL;
+#endif
+}
+
+void katie_jit_free(Katie_Code *code) {
+#ifdef KATIE_JIT
+    void *mem;
+
+    memcpy(&mem, &code->jit, sizeof(mem));
+    munmap(mem, code->jit_size);
+#endif
+    code->jit = NULL;
+}
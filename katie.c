@@ -12,6 +12,7 @@ static Token make_token(char *text, usize text_length, TokenKind kind, TokenPos
         .pos = pos,
         .line_start = line_start,
         .number = number,
+        ._float = 0,
     };
 }
 
@@ -41,6 +42,7 @@ void katie_init_lexer(Katie_Lexer *l, char *filepath, char *src) {
     l->col = 0;
     l->line_start = l->src;
     l->error_count = 0;
+    l->errors = NULL;
 
     l->token_begin = NULL;
     l->token_kind = TokenKind_Invaild;
@@ -87,71 +89,207 @@ static u8 lexer_digit_value(Katie_Lexer *l) {
     if (lexer_current_char(l) >= 'a' && lexer_current_char(l) <= 'f')
         return lexer_current_char(l) - 'a' + 10;
     if (lexer_current_char(l) >= 'A' && lexer_current_char(l) <= 'F')
-        return lexer_current_char(l) - 'a' + 10;
+        return lexer_current_char(l) - 'A' + 10;
     return 17;
 }
 
+/* Powers of ten which are exactly representable as doubles */
+static const f64 lexer_exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool lexer_is_exponent_start(Katie_Lexer *l) {
+    char next;
+
+    if (lexer_current_char(l) != 'e' && lexer_current_char(l) != 'E') return false;
+    next = lexer_peeknext(l);
+    if (next == '+' || next == '-') next = l->src[l->index + 2];
+    return is_decimal_digit(next);
+}
+
+/*
+ * Scans a decimal float literal starting at `token_begin`, i.e [digits][.digits][e[+-]digits]
+ *
+ * Mantissas of at most 19 digits which fit in 53 bits, scaled by an exactly representable
+ * power of ten, are converted with a single multiplication or division which is correctly
+ * rounded. Everything else falls back to strtod.
+ */
+static Token lexer_scan_float(Katie_Lexer *l) {
+    u64 mantissa;
+    int digit_count, exponent, exponent_value;
+    bool is_exact, is_exponent_negative;
+    f64 value;
+
+    l->index = l->token_start_index;
+    l->col = l->token_start_pos.col;
+    l->token_kind = TokenKind_Float;
+
+    mantissa = 0;
+    digit_count = 0;
+    exponent = 0;
+    is_exact = true;
+
+    while (is_decimal_digit(lexer_current_char(l))) {
+        if (digit_count < 19) {
+            mantissa = mantissa * 10 + decimal_digit_to_int(lexer_current_char(l));
+            if (mantissa) digit_count += 1;
+        } else {
+            exponent += 1;
+            is_exact = false;
+        }
+        lexer_nextchar(l);
+    }
+
+    if (lexer_current_char(l) == '.') {
+        lexer_nextchar(l);
+        while (is_decimal_digit(lexer_current_char(l))) {
+            if (digit_count < 19) {
+                mantissa = mantissa * 10 + decimal_digit_to_int(lexer_current_char(l));
+                if (mantissa) digit_count += 1;
+                exponent -= 1;
+            } else {
+                is_exact = false;
+            }
+            lexer_nextchar(l);
+        }
+    }
+
+    if (lexer_is_exponent_start(l)) {
+        lexer_nextchar(l);
+        is_exponent_negative = lexer_current_char(l) == '-';
+        if (lexer_current_char(l) == '+' || lexer_current_char(l) == '-') lexer_nextchar(l);
+
+        exponent_value = 0;
+        while (is_decimal_digit(lexer_current_char(l))) {
+            if (exponent_value < 100000) {
+                exponent_value = exponent_value * 10 + decimal_digit_to_int(lexer_current_char(l));
+            }
+            lexer_nextchar(l);
+        }
+        exponent += is_exponent_negative ? -exponent_value : exponent_value;
+    }
+
+    if (is_exact && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        value = exponent < 0 ? (f64)mantissa / lexer_exact_pow10[-exponent]
+                             : (f64)mantissa * lexer_exact_pow10[exponent];
+    } else {
+        String text = make_string(l->token_begin, l->index - l->token_start_index);
+        value = strtod(text, NULL);
+        free_string(text);
+    }
+
+    Token token = make_token(l->token_begin, l->index - l->token_start_index, l->token_kind,
+                             l->token_start_pos, l->line_start, 0);
+    token._float = value;
+    return token;
+}
+
 static Token lexer_scan_number(Katie_Lexer *l) {
     i64 number;
     u8 base, digit_value;
+    bool is_overflow;
 
     l->token_begin = &lexer_current_char(l);
     l->token_start_pos = lexer_current_pos(l);
     l->token_start_index = l->index;
 
-    if (lexer_current_char(l) == '.') {
-        while (!lexer_is_end(l) && is_decimal_digit(lexer_current_char(l))) {
-            lexer_nextchar(l);
-        }
-    } else {
-        l->token_kind = TokenKind_Number;
-        base = 10;
+    l->token_kind = TokenKind_Number;
+    base = 10;
 
-        if (lexer_current_char(l) == '0') {
-            switch (lexer_peeknext(l)) {
-            case 'b':
-                base = 2;
-                lexer_nextchar(l);
-                lexer_nextchar(l);
-                break;
+    if (lexer_current_char(l) == '0') {
+        switch (lexer_peeknext(l)) {
+        case 'b':
+            base = 2;
+            lexer_nextchar(l);
+            lexer_nextchar(l);
+            break;
 
-            case 'o':
-                base = 10;
-                lexer_nextchar(l);
-                lexer_nextchar(l);
-                break;
+        case 'o':
+            base = 8;
+            lexer_nextchar(l);
+            lexer_nextchar(l);
+            break;
 
-            case 'x':
-                base = 16;
-                lexer_nextchar(l);
-                lexer_nextchar(l);
-                break;
+        case 'x':
+            base = 16;
+            lexer_nextchar(l);
+            lexer_nextchar(l);
+            break;
 
-            default: break;
-            }
+        default: break;
         }
     }
 
     number = 0;
+    is_overflow = false;
 
     while (!lexer_is_end(l)) {
         digit_value = lexer_digit_value(l);
-        if (digit_value > base) break;
-        number = (number * base) + digit_value;
+        if (digit_value >= base) break;
+
+        /* keep scanning after an overflow, reader re-parses the text as a BigNum */
+        if (!is_overflow && (__builtin_mul_overflow(number, (i64)base, &number) ||
+                             __builtin_add_overflow(number, (i64)digit_value, &number))) {
+            is_overflow = true;
+        }
         lexer_nextchar(l);
     }
 
+    if (base == 10 && (lexer_current_char(l) == '.' || lexer_is_exponent_start(l))) {
+        return lexer_scan_float(l);
+    }
+
+    if (is_overflow) {
+        l->token_kind = TokenKind_BigNumber;
+        number = 0;
+    }
+
     Token token = make_token(l->token_begin, l->index - l->token_start_index, l->token_kind,
                              l->token_start_pos, l->line_start, number);
 
     if (base != 10 && l->index - l->token_start_index <= 2) {
-        katie_syntax_error(l->filepath, &token, "lexer error", "Invaild number");
+        katie_syntax_error(l->errors, l->filepath, &token, "lexer error", "Invaild number");
+        l->error_count += 1;
         token.kind = TokenKind_Invaild;
     }
 
     return token;
 }
 
+/* Scans a string literal of one line, its text keeps the quotes and escapes for the reader */
+static Token lexer_scan_string(Katie_Lexer *l) {
+    Token token;
+
+    l->token_begin = &lexer_current_char(l);
+    l->token_start_pos = lexer_current_pos(l);
+    l->token_start_index = l->index;
+    l->token_kind = TokenKind_String;
+
+    lexer_nextchar(l);
+    while (!lexer_is_end(l) && !lexer_is_line_end(l) && lexer_current_char(l) != '"') {
+        if (lexer_current_char(l) == '\\' && lexer_peeknext(l) != '\0' &&
+            lexer_peeknext(l) != '\n') {
+            lexer_nextchar(l);
+        }
+        lexer_nextchar(l);
+    }
+
+    if (lexer_current_char(l) == '"') {
+        lexer_nextchar(l);
+    } else {
+        l->token_kind = TokenKind_Invaild;
+    }
+
+    token = make_token(l->token_begin, l->index - l->token_start_index, l->token_kind,
+                       l->token_start_pos, l->line_start, 0);
+    if (token.kind == TokenKind_Invaild) {
+        katie_syntax_error(l->errors, l->filepath, &token, "lexer error", "Unterminated string");
+        l->error_count += 1;
+    }
+    return token;
+}
+
 static bool lexer_is_reserved(char sym) {
     switch (sym) {
     case '(':
@@ -278,6 +416,8 @@ static Token lexer_next_token(Katie_Lexer *l) {
         } else if (lexer_current_char(l) == ';') {
             lexer_skip_line_comments(l);
             return lexer_next_token(l);
+        } else if (lexer_current_char(l) == '"') {
+            return lexer_scan_string(l);
         } else {
             return lexer_scan_symbol(l);
         }
@@ -290,11 +430,11 @@ static Token lexer_next_token(Katie_Lexer *l) {
                       0);
 }
 
-Array(Token) katie_lexer_slurp_tokens(Katie_Lexer *l) {
+static Array(Token) lexer_append_tokens(Katie_Lexer *l, Array(Token) tokens) {
     Token tok;
-    Array(Token) tokens;
-
-    init_array(tokens);
+    u64 start_ns = katie_stats_begin();
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_Tokens);
+    usize first = array_length(tokens);
 
     while (tok = lexer_next_token(l), tok.kind != TokenKind_EOS) {
         if (tok.kind != TokenKind_Invaild) {
@@ -303,11 +443,24 @@ Array(Token) katie_lexer_slurp_tokens(Katie_Lexer *l) {
     }
 
     array_push(tokens, tok);
+    katie_stat_add(tokens, array_length(tokens) - first);
+    katie_stats_end(lex_ns, start_ns);
+    katie_alloc_kind_pop(kindSave);
     return tokens;
 }
 
+Array(Token) katie_lexer_slurp_tokens(Katie_Lexer *l) {
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_Tokens);
+    Array(Token) tokens;
+
+    init_array(tokens);
+    katie_alloc_kind_pop(kindSave);
+    return lexer_append_tokens(l, tokens);
+}
+
 KatieVal *alloc_val(KatieValKind kind) {
     KatieVal *val = xmalloc(sizeof(KatieVal));
+    katie_stat_add(vals_allocated, 1);
     val->kind = kind;
     return val;
 }
@@ -322,67 +475,192 @@ KatieVal *alloc_number(i64 number) {
     return val;
 }
 
+KatieVal *alloc_bignum(BigNum bignum) {
+    KatieVal *val = alloc_val(KatieValKind_BigNum);
+    val->as.bignum = bignum;
+    return val;
+}
+
+KatieVal *alloc_float(f64 _float) {
+    KatieVal *val = alloc_val(KatieValKind_Float);
+    val->as._float = _float;
+    return val;
+}
+
 KatieVal *alloc_bool(bool _bool) {
     KatieVal *val = alloc_val(KatieValKind_Bool);
     val->as._bool = _bool;
     return val;
 }
 
+KatieVal *alloc_string(String string) {
+    KatieVal *val = alloc_val(KatieValKind_String);
+    val->as.string = string;
+    return val;
+}
+
 KatieVal *alloc_list(Array(KatieVal *) list) {
     KatieVal *val = alloc_val(KatieValKind_List);
     val->as.list = list;
     return val;
 }
 
-KatieVal *alloc_symbol(char *text, usize length) {
-    KatieVal *val = alloc_val(KatieValKind_Symbol);
-    val->as.symbol = make_string(text, length);
+KatieVal *alloc_seq(Katie_SeqThunk thunk) {
+    KatieVal *val = alloc_val(KatieValKind_Seq);
+    val->as.seq = xmalloc(sizeof(Katie_Seq));
+    val->as.seq->thunk = thunk;
+    val->as.seq->thunk.source.is_owned = false; /* a seq others may read owns nothing */
+    val->as.seq->chunk = NULL;
     return val;
 }
 
+/*
+ * Site ids are shared by every thread and reused once the symbol holding one is freed, so the
+ * per-context site caches stay as large as the most sites ever live at once rather than growing
+ * with every module read by a batch or a server.
+ */
+static pthread_mutex_t katie_site_lock = PTHREAD_MUTEX_INITIALIZER;
+static Array(u32) katie_site_free; /* ids of freed sites */
+static u32 katie_site_count;       /* ids handed out so far */
+
+static u32 katie_site_acquire(void) {
+    u32 site;
+
+    pthread_mutex_lock(&katie_site_lock);
+    if (katie_site_free && !array_is_empty(katie_site_free)) {
+        site = katie_site_free[--array_length(katie_site_free)];
+    } else {
+        site = katie_site_count++;
+    }
+    pthread_mutex_unlock(&katie_site_lock);
+    return site;
+}
+
+static void katie_site_release(u32 site) {
+    pthread_mutex_lock(&katie_site_lock);
+    if (!katie_site_free) init_array(katie_site_free);
+    array_push(katie_site_free, site);
+    pthread_mutex_unlock(&katie_site_lock);
+}
+
+KatieVal *alloc_symbol(char *text, usize length) {
+    Katie_SymbolSite *site = xmalloc(sizeof(Katie_SymbolSite));
+    katie_stat_add(vals_allocated, 1);
+    site->val.kind = KatieValKind_Symbol;
+    site->val.as.symbol = katie_intern(text, length);
+    site->site = katie_site_acquire();
+    site->filepath = NULL;
+    site->pos = (TokenPos){0};
+    return &site->val;
+}
+
 KatieVal *alloc_special(Katie_SpecialKind special_kind) {
-    KatieVal *val = alloc_val(KatieValKind_Special);
+    KatieVal *val;
+
+    if (special_kind == Katie_Special_Fn) {
+        Katie_FnSite *site = xmalloc(sizeof(Katie_FnSite));
+        katie_stat_add(vals_allocated, 1);
+        site->info = NULL;
+        site->filepath = NULL;
+        site->pos = (TokenPos){0};
+        val = &site->val;
+        val->kind = KatieValKind_Special;
+    } else {
+        val = alloc_val(KatieValKind_Special);
+    }
+
     val->as.special = special_kind;
     return val;
 }
 
 KatieVal *alloc_native_proc(Katie_Proc proc) {
     KatieVal *val = alloc_val(KatieValKind_NativeFunction);
-    val->as.proc = proc;
+    val->as.native.proc = proc;
+    val->as.native.spec = NULL;
+    val->as.native.stat = NULL;
+    return val;
+}
+
+KatieVal *alloc_native(Katie_NativeSpec *spec) {
+    KatieVal *val = alloc_native_proc(spec->proc);
+
+    Debug_Assert_Message(!katie_spec_has_fixnum2(spec) ||
+                             (spec->min_args <= 2 &&
+                              (spec->max_args == KATIE_VARIADIC || spec->max_args >= 2)),
+                         "fixnum2 of a native which never takes two args");
+    val->as.native.spec = spec;
     return val;
 }
 
-KatieVal *alloc_function(KatieEnv *env, KatieVal *name, KatieVal *params, KatieVal *body) {
+KatieVal *alloc_function(Katie_FnInfo *info, KatieVal *name, KatieVal *params, KatieVal *body) {
     KatieVal *val = alloc_val(KatieValKind_Function);
-    val->as.function.env = env;
+    val->as.function.info = info;
     val->as.function.name = name;
     val->as.function.params = params;
     val->as.function.body = body;
+    val->as.function.captured =
+        array_is_empty(info->captures)
+            ? NULL
+            : xmalloc(array_length(info->captures) * sizeof(KatieVal *));
     return val;
 }
 
+KatieVal *alloc_box(KatieVal *val) {
+    KatieVal *box = alloc_val(KatieValKind_Box);
+    box->as.box = val;
+    return box;
+}
+
 void dealloc_val(KatieVal *val) {
     switch (val->kind) {
+    case KatieValKind_Nil:
     case KatieValKind_Number:
-    case KatieValKind_Bool:
-    case KatieValKind_Special: break;
-    case KatieValKind_Symbol: free_string(val->as.symbol); break;
+    case KatieValKind_Float:
+    case KatieValKind_Bool: break;
+    case KatieValKind_Special: {
+        Katie_FnInfo *info;
+        if (val->as.special != Katie_Special_Fn || !(info = KATIE_FN_SITE(val)->info)) break;
+        free_array(info->captures);
+        free_array(info->boxed);
+        if (info->code) katie_free_code(info->code);
+        xfree(info);
+    } break;
+    case KatieValKind_BigNum: bignum_free(val->as.bignum); break;
+    case KatieValKind_String: free_string(val->as.string); break;
+    /* names are owned by the symbol table */
+    case KatieValKind_Symbol: katie_site_release(KATIE_SYMBOL_SITE(val)->site); break;
 
     case KatieValKind_List: {
         array_for_each(val->as.list, i) { dealloc_val(val->as.list[i]); }
         free_array(val->as.list);
     } break;
 
-    case KatieValKind_Function: {
-        dealloc_val(val->as.function.name);
-        dealloc_val(val->as.function.params);
-        dealloc_val(val->as.function.body);
+    case KatieValKind_Function: { /* the fn form is owned by its module */
+        if (val->as.function.captured) xfree(val->as.function.captured);
     } break;
 
+    case KatieValKind_Box: break;
+    case KatieValKind_Future: break; /* the task may still be running */
+    case KatieValKind_Seq: katie_seq_free(val->as.seq); break;
+
     default: Unreachable();
     }
 
-    free(val);
+    katie_stat_add(vals_freed, 1);
+    xfree(val);
+}
+
+/* Shortest representation which reads back as the same double, always marked as a float */
+static void katie_format_float(char *buf, f64 _float) {
+    int precision;
+
+    for (precision = 15; precision < 17; ++precision) {
+        sprintf(buf, "%.*g", precision, _float);
+        if (strtod(buf, NULL) == _float) break;
+    }
+    if (precision == 17) sprintf(buf, "%.17g", _float);
+
+    if (!strpbrk(buf, ".eni")) strcat(buf, ".0"); /* skip "inf" and "nan" too */
 }
 
 String katie_value_as_string(String strResult, KatieVal *val) {
@@ -395,8 +673,27 @@ String katie_value_as_string(String strResult, KatieVal *val) {
         strResult = append_string_length(strResult, buf, strlen(buf));
     } break;
 
+    case KatieValKind_BigNum: strResult = bignum_append_string(strResult, val->as.bignum); break;
+
+    case KatieValKind_Float: {
+        char buf[64];
+        katie_format_float(buf, val->as._float);
+        strResult = append_cstring(strResult, buf);
+    } break;
+
+    case KatieValKind_Bool:
+        strResult = append_cstring(strResult, val->as._bool ? "true" : "false");
+        break;
+
+    case KatieValKind_String:
+        strResult = append_cstring(strResult, "\"");
+        strResult = append_string_length(strResult, val->as.string, string_length(val->as.string));
+        strResult = append_cstring(strResult, "\"");
+        break;
+
     case KatieValKind_Symbol:
-        strResult = append_string_length(strResult, val->as.symbol, string_length(val->as.symbol));
+        strResult = append_string_length(strResult, val->as.symbol.name,
+                                         string_length(val->as.symbol.name));
         break;
 
     case KatieValKind_Special:
@@ -413,6 +710,35 @@ String katie_value_as_string(String strResult, KatieVal *val) {
         strResult = append_cstring(strResult, ")");
         break;
 
+    case KatieValKind_NativeFunction:
+        strResult = append_cstring(strResult, "#<native-function>");
+        break;
+    case KatieValKind_Function: strResult = append_cstring(strResult, "#<function>"); break;
+    case KatieValKind_Future: strResult = append_cstring(strResult, "#<future>"); break;
+
+    case KatieValKind_Seq: { /* as far as it is realized, never realizing any of it */
+        usize printed = 0, i;
+
+        strResult = append_cstring(strResult, "(");
+        for (KatieVal *seq = val; seq;) {
+            Katie_SeqChunk *chunk = __atomic_load_n(&seq->as.seq->chunk, __ATOMIC_ACQUIRE);
+            if (!chunk) {
+                strResult = append_cstring(strResult, "... ");
+                break;
+            }
+            for (i = 0; i < array_length(chunk->values) && printed < KATIE_SEQ_PRINT; ++i) {
+                strResult = katie_value_as_string(strResult, chunk->values[i]);
+                strResult = append_cstring(strResult, " ");
+                printed += 1;
+            }
+            if (i < array_length(chunk->values) || (printed == KATIE_SEQ_PRINT && chunk->rest)) {
+                strResult = append_cstring(strResult, "... ");
+                break;
+            }
+            seq = chunk->rest;
+        }
+        strResult = append_cstring(strResult, ")");
+    } break;
     default: Unreachable();
     }
 
@@ -423,8 +749,21 @@ void katie_print_value(KatieVal *val) {
     switch (val->kind) {
     case KatieValKind_Nil: printf("nil"); break;
     case KatieValKind_Number: printf("%ld", val->as.number); break;
+    case KatieValKind_BigNum: {
+        String s = bignum_append_string(make_string_empty(), val->as.bignum);
+        printf("%s", s);
+        free_string(s);
+    } break;
+    case KatieValKind_Float: {
+        char buf[64];
+        katie_format_float(buf, val->as._float);
+        printf("%s", buf);
+    } break;
     case KatieValKind_Bool: printf("%s", val->as._bool ? "true" : "false"); break;
-    case KatieValKind_Symbol: printf("%s", val->as.symbol); break;
+    case KatieValKind_String:
+        printf("\"%.*s\"", (int)string_length(val->as.string), val->as.string);
+        break;
+    case KatieValKind_Symbol: printf("%s", val->as.symbol.name); break;
     case KatieValKind_Special: printf("%s", katie_special_kind_to_cstring[val->as.special]); break;
     case KatieValKind_List:
         printf("(");
@@ -437,6 +776,12 @@ void katie_print_value(KatieVal *val) {
 
     case KatieValKind_NativeFunction: printf("#<native-function>"); break;
     case KatieValKind_Function: printf("#<function>"); break;
+    case KatieValKind_Future: printf("#<future>"); break;
+    case KatieValKind_Seq: {
+        String s = katie_value_as_string(make_string_empty(), val);
+        printf("%s", s);
+        free_string(s);
+    } break;
     default: Unreachable();
     }
 }
@@ -449,13 +794,28 @@ void katie_print_value(KatieVal *val) {
 #define reader_is_end(r) (r->tokens[r->index].kind == TokenKind_EOS)
 #define reader_next_token(r) r->index += 1
 
-void katie_init_reader(Katie_Reader *r, char *source_filepath, char *src) {
+void katie_init_reader(Katie_Reader *r, char *source_filepath, char *src, String *errors) {
     Katie_Lexer l;
     katie_init_lexer(&l, source_filepath, src);
+    l.errors = errors;
     r->source_filepath = source_filepath;
     r->src = src;
+    r->errors = errors;
     r->tokens = katie_lexer_slurp_tokens(&l);
     r->index = 0;
+    r->error_count = l.error_count;
+}
+
+/* Points the reader at another source, reusing the token buffer of the previous one */
+void katie_reset_reader(Katie_Reader *r, char *src) {
+    Katie_Lexer l;
+    katie_init_lexer(&l, r->source_filepath, src);
+    l.errors = r->errors;
+    r->src = src;
+    array_length(r->tokens) = 0;
+    r->tokens = lexer_append_tokens(&l, r->tokens);
+    r->index = 0;
+    r->error_count = l.error_count;
 }
 
 void katie_deinit_reader(Katie_Reader *r) {
@@ -464,11 +824,32 @@ void katie_deinit_reader(Katie_Reader *r) {
 
 static void reader_expect(Katie_Reader *r, TokenKind kind) {
     if (reader_curr_token(r).kind != kind) {
-        katie_syntax_error(r->source_filepath, &reader_curr_token(r), "reader error",
+        katie_syntax_error(r->errors, r->source_filepath, &reader_curr_token(r), "reader error",
                            "expected kind '%s' instead got '%s'", token_kind_to_cstring[kind],
                            token_kind_to_cstring[reader_curr_token(r).kind]);
+        r->error_count += 1;
+    }
+    if (!reader_is_end(r)) reader_next_token(r);
+}
+
+/* The text of a string token without its quotes, escapes replaced by what they stand for */
+static KatieVal *read_string(Token *token) {
+    String string = make_string_empty();
+    char ch;
+
+    for (usize i = 1; i + 1 < token->text_length; ++i) {
+        ch = token->text[i];
+        if (ch == '\\') {
+            switch (ch = token->text[++i]) {
+            case 'n': ch = '\n'; break;
+            case 't': ch = '\t'; break;
+            case '0': ch = '\0'; break;
+            default: break; /* \" and \\ stand for themselves, as does any other */
+            }
+        }
+        string = append_string_length(string, &ch, 1);
     }
-    reader_next_token(r);
+    return alloc_string(string);
 }
 
 static KatieVal *read_list(Katie_Reader *r) {
@@ -500,8 +881,26 @@ KatieVal *katie_read_form(Katie_Reader *r) {
         reader_next_token(r);
         break;
 
+    case TokenKind_BigNumber:
+        val = alloc_bignum(
+            bignum_from_text(reader_curr_token(r).text, reader_curr_token(r).text_length));
+        reader_next_token(r);
+        break;
+
+    case TokenKind_Float:
+        val = alloc_float(reader_curr_token(r)._float);
+        reader_next_token(r);
+        break;
+
+    case TokenKind_String:
+        val = read_string(&reader_curr_token(r));
+        reader_next_token(r);
+        break;
+
     case TokenKind_Symbol:
         val = alloc_symbol(reader_curr_token(r).text, reader_curr_token(r).text_length);
+        KATIE_SYMBOL_SITE(val)->filepath = r->source_filepath;
+        KATIE_SYMBOL_SITE(val)->pos = reader_curr_token(r).pos;
         reader_next_token(r);
         break;
 
@@ -520,8 +919,15 @@ KatieVal *katie_read_form(Katie_Reader *r) {
         reader_next_token(r);
         break;
 
+    case TokenKind_Special_Do:
+        val = alloc_special(Katie_Special_Do);
+        reader_next_token(r);
+        break;
+
     case TokenKind_Special_Fn:
         val = alloc_special(Katie_Special_Fn);
+        KATIE_FN_SITE(val)->filepath = r->source_filepath;
+        KATIE_FN_SITE(val)->pos = reader_curr_token(r).pos;
         reader_next_token(r);
         break;
 
@@ -531,21 +937,57 @@ KatieVal *katie_read_form(Katie_Reader *r) {
         reader_expect(r, TokenKind_RightParen);
         break;
 
-    default: Unreachable();
+    default:
+        katie_syntax_error(r->errors, r->source_filepath, &reader_curr_token(r), "reader error",
+                           "unexpected '%s'", token_kind_to_cstring[reader_curr_token(r).kind]);
+        r->error_count += 1;
+        reader_next_token(r);
+        return NULL;
     }
 
+    katie_stat_add(ast_nodes, 1);
     return val;
 }
 
+/* NULL when the source has syntax errors */
 Katie_Module *katie_read_module(Katie_Reader *r) {
-    return read_list(r);
+    u64 start_ns = katie_stats_begin();
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_AstNode);
+    Katie_Module *module = read_list(r);
+
+    while (!reader_is_end(r)) { /* unbalanced ')' */
+        katie_read_form(r);
+    }
+    katie_stats_end(read_ns, start_ns);
+    katie_alloc_kind_pop(kindSave);
+    if (r->error_count) {
+        dealloc_val(module);
+        return NULL;
+    }
+    return module;
 }
 
 // --------------------------------------------------------------------------
 //                          - Error Reporting -
 // --------------------------------------------------------------------------
-void katie_syntax_error(char *filepath, Token *token, char *prefix, char *msg, ...) {
+/* Appended to `errors` a line each, printed with the faulty line when it is NULL */
+void katie_syntax_error(String *errors, char *filepath, Token *token, char *prefix, char *msg,
+                        ...) {
     va_list ap;
+
+    if (errors) {
+        char buf[512];
+        int length = snprintf(buf, sizeof(buf), "%s:%zu:%zu: %s: ", filepath, token->pos.row,
+                              token->pos.col, prefix);
+        va_start(ap, msg);
+        vsnprintf(buf + length, sizeof(buf) - (usize)length, msg, ap);
+        va_end(ap);
+
+        if (string_length(*errors)) *errors = append_cstring(*errors, "\n");
+        *errors = append_cstring(*errors, buf);
+        return;
+    }
+
     va_start(ap, msg);
     fprintf(stderr, "%s:%zu:%zu: %s: ", filepath, token->pos.row, token->pos.col, prefix);
     vfprintf(stderr, msg, ap);
@@ -562,107 +1004,740 @@ void katie_syntax_error(char *filepath, Token *token, char *prefix, char *msg, .
     fprintf(stderr, "\n\n");
 }
 
+/* Exits, unless the context set a recovery point with katie_try_eval_module */
+void katie_runtime_error(Katie *ctx, char *msg, ...) {
+    va_list ap;
+
+    if (ctx && ctx->recover) {
+        char buf[512];
+        va_start(ap, msg);
+        vsnprintf(buf, sizeof(buf), msg, ap);
+        va_end(ap);
+
+        katie_alloc_kind_push(Katie_AllocKind_String); /* restored by the recovery point */
+        ctx->error = append_cstring(string_reset(ctx->error), buf);
+        longjmp(*ctx->recover, 1);
+    }
+
+    va_start(ap, msg);
+    fprintf(stderr, "runtime error: ");
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+
+    putc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
 // --------------------------------------------------------------------------
-//                          - Native Functions -
+//                          - Numeric Tower -
 // --------------------------------------------------------------------------
-static i64 katie_get_op_value(KatieVal *val) {
+/*
+ * Arithmetic natives keep an unboxed fixnum accumulator on their fast path. Once an operand is
+ * not a fixnum, or an operation overflows, the rest of the fold continues on a Katie_Num and every
+ * step dispatches through a table indexed by the classes of both operands.
+ */
+typedef enum {
+    Katie_NumClass_Fixnum,
+    Katie_NumClass_BigNum,
+    Katie_NumClass_Float,
+    Katie_NumClass_Count,
+} Katie_NumClass;
+
+typedef enum {
+    Katie_NumOp_Add,
+    Katie_NumOp_Sub,
+    Katie_NumOp_Mul,
+    Katie_NumOp_Div,
+    Katie_NumOp_Count,
+} Katie_NumOp;
+
+/* Accumulators own their BigNum, operands borrow it from their KatieVal */
+typedef struct Katie_Num Katie_Num;
+struct Katie_Num {
+    Katie_NumClass cls;
+    union {
+        i64 fixnum;
+        BigNum bignum;
+        f64 _float;
+    } as;
+};
+
+typedef Katie_Num (*Katie_NumBinop)(Katie *ctx, Katie_Num acc, Katie_Num operand);
+typedef int (*Katie_NumCompare)(Katie_Num a, Katie_Num b);
+
+#define KATIE_NUM_UNORDERED 2 /* comparison result involving NaN */
+
+/* Operand of an arithmetic native as a fixnum, bools count as 0 and 1 */
+static inline bool katie_get_fixnum(KatieVal *val, i64 *out) {
     switch (val->kind) {
-    case KatieValKind_Number: return val->as.number;
-    case KatieValKind_Bool: return cast(i64) val->as._bool;
-    default: return -1;
+    case KatieValKind_Number: *out = val->as.number; return true;
+    case KatieValKind_Bool: *out = cast(i64) val->as._bool; return true;
+    default: return false;
+    }
+}
+
+static inline Katie_Num katie_num_fixnum(i64 fixnum) {
+    return (Katie_Num){.cls = Katie_NumClass_Fixnum, .as.fixnum = fixnum};
+}
+
+static inline Katie_Num katie_num_float(f64 _float) {
+    return (Katie_Num){.cls = Katie_NumClass_Float, .as._float = _float};
+}
+
+/* Demotes to a fixnum whenever the BigNum fits */
+static Katie_Num katie_num_bignum(BigNum bignum) {
+    i64 fixnum;
+
+    if (bignum_fits_i64(bignum, &fixnum)) {
+        bignum_free(bignum);
+        return katie_num_fixnum(fixnum);
+    }
+    return (Katie_Num){.cls = Katie_NumClass_BigNum, .as.bignum = bignum};
+}
+
+/* `is_owned` copies a BigNum so the result can be used as an accumulator */
+static Katie_Num katie_num_from_val(Katie *ctx, KatieVal *val, bool is_owned) {
+    i64 fixnum;
+
+    switch (val->kind) {
+    case KatieValKind_Float: return katie_num_float(val->as._float);
+    case KatieValKind_BigNum:
+        return (Katie_Num){.cls = Katie_NumClass_BigNum,
+                           .as.bignum = is_owned ? bignum_copy(val->as.bignum) : val->as.bignum};
+    default:
+        if (!katie_get_fixnum(val, &fixnum)) {
+            katie_runtime_error(ctx, "expected number, got %s",
+                                katie_val_kind_to_cstring[val->kind]);
+        }
+        return katie_num_fixnum(fixnum);
     }
 }
 
+static KatieVal *katie_num_to_val(Katie_Num num) {
+    switch (num.cls) {
+    case Katie_NumClass_Fixnum: return alloc_number(num.as.fixnum);
+    case Katie_NumClass_BigNum: return alloc_bignum(num.as.bignum);
+    case Katie_NumClass_Float: return alloc_float(num.as._float);
+    default: Unreachable();
+    }
+    return NULL;
+}
+
+static f64 katie_num_as_f64(Katie_Num num) {
+    switch (num.cls) {
+    case Katie_NumClass_Fixnum: return (f64)num.as.fixnum;
+    case Katie_NumClass_BigNum: return bignum_to_f64(num.as.bignum);
+    default: return num.as._float;
+    }
+}
+
+static BigNum katie_num_as_bignum(Katie_Num num) {
+    return num.cls == Katie_NumClass_BigNum ? num.as.bignum : bignum_from_i64(num.as.fixnum);
+}
+
+static Katie_Num num_bignum_apply(Katie *ctx, Katie_Num acc, Katie_Num operand,
+                                  BigNum (*op)(BigNum, BigNum)) {
+    BigNum lhs, rhs, result;
+
+    lhs = katie_num_as_bignum(acc);
+    rhs = katie_num_as_bignum(operand);
+    if (op == bignum_div && bignum_is_zero(rhs)) {
+        katie_runtime_error(ctx, "division by zero");
+    }
+
+    result = op(lhs, rhs);
+    bignum_free(lhs);
+    if (operand.cls != Katie_NumClass_BigNum) bignum_free(rhs);
+    return katie_num_bignum(result);
+}
+
+static f64 num_take_f64(Katie_Num acc) {
+    f64 result = katie_num_as_f64(acc);
+    if (acc.cls == Katie_NumClass_BigNum) bignum_free(acc.as.bignum);
+    return result;
+}
+
+static Katie_Num num_add_fixnum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    i64 result;
+    if (__builtin_add_overflow(acc.as.fixnum, operand.as.fixnum, &result))
+        return num_bignum_apply(ctx, acc, operand, bignum_add);
+    return katie_num_fixnum(result);
+}
+
+static Katie_Num num_sub_fixnum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    i64 result;
+    if (__builtin_sub_overflow(acc.as.fixnum, operand.as.fixnum, &result))
+        return num_bignum_apply(ctx, acc, operand, bignum_sub);
+    return katie_num_fixnum(result);
+}
+
+static Katie_Num num_mul_fixnum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    i64 result;
+    if (__builtin_mul_overflow(acc.as.fixnum, operand.as.fixnum, &result))
+        return num_bignum_apply(ctx, acc, operand, bignum_mul);
+    return katie_num_fixnum(result);
+}
+
+static Katie_Num num_div_fixnum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    if (operand.as.fixnum == 0) {
+        katie_runtime_error(ctx, "division by zero");
+    }
+    /* I64_MIN / -1 is the only overflowing fixnum division */
+    if (acc.as.fixnum == I64_MIN && operand.as.fixnum == -1)
+        return num_bignum_apply(ctx, acc, operand, bignum_div);
+    return katie_num_fixnum(acc.as.fixnum / operand.as.fixnum);
+}
+
+static Katie_Num num_add_bignum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    return num_bignum_apply(ctx, acc, operand, bignum_add);
+}
+
+static Katie_Num num_sub_bignum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    return num_bignum_apply(ctx, acc, operand, bignum_sub);
+}
+
+static Katie_Num num_mul_bignum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    return num_bignum_apply(ctx, acc, operand, bignum_mul);
+}
+
+static Katie_Num num_div_bignum(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    return num_bignum_apply(ctx, acc, operand, bignum_div);
+}
+
+static Katie_Num num_add_float(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    (void)ctx;
+    return katie_num_float(num_take_f64(acc) + katie_num_as_f64(operand));
+}
+
+static Katie_Num num_sub_float(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    (void)ctx;
+    return katie_num_float(num_take_f64(acc) - katie_num_as_f64(operand));
+}
+
+static Katie_Num num_mul_float(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    (void)ctx;
+    return katie_num_float(num_take_f64(acc) * katie_num_as_f64(operand));
+}
+
+static Katie_Num num_div_float(Katie *ctx, Katie_Num acc, Katie_Num operand) {
+    (void)ctx;
+    return katie_num_float(num_take_f64(acc) / katie_num_as_f64(operand));
+}
+
+/* Mixing a float with anything gives a float, otherwise a BigNum operand promotes */
+#define KATIE_NUM_BINOP_ROW(fixnum_op, bignum_op, float_op)                                        \
+    {                                                                                              \
+        [Katie_NumClass_Fixnum] = {fixnum_op, bignum_op, float_op},                                \
+        [Katie_NumClass_BigNum] = {bignum_op, bignum_op, float_op},                                \
+        [Katie_NumClass_Float] = {float_op, float_op, float_op},                                   \
+    }
+
+static Katie_NumBinop const katie_num_binop_table[Katie_NumOp_Count][Katie_NumClass_Count]
+                                                 [Katie_NumClass_Count] = {
+    [Katie_NumOp_Add] = KATIE_NUM_BINOP_ROW(num_add_fixnum, num_add_bignum, num_add_float),
+    [Katie_NumOp_Sub] = KATIE_NUM_BINOP_ROW(num_sub_fixnum, num_sub_bignum, num_sub_float),
+    [Katie_NumOp_Mul] = KATIE_NUM_BINOP_ROW(num_mul_fixnum, num_mul_bignum, num_mul_float),
+    [Katie_NumOp_Div] = KATIE_NUM_BINOP_ROW(num_div_fixnum, num_div_bignum, num_div_float),
+};
+
+static int num_compare_fixnum(Katie_Num a, Katie_Num b) {
+    return (a.as.fixnum > b.as.fixnum) - (a.as.fixnum < b.as.fixnum);
+}
+
+static int num_compare_bignum(Katie_Num a, Katie_Num b) {
+    BigNum lhs = katie_num_as_bignum(a), rhs = katie_num_as_bignum(b);
+    int result = bignum_compare(lhs, rhs);
+    if (a.cls != Katie_NumClass_BigNum) bignum_free(lhs);
+    if (b.cls != Katie_NumClass_BigNum) bignum_free(rhs);
+    return result;
+}
+
+/* The largest integral float at most `_float`, which is finite */
+static f64 katie_floor_f64(f64 _float) {
+    f64 truncated;
+
+    if (_float <= -0x1p52 || _float >= 0x1p52) return _float; /* no fraction bits left */
+    truncated = (f64)(i64)_float;
+    return truncated > _float ? truncated - 1 : truncated;
+}
+
+/* The integer an integral, finite float holds, exactly */
+static Katie_Num katie_num_from_integral_f64(f64 integral) {
+    BigNum result, factor, product;
+    u64 bits;
+    i64 mantissa;
+    int exponent;
+
+    if (integral >= -0x1p63 && integral < 0x1p63) return katie_num_fixnum((i64)integral);
+
+    /* past 2^63 a float is its 53 bit mantissa shifted left, by at least 11 */
+    memcpy(&bits, &integral, sizeof(bits));
+    mantissa = (i64)((bits & ((1ull << 52) - 1)) | (1ull << 52));
+    exponent = (int)((bits >> 52) & 0x7ff) - 1075;
+
+    result = bignum_from_i64(integral < 0 ? -mantissa : mantissa);
+    for (; exponent > 0; exponent -= 30) {
+        factor = bignum_from_i64((i64)1 << (exponent < 30 ? exponent : 30));
+        product = bignum_mul(result, factor);
+        bignum_free(result);
+        bignum_free(factor);
+        result = product;
+    }
+    return katie_num_bignum(result);
+}
+
+/* An integer against a float without rounding the integer, which f64 can not hold past 2^53 */
+static int num_compare_integer_float(Katie_Num integer, f64 _float) {
+    Katie_Num floored;
+    int result;
+
+    if (_float != _float) return KATIE_NUM_UNORDERED;
+    if (isinf(_float)) return _float > 0 ? -1 : 1;
+
+    floored = katie_num_from_integral_f64(katie_floor_f64(_float));
+    if (integer.cls == Katie_NumClass_Fixnum && floored.cls == Katie_NumClass_Fixnum) {
+        result = num_compare_fixnum(integer, floored);
+    } else {
+        result = num_compare_bignum(integer, floored);
+    }
+    if (floored.cls == Katie_NumClass_BigNum) bignum_free(floored.as.bignum);
+
+    /* equal to the floor of a float with a fraction is less than the float */
+    return result == 0 && katie_floor_f64(_float) != _float ? -1 : result;
+}
+
+static int num_compare_float(Katie_Num a, Katie_Num b) {
+    f64 lhs, rhs;
+    int result;
+
+    if (a.cls != Katie_NumClass_Float) return num_compare_integer_float(a, b.as._float);
+    if (b.cls != Katie_NumClass_Float) {
+        result = num_compare_integer_float(b, a.as._float);
+        return result == KATIE_NUM_UNORDERED ? result : -result;
+    }
+
+    lhs = a.as._float;
+    rhs = b.as._float;
+    if (lhs != lhs || rhs != rhs) return KATIE_NUM_UNORDERED;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static Katie_NumCompare const katie_num_compare_table[Katie_NumClass_Count][Katie_NumClass_Count] =
+    KATIE_NUM_BINOP_ROW(num_compare_fixnum, num_compare_bignum, num_compare_float);
+
+/* Continues a fold on `acc` over the remaining operands, takes ownership of `acc` */
+static KatieVal *native_arith_fold(Katie *ctx, Katie_NumOp op, Katie_Num acc, int argc,
+                                   KatieVal **argv) {
+    Katie_Num operand;
+
+    for (int i = 0; i < argc; ++i) {
+        operand = katie_num_from_val(ctx, argv[i], false);
+        acc = katie_num_binop_table[op][acc.cls][operand.cls](ctx, acc, operand);
+    }
+    return katie_num_to_val(acc);
+}
+
+// --------------------------------------------------------------------------
+//                          - Native Functions -
+// --------------------------------------------------------------------------
 static KatieVal *native_op_add(Katie *ctx, int argc, KatieVal **argv) {
-    i64 result, temp;
+    i64 result, operand;
+
     result = 0;
     for (int i = 0; i < argc; ++i) {
-        temp = katie_get_op_value(argv[i]);
-        if (temp >= 0) {
-            result += temp;
+        if (!katie_get_fixnum(argv[i], &operand) ||
+            __builtin_add_overflow(result, operand, &operand)) {
+            return native_arith_fold(ctx, Katie_NumOp_Add, katie_num_fixnum(result), argc - i,
+                                     &argv[i]);
         }
+        result = operand;
     }
     return alloc_number(result);
 }
 
 static KatieVal *native_op_sub(Katie *ctx, int argc, KatieVal **argv) {
-    i64 result, temp;
-    int i = 0;
-
-    do {
-        result = katie_get_op_value(argv[i]);
-        i++;
-    } while (i < argc && result < 0);
-
-    for (; i < argc; ++i) {
-        temp = katie_get_op_value(argv[i]);
-        if (temp >= 0) {
-            result -= temp;
+    i64 result, operand;
+
+    if (!katie_get_fixnum(argv[0], &result)) {
+        return native_arith_fold(ctx, Katie_NumOp_Sub, katie_num_from_val(ctx, argv[0], true),
+                                 argc - 1, &argv[1]);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if (!katie_get_fixnum(argv[i], &operand) ||
+            __builtin_sub_overflow(result, operand, &operand)) {
+            return native_arith_fold(ctx, Katie_NumOp_Sub, katie_num_fixnum(result), argc - i,
+                                     &argv[i]);
         }
+        result = operand;
     }
     return alloc_number(result);
 }
 
 static KatieVal *native_op_mul(Katie *ctx, int argc, KatieVal **argv) {
-    i64 result, temp;
+    i64 result, operand;
+
     result = 1;
     for (int i = 0; i < argc; ++i) {
-        temp = katie_get_op_value(argv[i]);
-        if (temp >= 0) {
-            result *= temp;
+        if (!katie_get_fixnum(argv[i], &operand) ||
+            __builtin_mul_overflow(result, operand, &operand)) {
+            return native_arith_fold(ctx, Katie_NumOp_Mul, katie_num_fixnum(result), argc - i,
+                                     &argv[i]);
         }
+        result = operand;
     }
     return alloc_number(result);
 }
 
 static KatieVal *native_op_div(Katie *ctx, int argc, KatieVal **argv) {
-    i64 result, temp;
-    int i = 0;
-
-    do {
-        result = katie_get_op_value(argv[i]);
-        i++;
-    } while (i < argc && result < 0);
-
-    for (; i < argc; ++i) {
-        temp = katie_get_op_value(argv[i]);
-        if (temp >= 0) {
-            result = cast(i64)(result / temp);
+    i64 result, operand;
+
+    if (!katie_get_fixnum(argv[0], &result)) {
+        return native_arith_fold(ctx, Katie_NumOp_Div, katie_num_from_val(ctx, argv[0], true),
+                                 argc - 1, &argv[1]);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        /* I64_MIN / -1 is the only overflowing fixnum division */
+        if (!katie_get_fixnum(argv[i], &operand) || operand == 0 ||
+            (result == I64_MIN && operand == -1)) {
+            return native_arith_fold(ctx, Katie_NumOp_Div, katie_num_fixnum(result), argc - i,
+                                     &argv[i]);
         }
+        result = result / operand;
     }
     return alloc_number(result);
 }
 
+static bool katie_values_equal(Katie *ctx, KatieVal *a, KatieVal *b);
+
+/* Chained comparison, (< a b c) holds when every adjacent pair does */
+static bool native_compare_chain(Katie *ctx, int argc, KatieVal **argv, int lo, int hi) {
+    Katie_Num lhs, rhs;
+    int result;
+
+    for (int i = 0; i + 1 < argc; ++i) {
+        lhs = katie_num_from_val(ctx, argv[i], false);
+        rhs = katie_num_from_val(ctx, argv[i + 1], false);
+        result = katie_num_compare_table[lhs.cls][rhs.cls](lhs, rhs);
+        if (result < lo || result > hi) return false;
+    }
+    return true;
+}
+
+static KatieVal *native_op_lt(Katie *ctx, int argc, KatieVal **argv) {
+    return alloc_bool(native_compare_chain(ctx, argc, argv, -1, -1));
+}
+
+static KatieVal *native_op_gt(Katie *ctx, int argc, KatieVal **argv) {
+    return alloc_bool(native_compare_chain(ctx, argc, argv, 1, 1));
+}
+
+static KatieVal *native_op_le(Katie *ctx, int argc, KatieVal **argv) {
+    return alloc_bool(native_compare_chain(ctx, argc, argv, -1, 0));
+}
+
+static KatieVal *native_op_ge(Katie *ctx, int argc, KatieVal **argv) {
+    return alloc_bool(native_compare_chain(ctx, argc, argv, 0, 1));
+}
+
+static KatieVal *native_op_eq(Katie *ctx, int argc, KatieVal **argv) {
+    for (int i = 0; i + 1 < argc; ++i) {
+        if (!katie_values_equal(ctx, argv[i], argv[i + 1])) return alloc_bool(false);
+    }
+    return alloc_bool(true);
+}
+
+static bool native_fixnum_add(i64 a, i64 b, i64 *result) {
+    return !__builtin_add_overflow(a, b, result);
+}
+
+static bool native_fixnum_sub(i64 a, i64 b, i64 *result) {
+    return !__builtin_sub_overflow(a, b, result);
+}
+
+static bool native_fixnum_mul(i64 a, i64 b, i64 *result) {
+    return !__builtin_mul_overflow(a, b, result);
+}
+
+static bool native_fixnum_div(i64 a, i64 b, i64 *result) {
+    if (b == 0 || (a == I64_MIN && b == -1)) return false;
+    *result = a / b;
+    return true;
+}
+
+static bool native_fixnum_lt(i64 a, i64 b, i64 *result) {
+    *result = a < b;
+    return true;
+}
+
+static bool native_fixnum_gt(i64 a, i64 b, i64 *result) {
+    *result = a > b;
+    return true;
+}
+
+static bool native_fixnum_le(i64 a, i64 b, i64 *result) {
+    *result = a <= b;
+    return true;
+}
+
+static bool native_fixnum_ge(i64 a, i64 b, i64 *result) {
+    *result = a >= b;
+    return true;
+}
+
+static bool native_fixnum_eq(i64 a, i64 b, i64 *result) {
+    *result = a == b;
+    return true;
+}
+
+static KatieVal *native_list(Katie *ctx, int argc, KatieVal **argv) {
+    Array(KatieVal *) list;
+
+    (void)ctx;
+    array_reserve(list, (usize)argc + 1);
+    for (int i = 0; i < argc; ++i)
+        array_push(list, argv[i]);
+    return alloc_list(list);
+}
+
+static bool katie_is_number(KatieVal *val) {
+    return val->kind == KatieValKind_Number || val->kind == KatieValKind_BigNum ||
+           val->kind == KatieValKind_Float;
+}
+
+/* Numbers compare by value across the tower, everything else structurally */
+static bool katie_values_equal(Katie *ctx, KatieVal *a, KatieVal *b) {
+    if (katie_is_number(a) && katie_is_number(b)) {
+        Katie_Num lhs = katie_num_from_val(ctx, a, false), rhs = katie_num_from_val(ctx, b, false);
+        return katie_num_compare_table[lhs.cls][rhs.cls](lhs, rhs) == 0;
+    }
+    if (a->kind != b->kind) return false;
+
+    switch (a->kind) {
+    case KatieValKind_Nil: return true;
+    case KatieValKind_Bool: return a->as._bool == b->as._bool;
+    case KatieValKind_String:
+        return string_length(a->as.string) == string_length(b->as.string) &&
+               memcmp(a->as.string, b->as.string, string_length(a->as.string)) == 0;
+    case KatieValKind_Symbol: return a->as.symbol.id == b->as.symbol.id;
+    case KatieValKind_Special: return a->as.special == b->as.special;
+    case KatieValKind_List: {
+        if (array_length(a->as.list) != array_length(b->as.list)) return false;
+        array_for_each(a->as.list, i) {
+            if (!katie_values_equal(ctx, a->as.list[i], b->as.list[i])) return false;
+        }
+        return true;
+    }
+    default: return a == b;
+    }
+}
+
+static Katie_NativeSpec katie_builtin_natives[] = {
+    {.name = "+", .proc = native_op_add, .max_args = KATIE_VARIADIC, .kinds = KATIE_KINDS_NUMBER,
+     .is_pure = true, .fixnum2 = native_fixnum_add},
+    {.name = "-", .proc = native_op_sub, .min_args = 1, .max_args = KATIE_VARIADIC,
+     .kinds = KATIE_KINDS_NUMBER, .is_pure = true, .fixnum2 = native_fixnum_sub},
+    {.name = "*", .proc = native_op_mul, .max_args = KATIE_VARIADIC, .kinds = KATIE_KINDS_NUMBER,
+     .is_pure = true, .fixnum2 = native_fixnum_mul},
+    {.name = "/", .proc = native_op_div, .min_args = 1, .max_args = KATIE_VARIADIC,
+     .kinds = KATIE_KINDS_NUMBER, .is_pure = true, .fixnum2 = native_fixnum_div},
+    {.name = "<", .proc = native_op_lt, .max_args = KATIE_VARIADIC, .kinds = KATIE_KINDS_NUMBER,
+     .is_pure = true, .fixnum2 = native_fixnum_lt, .is_predicate = true},
+    {.name = ">", .proc = native_op_gt, .max_args = KATIE_VARIADIC, .kinds = KATIE_KINDS_NUMBER,
+     .is_pure = true, .fixnum2 = native_fixnum_gt, .is_predicate = true},
+    {.name = "<=", .proc = native_op_le, .max_args = KATIE_VARIADIC, .kinds = KATIE_KINDS_NUMBER,
+     .is_pure = true, .fixnum2 = native_fixnum_le, .is_predicate = true},
+    {.name = ">=", .proc = native_op_ge, .max_args = KATIE_VARIADIC, .kinds = KATIE_KINDS_NUMBER,
+     .is_pure = true, .fixnum2 = native_fixnum_ge, .is_predicate = true},
+    {.name = "=", .proc = native_op_eq, .max_args = KATIE_VARIADIC, .is_pure = true,
+     .fixnum2 = native_fixnum_eq, .is_predicate = true},
+    {.name = "list", .proc = native_list, .max_args = KATIE_VARIADIC},
+};
+
+/* The first kind of a mask, to name what was expected, bools only when nothing else is */
+static KatieValKind katie_kinds_first(u32 kinds) {
+    if (kinds != KATIE_KIND(Bool)) kinds &= ~KATIE_KIND(Bool);
+    return (KatieValKind)__builtin_ctz(kinds);
+}
+
+static void katie_check_native_args(Katie *ctx, Katie_NativeSpec *spec, int argc,
+                                    KatieVal **argv) {
+    if (argc < spec->min_args) {
+        katie_runtime_error(ctx, "%s expects at least %d argument%s, got %d", spec->name,
+                            spec->min_args, spec->min_args == 1 ? "" : "s", argc);
+    }
+    if (spec->max_args != KATIE_VARIADIC && argc > spec->max_args) {
+        katie_runtime_error(ctx, "%s expects at most %d argument%s, got %d", spec->name,
+                            spec->max_args, spec->max_args == 1 ? "" : "s", argc);
+    }
+
+    for (int i = 0; i < argc; ++i) {
+        u32 kinds = i < KATIE_NATIVE_ARGS && spec->arg_kinds[i] ? spec->arg_kinds[i] : spec->kinds;
+        if (kinds && !(kinds & (1u << argv[i]->kind))) {
+            katie_runtime_error(ctx, "%s expects a %s, got %s", spec->name,
+                                katie_val_kind_to_cstring[katie_kinds_first(kinds)],
+                                katie_val_kind_to_cstring[argv[i]->kind]);
+        }
+    }
+}
+
+/* Calls a native, unboxed when it has an entry for the fixnums it is given */
+KatieVal *katie_call_native(Katie *ctx, KatieVal *native, int argc, KatieVal **argv) {
+    Katie_NativeSpec *spec = native->as.native.spec;
+    i64 result;
+
+    if (!spec) return native->as.native.proc(ctx, argc, argv);
+
+    if (katie_spec_has_fixnum2(spec) && argc == 2 && argv[0]->kind == KatieValKind_Number &&
+        argv[1]->kind == KatieValKind_Number &&
+        katie_spec_fixnum2(spec, argv[0]->as.number, argv[1]->as.number, &result)) {
+        return spec->is_predicate ? alloc_bool(result) : alloc_number(result);
+    }
+    katie_check_native_args(ctx, spec, argc, argv);
+    return spec->proc(ctx, argc, argv);
+}
+
+void katie_define_natives(Katie *ctx, Katie_NativeSpec *specs, usize count) {
+    for (usize i = 0; i < count; ++i) {
+        katie_define_global(ctx, katie_intern_cstring(specs[i].name), alloc_native(&specs[i]));
+    }
+}
+
 // --------------------------------------------------------------------------
-//                          - Env -
+//                          - Globals -
 // --------------------------------------------------------------------------
-static KatieEnv *alloc_env(KatieEnv *outer) {
-    KatieEnv *env = xmalloc(sizeof(KatieEnv));
-    env->entries = NULL;
-    env->outer = outer;
-    return env;
+static Katie_Global *katie_global_cell(Katie *ctx, Katie_Symbol key) {
+    Katie_Global *global;
+
+    while (array_length(ctx->globals) <= key.id)
+        array_push(ctx->globals, NULL);
+
+    global = ctx->globals[key.id];
+    if (!global) {
+        global = xmalloc(sizeof(Katie_Global));
+        global->value = NULL;
+        global->version = 0;
+        global->is_shadowed = false;
+        ctx->globals[key.id] = global;
+    }
+    return global;
 }
 
-static void dealloc_env(KatieEnv *env) {
-    shfree(env->entries);
-    if (env->outer) dealloc_env(env->outer);
-    free(env);
+Katie_Global *katie_find_global(Katie *ctx, Katie_Symbol key) {
+    if (key.id >= array_length(ctx->globals)) return NULL;
+    return ctx->globals[key.id];
 }
 
-static KatieVal *env_find_1level(KatieEnv *env, String key) {
-    KatieVal *val = shget(env->entries, key);
-    return (val) ? val : NULL;
+void katie_define_global(Katie *ctx, Katie_Symbol key, KatieVal *val) {
+    Katie_Global *global = katie_global_cell(ctx, key);
+    if (val->kind == KatieValKind_NativeFunction) katie_stat_native_name(val, key);
+    if (global->value) global->version += 1; /* rebinding */
+    global->value = val;
 }
 
-static KatieVal *env_lookup(KatieEnv *env, String key) {
-    KatieVal *val = shget(env->entries, key);
-    if (val) return val;
-    if (env->outer) return env_lookup(env->outer, key);
-    return NULL;
+Katie_Snapshot *katie_snapshot_globals(Katie *ctx) {
+    Katie_Snapshot *snapshot = xmalloc(sizeof(Katie_Snapshot));
+
+    snapshot->refs = 1;
+    array_reserve(snapshot->values, array_length(ctx->globals) + 1);
+    array_for_each(ctx->globals, i) {
+        array_push(snapshot->values, ctx->globals[i] ? ctx->globals[i]->value : NULL);
+    }
+    return snapshot;
+}
+
+void katie_snapshot_acquire(Katie_Snapshot *snapshot) {
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+}
+
+void katie_snapshot_release(Katie_Snapshot *snapshot) {
+    if (__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    free_array(snapshot->values);
+    xfree(snapshot);
+}
+
+/* Makes the globals hold exactly the values of `snapshot`, only changed ones are bumped */
+void katie_restore_globals(Katie *ctx, Katie_Snapshot *snapshot) {
+    usize count = array_length(ctx->globals);
+
+    if (array_length(snapshot->values) > count) count = array_length(snapshot->values);
+    for (usize id = 1; id < count; ++id) {
+        KatieVal *val = id < array_length(snapshot->values) ? snapshot->values[id] : NULL;
+        Katie_Global *global = id < array_length(ctx->globals) ? ctx->globals[id] : NULL;
+
+        if (!global && !val) continue;
+        if (!global) global = katie_global_cell(ctx, katie_symbol_from_id((Katie_SymbolId)id));
+        if (global->value == val) continue;
+
+        global->value = val;
+        global->version += 1;
+    }
 }
 
-static void env_put(KatieEnv *env, char *key, KatieVal *val) {
-    shput(env->entries, key, val);
+/* Binds `val` as is in a local env, boxes included */
+static void katie_bind_local(Katie *ctx, KatieEnv *env, Katie_Symbol key, KatieVal *val) {
+    /* a local binding may now hide the global from sites which already cached it */
+    Katie_Global *global = katie_global_cell(ctx, key);
+    if (!global->is_shadowed) {
+        global->is_shadowed = true;
+        global->version += 1;
+    }
+    env_put(env, key, val);
+}
+
+/* Binds in `env`, or globally when `env` is NULL. Boxed locals are updated in place. */
+void katie_define(Katie *ctx, KatieEnv *env, Katie_Symbol key, KatieVal *val) {
+    KatieVal *current;
+
+    if (!env) {
+        katie_define_global(ctx, key, val);
+        return;
+    }
+
+    current = env_find_1level(env, key);
+    if (current && current->kind == KatieValKind_Box) {
+        current->as.box = val;
+        return;
+    }
+    katie_bind_local(ctx, env, key, val);
+}
+
+/*
+ * Resolves a symbol reference site. Sites which resolved to a global that no local env can
+ * shadow keep that global, a hit then costs a version compare instead of probing every env in
+ * the chain.
+ */
+static inline Katie_SiteCache *katie_site_cache(Katie *ctx, u32 site) {
+    while (array_length(ctx->sites) <= site)
+        array_push(ctx->sites, ((Katie_SiteCache){.global = NULL}));
+    return &ctx->sites[site];
+}
+
+KatieVal *katie_lookup(Katie *ctx, KatieVal *symbol) {
+    Katie_SiteCache *cache = katie_site_cache(ctx, KATIE_SYMBOL_SITE(symbol)->site);
+    Katie_Global *global = cache->global;
+    KatieVal *val;
+
+    katie_stat_add(env_lookups, 1);
+    if (global && cache->symbol == symbol->as.symbol.id && cache->version == global->version) {
+        return global->value;
+    }
+
+    if (ctx->env) {
+        val = env_lookup(ctx->env, symbol->as.symbol);
+        if (val) return val->kind == KatieValKind_Box ? val->as.box : val;
+    }
+
+    global = katie_find_global(ctx, symbol->as.symbol);
+    if (!global || !global->value) return NULL;
+
+    if (!global->is_shadowed) {
+        cache->global = global;
+        cache->symbol = symbol->as.symbol.id;
+        cache->version = global->version;
+    }
+    return global->value;
 }
 
 // --------------------------------------------------------------------------
@@ -671,21 +1746,32 @@ static void env_put(KatieEnv *env, char *key, KatieVal *val) {
 static KatieVal *reduce_val(Katie *ctx, KatieVal *val);
 
 KatieVal *eval_special_form(Katie *ctx, KatieVal *sym, KatieVal *val) {
-    KatieEnv *oldEnv;
     Array(KatieVal *) list = val->as.list;
 
-    Debug_Assert(array_length(list) >= 3);
+    if (sym->as.special == Katie_Special_Do) {
+        KatieVal *result = alloc_nil();
+        for (usize i = 1; i < array_length(list); ++i)
+            result = katie_eval(ctx, list[i]);
+        return result;
+    }
+
+    if (array_length(list) < 3)
+        katie_runtime_error(ctx, "%s: too few operands",
+                            katie_special_kind_to_cstring[sym->as.special]);
 
     switch (sym->as.special) {
     case Katie_Special_Def: {
         KatieVal *newVal;
-        Debug_Assert(list[1]->kind == KatieValKind_Symbol);
+        if (list[1]->kind != KatieValKind_Symbol)
+            katie_runtime_error(ctx, "def: cannot bind a %s",
+                                katie_val_kind_to_cstring[list[1]->kind]);
         newVal = katie_eval(ctx, list[2]);
-        env_put(ctx->env, list[1]->as.symbol, newVal);
+        katie_define(ctx, ctx->env, list[1]->as.symbol, newVal);
         return newVal;
     }
 
-    case Katie_Special_Let: Todo();
+    /* a well formed let* was rewritten by the optimizer */
+    case Katie_Special_Let: katie_runtime_error(ctx, "let*: malformed bindings"); return NULL;
     case Katie_Special_Defn: Todo();
 
     case Katie_Special_If: {
@@ -693,35 +1779,119 @@ KatieVal *eval_special_form(Katie *ctx, KatieVal *sym, KatieVal *val) {
         if (cond->kind != KatieValKind_Nil && (cond->kind == KatieValKind_Bool && cond->as._bool)) {
             return katie_eval(ctx, list[2]);
         } else {
-            if (array_length(list) < 3) return alloc_nil();
+            if (array_length(list) < 4) return alloc_nil();
             return katie_eval(ctx, list[3]);
         }
     }
 
-    case Katie_Special_Fn: { /* lambda */
-        Debug_Assert(array_length(list) == 3);
-        Debug_Assert(list[1]->kind == KatieValKind_List);
+    case Katie_Special_Fn: return katie_make_closure(ctx, val); /* lambda */
 
-        KatieEnv *env = alloc_env(ctx->env);
-        Array(KatieVal *) params_list = list[1]->as.list;
+    default: Unreachable();
+    }
+}
 
-        /* Initialize function arguments as nil in lambda env */
-        array_for_each(params_list, i) {
-            Debug_Assert(params_list[i]->as.symbol);
-            env_put(env, params_list[i]->as.symbol, alloc_nil());
-        }
-        return alloc_function(env, NULL, list[1], list[2]);
+KatieVal *katie_make_closure(Katie *ctx, KatieVal *fn_form) {
+    Array(KatieVal *) list = fn_form->as.list;
+    Katie_FnInfo *info;
+    KatieVal *fn;
+
+    if (array_length(list) != 3 || list[1]->kind != KatieValKind_List)
+        katie_runtime_error(ctx, "fn: expected a parameter list and one body");
+    array_for_each(list[1]->as.list, i) {
+        if (list[1]->as.list[i]->kind != KatieValKind_Symbol)
+            katie_runtime_error(ctx, "fn: parameter %zu is a %s", i,
+                                katie_val_kind_to_cstring[list[1]->as.list[i]->kind]);
     }
 
-    default: Unreachable();
+    info = KATIE_FN_SITE(list[0])->info;
+    Debug_Assert_Message(info, "fn form was not resolved");
+
+    fn = alloc_function(info, NULL, list[1], list[2]);
+
+    /* Flat closure: copy the captured bindings out of the current frame, boxes included */
+    array_for_each(info->captures, i) {
+        KatieVal *captured = ctx->env ? env_find_1level(ctx->env, info->captures[i]) : NULL;
+        Assert_Message(captured, "captured binding missing from the defining frame");
+        fn->as.function.captured[i] = captured;
+    }
+    return fn;
+}
+
+/* Evaluates under a profiler and tracer frame, kept out of line so the common path stays tight.
+ * A fn body runs its `code`, a top level form has none. */
+static __attribute__((noinline)) KatieVal *katie_eval_observed(Katie *ctx, u32 frame,
+                                                               KatieVal *val, Katie_Code *code,
+                                                               bool is_form) {
+    u32 frameSave = katie_alloc_frame_push(frame);
+    KatieVal *result;
+
+    if (katie_profiler.is_enabled) katie_profile_push(frame);
+    if (katie_tracer.is_enabled) katie_trace_push(frame, is_form);
+    result = code ? katie_run_code(ctx, code) : katie_eval(ctx, val);
+    if (katie_tracer.is_enabled) katie_trace_pop();
+    if (katie_profiler.is_enabled) katie_profile_pop();
+    katie_alloc_frame_pop(frameSave);
+    return result;
+}
+
+/* Every call gets a fresh frame holding the arguments, the captured values and a box for each
+ * boxed local. Closures never reference the frame itself, so it dies with the call. */
+static KatieVal *katie_apply_function(Katie *ctx, KatieVal *fnVal, int argc, KatieVal **argv) {
+    Katie_Function *fn = &fnVal->as.function;
+    Katie_FnInfo *info = fn->info;
+    Array(KatieVal *) params_list = fn->params->as.list;
+    Katie_Code *code = katie_fn_code(info, fn->params, fn->body);
+    KatieEnv *frame, *envSave;
+    KatieVal *result;
+
+    if (array_length(params_list) != (usize)argc) {
+        katie_runtime_error(ctx, "expected %zu arguments, got %d", array_length(params_list),
+                            argc);
+    }
+
+    frame = alloc_env(NULL);
+    array_for_each(params_list, i) {
+        Debug_Assert(params_list[i]->kind == KatieValKind_Symbol);
+        katie_bind_local(ctx, frame, params_list[i]->as.symbol, argv[i]);
+    }
+    array_for_each(info->captures, i) {
+        katie_bind_local(ctx, frame, info->captures[i], fn->captured[i]);
+    }
+    array_for_each(info->boxed, i) {
+        katie_bind_local(ctx, frame, info->boxed[i],
+                         alloc_box(env_find_1level(frame, info->boxed[i])));
+    }
+
+    envSave = ctx->env;
+    ctx->env = frame;
+    if (katie_is_observed()) {
+        result = katie_eval_observed(ctx, katie_profile_fn_frame(info), fn->body, code, false);
+    } else {
+        result = katie_run_code(ctx, code);
+    }
+    ctx->env = envSave;
+
+    dealloc_env(frame);
+    return result;
+}
+
+KatieVal *katie_apply(Katie *ctx, KatieVal *fn, int argc, KatieVal **argv) {
+    switch (fn->kind) {
+    case KatieValKind_NativeFunction:
+        katie_stat_native_call(fn);
+        return katie_call_native(ctx, fn, argc, argv);
+    case KatieValKind_Function: return katie_apply_function(ctx, fn, argc, argv);
+    default:
+        katie_runtime_error(ctx, "%s is not callable", katie_val_kind_to_cstring[fn->kind]);
+        return NULL;
     }
 }
 
 KatieVal *katie_eval(Katie *ctx, KatieVal *val) {
-    KatieVal *first, *reducedList, *reducedListFirst;
+    KatieVal *first, *reducedList, *reducedListFirst, *result;
 
     if (val->kind != KatieValKind_List) return reduce_val(ctx, val);
-    if (array_is_empty(val->as.list)) return NULL;
+    if (array_is_empty(val->as.list)) katie_runtime_error(ctx, "cannot call an empty list");
 
     /* handle special form */
     first = val->as.list[0];
@@ -732,69 +1902,29 @@ KatieVal *katie_eval(Katie *ctx, KatieVal *val) {
     reducedList = reduce_val(ctx, val);
     reducedListFirst = reducedList->as.list[0];
 
-    switch (reducedListFirst->kind) {
-    case KatieValKind_NativeFunction: {
-        if (first->kind == KatieValKind_Symbol) {
-            if (array_length(reducedList->as.list) < 2) return NULL;
-
-            return reducedListFirst->as.proc(ctx, array_length(reducedList->as.list) - 1,
-                                             &reducedList->as.list[1]);
-        }
-    }
-
-    case KatieValKind_Function: {
-        Debug_Assert(array_length(reducedList->as.list) >= 2);
-
-        KatieVal *valAfterFunctionApply;
-        Katie_Function fn;
-        Array(KatieVal *) params_list;
-
-        fn = reducedListFirst->as.function;
-        params_list = fn.params->as.list;
-
-        /* Check params count */
-        if (array_length(params_list) != array_length(reducedList->as.list) - 1) {
-            Unreachable();
-        }
-
-        /* Assign value to params in local env */
-        KatieVal *arg;
-        array_for_each(params_list, i) {
-            Debug_Assert(params_list[i]->kind == KatieValKind_Symbol);
-            arg = env_find_1level(fn.env, params_list[i]->as.symbol);
-
-            /* Refresh argument value
-             * Initially the particular argument's value is set to nil using alloc_nil()
-             * After that one every new function call we free the old value and initialize it with the new value.
-             *
-             * TODO We need an allocator here
-             */
-            *arg = *reducedList->as.list[i + 1];
-        }
-
-        KatieEnv *envSave = ctx->env;
-        ctx->env = fn.env;
-        valAfterFunctionApply = katie_eval(ctx, fn.body);
-        ctx->env = envSave;
+    result = katie_apply(ctx, reducedListFirst, array_length(reducedList->as.list) - 1,
+                         &reducedList->as.list[1]);
 
-        return valAfterFunctionApply;
-    }
-
-    default: Unreachable();
-    }
+    /* callees copy what they keep of the arguments, only the values outlive the call */
+    free_array(reducedList->as.list);
+    xfree(reducedList);
+    katie_stat_add(vals_freed, 1);
+    return result;
 }
 
 static KatieVal *reduce_val(Katie *ctx, KatieVal *val) {
     switch (val->kind) {
+    case KatieValKind_Nil: /* folded by the optimizer */
     case KatieValKind_Number:
+    case KatieValKind_BigNum:
+    case KatieValKind_Float:
+    case KatieValKind_String:
     case KatieValKind_Bool:
     case KatieValKind_Special: return val;
 
     case KatieValKind_Symbol: {
-        KatieVal *newVal = env_lookup(ctx->env, val->as.symbol);
-        if (!newVal) {
-            Unreachable();
-        }
+        KatieVal *newVal = katie_lookup(ctx, val);
+        if (!newVal) katie_runtime_error(ctx, "unbound symbol '%s'", val->as.symbol.name);
         return newVal;
     };
 
@@ -815,40 +1945,195 @@ static KatieVal *reduce_val(Katie *ctx, KatieVal *val) {
 //                          - Katie -
 // --------------------------------------------------------------------------
 void init_katie_ctx(Katie *k) {
-    k->env = alloc_env(NULL);
-    env_put(k->env, "+", alloc_native_proc(native_op_add));
-    env_put(k->env, "-", alloc_native_proc(native_op_sub));
-    env_put(k->env, "*", alloc_native_proc(native_op_mul));
-    env_put(k->env, "/", alloc_native_proc(native_op_div));
-    env_put(k->env, "true", alloc_bool(true));
-    env_put(k->env, "false", alloc_bool(false));
+    k->env = NULL;
+    init_array(k->globals);
+    init_array(k->sites);
+    k->output = make_string_empty();
+    k->worker = NULL;
+    k->hold = NULL;
+    k->parallel_forms = false;
+    k->recover = NULL;
+    k->error = make_string_empty();
+    k->result = NULL;
+    katie_define_natives(k, katie_builtin_natives,
+                         array_sizeof(katie_builtin_natives, Katie_NativeSpec));
+    katie_define_global(k, katie_intern_cstring("true"), alloc_bool(true));
+    katie_define_global(k, katie_intern_cstring("false"), alloc_bool(false));
+    katie_define_parallel_natives(k);
+    katie_define_module_natives(k);
+    katie_define_seq_natives(k);
 }
 
 void deinit_katie_ctx(Katie *k) {
-    dealloc_env(k->env);
+    array_for_each(k->globals, i) {
+        if (k->globals[i]) xfree(k->globals[i]);
+    }
+    free_array(k->globals);
+    free_array(k->sites);
+    free_string(k->output);
+    free_string(k->error);
 }
 
-void katie_take_file_source(Katie *k, char *source_filepath, String source) {
+/* Evaluates every form of a resolved module, appending each printed result to the output */
+static void katie_output_result(Katie *ctx, KatieVal *valResult) {
+    u64 start_ns;
+    u32 kindSave;
+
+    katie_seq_realize_printed(ctx, valResult); /* calls fns, which is evaluating */
+    start_ns = katie_stats_begin();
+    kindSave = katie_alloc_kind_push(Katie_AllocKind_String);
+    ctx->output = katie_value_as_string(ctx->output, valResult);
+    ctx->output = append_cstring(ctx->output, "\n");
+    katie_alloc_kind_pop(kindSave);
+    katie_stats_end(print_ns, start_ns);
+}
+
+void katie_eval_module(Katie *ctx, Katie_Module *module) {
+    u64 start_ns = katie_stats_begin();
+    u64 print_ns = katie_stats.print_ns;
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_Value);
+
+    ctx->result = NULL; /* parallel forms have no last one */
+    if (ctx->parallel_forms) {
+        katie_eval_module_parallel(ctx, module);
+    } else if (katie_is_observed()) {
+        array_for_each(module->as.list, i) {
+            KatieVal *form = module->as.list[i];
+            ctx->result =
+                katie_eval_observed(ctx, katie_profile_form_frame(form), form, NULL, true);
+            katie_output_result(ctx, ctx->result);
+        }
+    } else {
+        array_for_each(module->as.list, i) {
+            ctx->result = katie_eval(ctx, module->as.list[i]);
+            katie_output_result(ctx, ctx->result);
+        }
+    }
+    /* results are printed as they come, that time belongs to print_ns */
+    katie_stats_end(eval_ns, start_ns + (katie_stats.print_ns - print_ns));
+    katie_alloc_kind_pop(kindSave);
+}
+
+void katie_flush_output(Katie *ctx, FILE *stream) {
+    u64 start_ns = katie_stats_begin();
+    fwrite(ctx->output, 1, string_length(ctx->output), stream);
+    ctx->output = string_reset(ctx->output);
+    katie_stats_end(print_ns, start_ns);
+}
+
+/* Runtime errors leave the output with the results of the forms before the failing one */
+bool katie_try_eval_module(Katie *ctx, Katie_Module *module) {
+    jmp_buf recover;
+    jmp_buf *volatile recoverSave = ctx->recover;
+    KatieEnv *volatile envSave = ctx->env;
+    volatile u32 profileDepthSave = katie_profile_depth();
+    volatile u32 traceDepthSave = katie_trace_depth();
+    volatile u32 allocKindSave = katie_alloc_kind_push(Katie_AllocKind_Value);
+    volatile u32 allocFrameSave = katie_alloc_frame_push(0);
+    volatile bool is_ok = true;
+
+    ctx->recover = &recover;
+    if (setjmp(recover) == 0) {
+        katie_eval_module(ctx, module);
+    } else {
+        is_ok = false;
+        ctx->env = envSave; /* frames of the unwound calls are leaked */
+        katie_profile_unwind(profileDepthSave);
+        katie_trace_unwind(traceDepthSave);
+    }
+    katie_alloc_kind_pop(allocKindSave);
+    katie_alloc_frame_pop(allocFrameSave);
+    ctx->recover = recoverSave;
+    return is_ok;
+}
+
+/*
+ * Reads, optimizes and resolves a module, NULL if the source has syntax errors. They are appended
+ * to `errors` unless it is NULL, then they are printed.
+ */
+Katie_Module *katie_read_source(char *source_filepath, String source, Katie_OptimizeLevel level,
+                                String *errors) {
     Katie_Reader r;
-    KatieVal *valResult;
     Katie_Module *module;
 
-    katie_init_reader(&r, source_filepath, source);
-
+    katie_init_reader(&r, source_filepath, source, errors);
     module = katie_read_module(&r);
+    katie_deinit_reader(&r);
+
+    if (!module) return NULL;
+    katie_optimize_module(module, level);
+    katie_resolve_module(module);
+    return module;
+}
+
+void katie_take_file_source(Katie *k, char *source_filepath, String source) {
+    Katie_Module *module =
+        katie_read_source(source_filepath, source, Katie_OptimizeLevel_Program, NULL);
     if (!module) {
         eprintln("error: failed to read: %s", source_filepath);
-        katie_deinit_reader(&r);
-        free_string(source);
         return;
     }
+    katie_take_module(k, module);
+}
 
-    array_for_each(module->as.list, i) {
-        valResult = katie_eval(k, module->as.list[i]);
-        katie_print_value(valResult);
-        printf("\n");
+/* Evaluates and frees a resolved module, printing its results, exits on a runtime error */
+void katie_take_module(Katie *k, Katie_Module *module) {
+    bool is_ok = katie_try_eval_module(k, module);
+    katie_flush_output(k, stdout);
+    if (!is_ok) {
+        fflush(stdout);
+        eprintln("runtime error: %s", k->error);
+        exit(EXIT_FAILURE);
     }
 
     dealloc_val(module);
-    katie_deinit_reader(&r);
+}
+
+// --------------------------------------------------------------------------
+//                          - Code Cache -
+// --------------------------------------------------------------------------
+void init_katie_code_cache(Katie_CodeCache *cache, Katie_OptimizeLevel level) {
+    pthread_mutex_init(&cache->lock, NULL);
+    init_array(cache->entries);
+    cache->level = level;
+}
+
+void deinit_katie_code_cache(Katie_CodeCache *cache) {
+    array_for_each(cache->entries, i) {
+        free_string(cache->entries[i].source_filepath);
+        dealloc_val(cache->entries[i].module);
+    }
+    free_array(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/* Reads and resolves `source_filepath` on first use, NULL if it fails to read */
+Katie_Module *katie_code_cache_load(Katie_CodeCache *cache, char *source_filepath) {
+    Katie_Module *module = NULL;
+    String source;
+
+    pthread_mutex_lock(&cache->lock);
+    array_for_each(cache->entries, i) {
+        if (are_equal_cstring(cache->entries[i].source_filepath, source_filepath)) {
+            module = cache->entries[i].module;
+            goto unlock;
+        }
+    }
+
+    source = file_as_string(source_filepath);
+    module = katie_read_source(source_filepath, source, cache->level, NULL);
+    free_string(source);
+    if (!module) eprintln("error: failed to read: %s", source_filepath);
+
+    if (module) {
+        Katie_CodeCache_Entry entry = {
+            .source_filepath = make_string(source_filepath, strlen(source_filepath)),
+            .module = module,
+        };
+        array_push(cache->entries, entry);
+    }
+
+unlock:
+    pthread_mutex_unlock(&cache->lock);
+    return module;
 }
@@ -2,9 +2,10 @@
 #define __katie_h__
 
 #include "basic.h"
+#include "bignum.h"
 
-#define STB_DS_IMPLEMENTATION
-#include "stb_ds.h"
+#include <pthread.h>
+#include <setjmp.h>
 
 // --------------------------------------------------------------------------
 //                          - Tokens -
@@ -12,6 +13,8 @@
 #define TOKEN_KINDS                                                            \
   TOKEN_KIND(Invaild, "Invaild token")                                         \
   TOKEN_KIND(Number, "Number")                                                 \
+  TOKEN_KIND(BigNumber, "BigNumber")                                           \
+  TOKEN_KIND(Float, "Float")                                                   \
   TOKEN_KIND(String, "String")                                                 \
   TOKEN_KIND(Symbol, "Symbol")                                                 \
   TOKEN_KIND(Special_Def, "Special(def!)")                                     \
@@ -57,6 +60,7 @@ struct Token {
   char *line_start;
   TokenPos pos;
   i64 number;
+  f64 _float;
 };
 
 // --------------------------------------------------------------------------
@@ -70,6 +74,7 @@ struct Katie_Lexer {
   usize row, col;
   char *line_start;
   u32 error_count;
+  String *errors; /* syntax errors are appended here, printed when NULL */
 
   /* Info of Current token being processed */
   char *token_begin;
@@ -87,7 +92,11 @@ Array(Token) katie_lexer_slurp_tokens(Katie_Lexer *l);
 typedef enum {
   KatieValKind_Bool,
   KatieValKind_List,
+  KatieValKind_Seq, /* lazy, realized a chunk at a time */
   KatieValKind_Number,
+  KatieValKind_BigNum, /* Number which overflowed i64 */
+  KatieValKind_Float,
+  KatieValKind_String,
   KatieValKind_Nil,
   KatieValKind_Special, /* Special symbol */
   KatieValKind_Symbol,  /* Normal symbol */
@@ -95,6 +104,8 @@ typedef enum {
   KatieValKind_NativeFunction,
   KatieValKind_Vector,
   KatieValKind_HashMap,
+  KatieValKind_Box, /* Captured local which def may rebind, never escapes a frame lookup */
+  KatieValKind_Future,
 } KatieValKind;
 
 typedef enum {
@@ -111,33 +122,217 @@ typedef struct Katie Katie;
 
 typedef struct KatieVal KatieVal;
 typedef i64 Katie_Number;
+typedef f64 Katie_Float;
 typedef u8 Katie_Bool;
 typedef Array(KatieVal *) Katie_List;
-typedef String Katie_Symbol;
+typedef String Katie_String;
+typedef u32 Katie_SymbolId;
 typedef KatieVal *(*Katie_Proc)(Katie *ctx, int argc, KatieVal **argv);
+typedef struct Katie_Task Katie_Task;
+typedef struct Katie_Worker Katie_Worker;
+typedef struct Katie_ModuleHold Katie_ModuleHold;
 typedef KatieVal Katie_Module;
 
+#define KATIE_SYMBOL_NONE 0
+
+/* Interned symbol, every occurrence of a name shares the same `id`, `name` and `hash` */
+typedef struct Katie_Symbol Katie_Symbol;
+struct Katie_Symbol {
+  String name;
+  Katie_SymbolId id;
+  u32 hash;
+};
+
+typedef struct Katie_Code Katie_Code;
+
+/* Filled in for every `fn` form by katie_resolve_module */
+typedef struct Katie_FnInfo Katie_FnInfo;
+struct Katie_FnInfo {
+  Array(Katie_Symbol) captures; /* free names bound by an enclosing fn, in closure order */
+  Array(Katie_Symbol) boxed;    /* locals captured by an inner fn and rebound by def */
+  Katie_SymbolId name;          /* of a `(def name (fn ...))`, KATIE_SYMBOL_NONE otherwise */
+  char *filepath;
+  TokenPos pos;                 /* of the `fn` token */
+  u32 profile_frame;            /* 0 until first called while profiling or tracing */
+  Katie_Code *code;             /* NULL until first called */
+};
+
+/* Flat closure, holds exactly the values of its captured names */
 typedef struct Katie_Function Katie_Function;
 struct Katie_Function {
-  KatieEnv *env;
+  Katie_FnInfo *info;
   KatieVal *name;
   KatieVal *params;
   KatieVal *body;
+  KatieVal **captured; /* boxes are shared with the frame which defined them */
+};
+
+#define KATIE_SEQ_CHUNK 32
+#define KATIE_SEQ_PRINT 32 /* values of a seq printed, "..." stands for the rest */
+
+typedef enum {
+  Katie_SeqKind_Range,
+  Katie_SeqKind_Map,
+  Katie_SeqKind_Filter,
+  Katie_SeqKind_Take,
+} Katie_SeqKind;
+
+/* Where a seq reads its source from, a list or a seq and the index of the next value */
+typedef struct Katie_SeqCursor Katie_SeqCursor;
+struct Katie_SeqCursor {
+  KatieVal *coll; /* NULL once past the end */
+  usize index;    /* into the list, or the chunk of the seq */
+  bool is_owned;  /* coll is a private copy of an unrealized seq, stepped in place */
+};
+
+/* How to realize the chunk of a seq, read only once the seq is made */
+typedef struct Katie_SeqThunk Katie_SeqThunk;
+struct Katie_SeqThunk {
+  Katie_SeqKind kind;
+  KatieVal *fn;           /* map and filter */
+  Katie_SeqCursor source; /* map, filter and take */
+  i64 from, to, step;     /* range, `to` is exclusive */
+  bool is_unbounded;      /* range without a `to` */
+  i64 count;              /* take, values left to take */
+};
+
+typedef struct Katie_SeqChunk Katie_SeqChunk;
+struct Katie_SeqChunk {
+  Katie_List values; /* at most KATIE_SEQ_CHUNK */
+  KatieVal *rest;    /* seq of the values after these, NULL at the end */
+};
+
+typedef struct Katie_Seq Katie_Seq;
+struct Katie_Seq {
+  Katie_SeqThunk thunk;
+  Katie_SeqChunk *chunk; /* NULL until realized, published atomically */
+};
+
+/* Unboxed entry of a native on two fixnums, false when the result is no fixnum */
+typedef bool (*Katie_Fixnum2)(i64 a, i64 b, i64 *result);
+/* The same entry of a module's native, libkatie.h knows fixnums as long long */
+typedef bool (*Katie_ModuleFixnum2)(long long a, long long b, long long *result);
+
+#define KATIE_NATIVE_ARGS 4 /* leading args a native may give a kind of their own */
+#define KATIE_VARIADIC -1
+#define KATIE_KIND(name) (1u << KatieValKind_##name)
+/* Bools pass for 0 and 1 wherever numbers are taken */
+#define KATIE_KINDS_NUMBER \
+  (KATIE_KIND(Number) | KATIE_KIND(BigNum) | KATIE_KIND(Float) | KATIE_KIND(Bool))
+#define KATIE_KINDS_CALLABLE (KATIE_KIND(Function) | KATIE_KIND(NativeFunction))
+
+/* What a native takes, checked by katie_call_native before it is called, so natives need not */
+typedef struct Katie_NativeSpec Katie_NativeSpec;
+struct Katie_NativeSpec {
+  char *name;
+  Katie_Proc proc;
+  int min_args, max_args;             /* max_args is KATIE_VARIADIC for any number */
+  u32 arg_kinds[KATIE_NATIVE_ARGS];   /* KATIE_KIND masks of the leading args, 0 for `kinds` */
+  u32 kinds;                          /* of every other arg, 0 for any kind */
+  bool is_pure;                       /* no effects, its calls on constants may be folded */
+  Katie_Fixnum2 fixnum2;              /* instead of `proc` on two fixnums, which the kinds allow */
+  Katie_ModuleFixnum2 module_fixnum2; /* the same, of a native module's def */
+  bool is_predicate;                  /* fixnum2 results are bools */
+};
+
+#define katie_spec_has_fixnum2(spec) ((spec)->fixnum2 || (spec)->module_fixnum2)
+
+/* Calls the unboxed entry of a spec which has one */
+static inline bool katie_spec_fixnum2(Katie_NativeSpec *spec, i64 a, i64 b, i64 *result) {
+  long long module_result;
+
+  if (spec->fixnum2) return spec->fixnum2(a, b, result);
+  if (!spec->module_fixnum2(a, b, &module_result)) return false;
+  *result = module_result;
+  return true;
+}
+
+typedef struct Katie_NativeStat Katie_NativeStat;
+
+typedef struct Katie_NativeFn Katie_NativeFn;
+struct Katie_NativeFn {
+  Katie_Proc proc;
+  Katie_NativeSpec *spec; /* NULL for a bare proc, which checks its own args */
+  Katie_NativeStat *stat; /* NULL unless defined as a global while --stats is on */
 };
 
 struct KatieVal {
   KatieValKind kind;
   union {
     Katie_Number number;
+    BigNum bignum;
+    Katie_Float _float; /* stored inline, floats need no box of their own */
     Katie_Bool _bool;
+    Katie_String string; /* owned, may hold NULs */
     Katie_List list;
+    Katie_Seq *seq;
     Katie_Symbol symbol;
     Katie_SpecialKind special;
-    Katie_Proc proc;
+    Katie_NativeFn native;
     Katie_Function function;
+    KatieVal *box; /* NULL until the boxed local is defined */
+    Katie_Task *future;
   } as;
 };
 
+/* Global binding, its address is stable for the lifetime of the context */
+typedef struct Katie_Global Katie_Global;
+struct Katie_Global {
+  KatieVal *value; /* NULL while unbound */
+  u32 version;     /* bumped when a cached resolution to this global may be stale */
+  bool is_shadowed; /* some local env binds the same name, never cached */
+};
+
+/* Symbols read from source are reference sites. Modules are shared read only between contexts,
+ * so the global a site resolved to is cached per context, indexed by the site id. Ids of freed
+ * sites are reused, a cache entry also holds the symbol it resolved. */
+typedef struct Katie_SymbolSite Katie_SymbolSite;
+struct Katie_SymbolSite {
+  KatieVal val;
+  u32 site;
+  char *filepath;
+  TokenPos pos;
+};
+
+typedef struct Katie_SiteCache Katie_SiteCache;
+struct Katie_SiteCache {
+  Katie_Global *global; /* NULL until the site resolves to an unshadowed global */
+  Katie_SymbolId symbol; /* what the site read when it resolved, ids are reused */
+  u32 version;
+};
+
+#define KATIE_SYMBOL_SITE(val) ((Katie_SymbolSite *)(val))
+
+/* `fn` specials read from source carry the resolved info of their form */
+typedef struct Katie_FnSite Katie_FnSite;
+struct Katie_FnSite {
+  KatieVal val;
+  Katie_FnInfo *info;
+  char *filepath;
+  TokenPos pos;
+};
+
+#define KATIE_FN_SITE(val) ((Katie_FnSite *)(val))
+
+static char const *katie_val_kind_to_cstring[] = {
+    [KatieValKind_Bool] = "bool",
+    [KatieValKind_List] = "list",
+    [KatieValKind_Seq] = "seq",
+    [KatieValKind_Number] = "number",
+    [KatieValKind_BigNum] = "number",
+    [KatieValKind_Float] = "float",
+    [KatieValKind_String] = "string",
+    [KatieValKind_Nil] = "nil",
+    [KatieValKind_Special] = "special",
+    [KatieValKind_Symbol] = "symbol",
+    [KatieValKind_Function] = "function",
+    [KatieValKind_NativeFunction] = "native-function",
+    [KatieValKind_Vector] = "vector",
+    [KatieValKind_HashMap] = "hashmap",
+    [KatieValKind_Box] = "box",
+    [KatieValKind_Future] = "future",
+};
+
 static char const *katie_special_kind_to_cstring[] = {
     [Katie_Special_Def] = "def", [Katie_Special_Let] = "let*",
     [Katie_Special_If] = "if",   [Katie_Special_Do] = "do",
@@ -153,9 +348,12 @@ struct Katie_Reader {
   char *src;
   Array(Token) tokens;
   u32 index; /* Current token index */
+  u32 error_count;
+  String *errors; /* syntax errors are appended here, printed when NULL */
 };
 
-void katie_init_reader(Katie_Reader *r, char *source_filepath, char *src);
+void katie_init_reader(Katie_Reader *r, char *source_filepath, char *src, String *errors);
+void katie_reset_reader(Katie_Reader *r, char *src);
 void katie_deinit_reader(Katie_Reader *r);
 KatieVal *katie_read_form(Katie_Reader *r);
 Katie_Module *katie_read_module(Katie_Reader *r);
@@ -163,45 +361,497 @@ Katie_Module *katie_read_module(Katie_Reader *r);
 // --------------------------------------------------------------------------
 //                          - Env -
 // --------------------------------------------------------------------------
+#define KATIE_ENV_SMALL_CAPACITY 8
+
 typedef struct KatieEnv_Entry KatieEnv_Entry;
 struct KatieEnv_Entry {
-  char *key;
+  Katie_SymbolId key; /* KATIE_SYMBOL_NONE marks an empty slot */
+  u32 hash;           /* cached hash of the key symbol */
   KatieVal *value;
 };
 
 struct KatieEnv {
-  KatieEnv_Entry *entries; /* entries hashmap */
+  KatieEnv_Entry *entries; /* `small` or an open addressing table once hashed */
+  u32 count;
+  u32 capacity;
+  bool is_hashed;
   KatieEnv *outer;
+  KatieEnv_Entry small[KATIE_ENV_SMALL_CAPACITY];
 };
 
+Katie_Symbol katie_intern(char *text, usize length);
+Katie_Symbol katie_intern_cstring(char *cstring);
+Katie_Symbol katie_symbol_from_id(Katie_SymbolId id);
+
+KatieEnv *alloc_env(KatieEnv *outer);
+void dealloc_env(KatieEnv *env);
+KatieVal *env_find_1level(KatieEnv *env, Katie_Symbol key);
+KatieVal *env_lookup(KatieEnv *env, Katie_Symbol key);
+void env_put(KatieEnv *env, Katie_Symbol key, KatieVal *val);
+bool env_remove(KatieEnv *env, Katie_Symbol key);
+
 // --------------------------------------------------------------------------
 //                          - Katie Context -
 // --------------------------------------------------------------------------
+/* What the optimizer may assume of the globals a module is evaluated against */
+typedef enum Katie_OptimizeLevel {
+  Katie_OptimizeLevel_Module,  /* shares its context with modules which may rebind any global */
+  Katie_OptimizeLevel_Program, /* the whole program, its context starts with only the builtins */
+} Katie_OptimizeLevel;
+
+/*
+ * A context owns all of its mutable state, so independent contexts may run on separate threads.
+ * The only state shared between them is the symbol table, which is locked, and the modules of a
+ * code cache, which are never written once resolved.
+ */
 struct Katie {
-  KatieEnv *env;
+  KatieEnv *env;                 /* innermost local env, NULL at top level */
+  Array(Katie_Global *) globals; /* indexed by symbol id */
+  Array(Katie_SiteCache) sites;  /* indexed by symbol site id */
+  String output;                 /* printed results of katie_eval_module */
+  Katie_Worker *worker;          /* NULL unless owned by a pool worker */
+  Katie_ModuleHold *hold;        /* kept alive by the tasks spawned from here, may be NULL */
+  bool parallel_forms;           /* evaluate independent top level forms concurrently */
+  jmp_buf *recover;              /* runtime errors longjmp here instead of exiting */
+  String error;                  /* message of the last recovered runtime error */
+  KatieVal *result;              /* of the last top level form katie_eval_module evaluated */
 };
 
 void init_katie_ctx(Katie *k);
 void deinit_katie_ctx(Katie *k);
+void katie_eval_module(Katie *ctx, Katie_Module *module);
+bool katie_try_eval_module(Katie *ctx, Katie_Module *module);
+Katie_Module *katie_read_source(char *source_filepath, String source, Katie_OptimizeLevel level,
+                                String *errors);
+void katie_flush_output(Katie *ctx, FILE *stream);
+void katie_take_module(Katie *k, Katie_Module *module);
+
+// --------------------------------------------------------------------------
+//                          - Parallel -
+// --------------------------------------------------------------------------
+void katie_define_parallel_natives(Katie *ctx);
+void katie_eval_module_parallel(Katie *ctx, Katie_Module *module);
+
+/* A module tasks may outlive the evaluation of, freed with the last hold */
+struct Katie_ModuleHold {
+  u32 refs;
+  Katie_Module *module;
+};
+
+Katie_ModuleHold *katie_hold_module(Katie_Module *module);
+void katie_module_hold_release(Katie_ModuleHold *hold);
+
+// --------------------------------------------------------------------------
+//                          - Native Modules -
+// --------------------------------------------------------------------------
+void katie_define_module_natives(Katie *ctx);
+
+// --------------------------------------------------------------------------
+//                          - Lazy Sequences -
+// --------------------------------------------------------------------------
+void katie_define_seq_natives(Katie *ctx);
+Katie_SeqChunk *katie_seq_force(Katie *ctx, KatieVal *seq);
+void katie_seq_realize_printed(Katie *ctx, KatieVal *val);
+void katie_seq_free(Katie_Seq *seq);
+
+// --------------------------------------------------------------------------
+//                          - Code Cache -
+// --------------------------------------------------------------------------
+typedef struct Katie_CodeCache_Entry Katie_CodeCache_Entry;
+struct Katie_CodeCache_Entry {
+  String source_filepath;
+  Katie_Module *module; /* resolved, read only from here on */
+};
+
+/* Modules read once and shared by every context, safe to use from many threads */
+typedef struct Katie_CodeCache Katie_CodeCache;
+struct Katie_CodeCache {
+  pthread_mutex_t lock;
+  Array(Katie_CodeCache_Entry) entries;
+  Katie_OptimizeLevel level; /* of every module it reads */
+};
+
+void init_katie_code_cache(Katie_CodeCache *cache, Katie_OptimizeLevel level);
+void deinit_katie_code_cache(Katie_CodeCache *cache);
+Katie_Module *katie_code_cache_load(Katie_CodeCache *cache, char *source_filepath);
+
+/* Values of every global of a context, shared read only and refcounted */
+typedef struct Katie_Snapshot Katie_Snapshot;
+struct Katie_Snapshot {
+  u32 refs;
+  Array(KatieVal *) values; /* indexed by symbol id, NULL while unbound */
+};
+
+Katie_Snapshot *katie_snapshot_globals(Katie *ctx);
+void katie_snapshot_acquire(Katie_Snapshot *snapshot);
+void katie_snapshot_release(Katie_Snapshot *snapshot);
+void katie_restore_globals(Katie *ctx, Katie_Snapshot *snapshot);
+
+Katie_Global *katie_find_global(Katie *ctx, Katie_Symbol key);
+void katie_define_global(Katie *ctx, Katie_Symbol key, KatieVal *val);
+void katie_define(Katie *ctx, KatieEnv *env, Katie_Symbol key, KatieVal *val);
+KatieVal *katie_lookup(Katie *ctx, KatieVal *symbol);
 
 KatieVal *alloc_val(KatieValKind kind);
 KatieVal *alloc_nil();
 KatieVal *alloc_number(i64 number);
+KatieVal *alloc_bignum(BigNum bignum);
+KatieVal *alloc_float(f64 _float);
 KatieVal *alloc_bool(bool _bool);
+KatieVal *alloc_string(String string);
 KatieVal *alloc_list(Array(KatieVal *) list);
+KatieVal *alloc_seq(Katie_SeqThunk thunk);
 KatieVal *alloc_symbol(char *text, usize length);
+KatieVal *alloc_special(Katie_SpecialKind special_kind);
 KatieVal *alloc_native_proc(Katie_Proc proc);
-KatieVal *alloc_function(KatieEnv *env, KatieVal *name, KatieVal *params,
+KatieVal *alloc_native(Katie_NativeSpec *spec);
+void katie_define_natives(Katie *ctx, Katie_NativeSpec *specs, usize count);
+KatieVal *katie_call_native(Katie *ctx, KatieVal *native, int argc, KatieVal **argv);
+KatieVal *alloc_function(Katie_FnInfo *info, KatieVal *name, KatieVal *params,
                          KatieVal *body);
+KatieVal *alloc_box(KatieVal *val);
 void dealloc_val(KatieVal *val);
 
+void katie_optimize_module(Katie_Module *module, Katie_OptimizeLevel level);
+void katie_resolve_module(Katie_Module *module);
+
+/* What a top level form reads and defines, from katie_module_deps */
+typedef struct Katie_FormDeps Katie_FormDeps;
+struct Katie_FormDeps {
+  Katie_SymbolId defines;       /* KATIE_SYMBOL_NONE unless a `def` form */
+  Array(Katie_SymbolId) reads;  /* globals it may read, through calls included */
+  bool is_independent;          /* defines nothing but `defines` */
+  bool is_fn_literal;           /* only creates a closure, reads nothing */
+};
+
+Array(Katie_FormDeps) katie_module_deps(Katie_Module *module);
+void katie_free_module_deps(Array(Katie_FormDeps) deps);
+
 KatieVal *katie_eval(Katie *ctx, KatieVal *val);
+KatieVal *katie_apply(Katie *ctx, KatieVal *fn, int argc, KatieVal **argv);
+KatieVal *katie_make_closure(Katie *ctx, KatieVal *fn_form);
 String katie_value_as_string(String strResult, KatieVal *type);
 
+// --------------------------------------------------------------------------
+//                          - Bytecode -
+// --------------------------------------------------------------------------
+/*
+ * Fn bodies run as bytecode. The machine dispatches with labels as values where the compiler has
+ * them, `DISPATCH=switch ./build.sh` builds the portable switch instead.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SwitchDispatch)
+#define KATIE_THREADED_DISPATCH
+#endif
+
+Katie_Code *katie_fn_code(Katie_FnInfo *info, KatieVal *params, KatieVal *body);
+KatieVal *katie_run_code(Katie *ctx, Katie_Code *code);
+void katie_free_code(Katie_Code *code);
+
+// --------------------------------------------------------------------------
+//                          - JIT -
+// --------------------------------------------------------------------------
+/*
+ * `--jit` compiles the bytecode of a fn called `threshold` times to x86-64 machine code. Only
+ * x86-64 Linux builds have KATIE_JIT, elsewhere the flag is refused and the bytecode runs as is.
+ */
+#if defined(__x86_64__) && defined(__linux__)
+#define KATIE_JIT
+#endif
+
+#define KATIE_JIT_MAX_DEOPTS 64 /* a fn leaving its machine code more often is interpreted again */
+
+/* Where machine code which met something it can't handle left off, `sp` is NULL if it did not */
+typedef struct Katie_JitExit Katie_JitExit;
+struct Katie_JitExit {
+  u32 ip;       /* offset of the instruction to resume in the interpreter */
+  KatieVal **sp;
+};
+
+typedef KatieVal *(*Katie_JitFn)(Katie *ctx, KatieVal **stack, KatieVal **vals,
+                                 Katie_JitExit *exit);
+
+typedef struct Katie_Jit Katie_Jit;
+struct Katie_Jit {
+  bool is_enabled;
+  u32 threshold;
+  u32 compiled; /* fns compiled so far */
+  u64 deopts;
+};
+
+extern Katie_Jit katie_jit;
+
+bool katie_jit_start(u32 threshold);
+Katie_JitFn katie_jit_compile(Katie_Code *code);
+void katie_jit_free(Katie_Code *code);
+
+// --------------------------------------------------------------------------
+//                          - Ahead of Time -
+// --------------------------------------------------------------------------
+/*
+ * `--emit-c` writes a module out as a C program which includes runtime.c: the module as it was
+ * optimized, built without lexing or reading, and the bytecode of every fn translated to C and
+ * run like jit code. Forms the bytecode leaves to katie_eval are interpreted as ever.
+ */
+typedef struct Katie_AotFn Katie_AotFn;
+struct Katie_AotFn {
+  Katie_JitFn run;
+  u32 ops_length; /* of the bytecode it was translated from, on a mismatch it is interpreted */
+};
+
+typedef struct Katie_AotProgram Katie_AotProgram;
+struct Katie_AotProgram {
+  char *source_filepath;
+  Katie_Module *(*build)(void); /* the module as it was emitted, unresolved */
+  Katie_AotFn *fns;             /* in the order katie_aot_fn_forms finds their forms */
+  u32 fn_count;
+};
+
+int katie_emit_c(FILE *stream, char *source_filepath);
+int katie_aot_main(Katie_AotProgram *program);
+KatieVal *katie_aot_list(usize count, ...);
+KatieVal *katie_aot_symbol(char *name, usize row, usize col);
+KatieVal *katie_aot_fn(usize row, usize col);
+KatieVal *katie_aot_bignum(char *digits, bool is_negative);
+
+// --------------------------------------------------------------------------
+//                          - Stats -
+// --------------------------------------------------------------------------
+/*
+ * `--stats` timings are taken whenever `katie_stats.is_enabled`, the counters only exist in
+ * builds with KATIE_STATS, i.e every build but Release unless it also defines Stats.
+ */
+#if !defined(Release) || defined(Stats)
+#define KATIE_STATS
+#endif
+
+struct Katie_NativeStat {
+  Katie_Proc proc;
+  Katie_Symbol name; /* first global it was defined as */
+  u64 calls;
+};
+
+typedef struct Katie_Stats Katie_Stats;
+struct Katie_Stats {
+  bool is_enabled;
+  u64 lex_ns, read_ns, resolve_ns, eval_ns, print_ns;
+
+  u64 tokens;
+  u64 ast_nodes;
+  u64 vals_allocated, vals_freed;
+  u64 env_lookups, env_depth; /* env frames walked by lookups the site cache missed */
+  pthread_mutex_t natives_lock;
+  Array(Katie_NativeStat *) natives;
+};
+
+extern Katie_Stats katie_stats;
+
+u64 katie_stats_now_ns(void);
+void katie_stats_add_time(u64 *field, u64 start_ns);
+Katie_NativeStat *katie_stats_name_native(Katie_Proc proc, Katie_Symbol name);
+void katie_stats_report(FILE *stream);
+
+#define katie_stats_begin() (katie_stats.is_enabled ? katie_stats_now_ns() : 0)
+#define katie_stats_end(field, start_ns)                                                         \
+  do {                                                                                           \
+    if (katie_stats.is_enabled) katie_stats_add_time(&katie_stats.field, start_ns);              \
+  } while (0)
+
+#ifdef KATIE_STATS
+#define katie_stat_add(field, n) __atomic_fetch_add(&katie_stats.field, (n), __ATOMIC_RELAXED)
+/* Natives only have a stat while katie_stats.is_enabled */
+#define katie_stat_native_call(fn)                                                               \
+  do {                                                                                           \
+    Katie_NativeStat *__stat = (fn)->as.native.stat;                                             \
+    if (__stat) __atomic_fetch_add(&__stat->calls, 1, __ATOMIC_RELAXED);                         \
+  } while (0)
+#define katie_stat_native_name(fn, name)                                                         \
+  do {                                                                                           \
+    if (katie_stats.is_enabled)                                                                  \
+      (fn)->as.native.stat = katie_stats_name_native((fn)->as.native.proc, name);                \
+  } while (0)
+#else
+#define katie_stat_add(field, n) ((void)sizeof(n)) /* not evaluated */
+#define katie_stat_native_call(fn) ((void)(fn))
+#define katie_stat_native_name(fn, name) ((void)(fn))
+#endif
+
+// --------------------------------------------------------------------------
+//                          - Profiler -
+// --------------------------------------------------------------------------
+#define KATIE_PROFILE_MAX_DEPTH 256 /* deeper frames of a sample are cut off */
+
+/* What a sampled stack frame stands for, a called fn or a top level form */
+typedef struct Katie_ProfileFrame Katie_ProfileFrame;
+struct Katie_ProfileFrame {
+  Katie_SymbolId name; /* KATIE_SYMBOL_NONE for an anonymous fn or a top level form */
+  bool is_toplevel;
+  char *filepath;      /* NULL when unknown */
+  TokenPos pos;
+};
+
+typedef struct Katie_Profiler Katie_Profiler;
+struct Katie_Profiler {
+  bool is_enabled;
+  pthread_mutex_t lock;             /* guards frames, never taken by the signal handler */
+  Array(Katie_ProfileFrame) frames; /* by frame id, id 0 is unused */
+
+  /* every sample is its stack depth followed by up to KATIE_PROFILE_MAX_DEPTH frame ids */
+  u32 *samples;
+  u32 samples_capacity, samples_used;
+  u32 samples_dropped;
+};
+
+extern Katie_Profiler katie_profiler;
+
+bool katie_profile_start(int hz);
+void katie_profile_write(char *out_filepath);
+u32 katie_profile_fn_frame(Katie_FnInfo *info);
+u32 katie_profile_form_frame(KatieVal *form);
+void katie_profile_push(u32 frame);
+void katie_profile_pop(void);
+u32 katie_profile_depth(void);
+void katie_profile_unwind(u32 depth);
+String katie_profile_append_label(String out, u32 frame);
+
+// --------------------------------------------------------------------------
+//                          - Tracer -
+// --------------------------------------------------------------------------
+#define KATIE_TRACE_MAX_DEPTH 1024      /* upper bound of --trace-depth */
+#define KATIE_TRACE_CAPACITY (1u << 18) /* events kept per thread, older ones are overwritten */
+
+typedef enum Katie_TracePhase {
+  Katie_TracePhase_Begin,
+  Katie_TracePhase_End,
+} Katie_TracePhase;
+
+typedef struct Katie_TraceEvent Katie_TraceEvent;
+struct Katie_TraceEvent {
+  u64 ts_ns;
+  u32 frame; /* profiler frame id */
+  u32 phase;
+};
+
+/* Written by its thread only, read back once tracing is over */
+typedef struct Katie_TraceBuffer Katie_TraceBuffer;
+struct Katie_TraceBuffer {
+  Katie_TraceEvent *events;
+  u64 head; /* events ever written, the ring holds the last KATIE_TRACE_CAPACITY */
+  u32 tid;
+  Katie_TraceBuffer *next;
+};
+
+typedef struct Katie_Tracer Katie_Tracer;
+struct Katie_Tracer {
+  bool is_enabled;
+  u32 every;     /* record one call in `every`, top level forms are always recorded */
+  u32 max_depth; /* calls nested deeper are not recorded */
+  u64 start_ns;
+  Katie_TraceBuffer *buffers; /* every thread that recorded, pushed without locking */
+  u32 threads;
+};
+
+extern Katie_Tracer katie_tracer;
+
+void katie_trace_start(u32 every, u32 max_depth);
+void katie_trace_write(char *out_filepath);
+void katie_trace_push(u32 frame, bool is_form);
+void katie_trace_pop(void);
+u32 katie_trace_depth(void);
+void katie_trace_unwind(u32 depth);
+
+// --------------------------------------------------------------------------
+//                          - Allocation Tracker -
+// --------------------------------------------------------------------------
+/*
+ * `--allocs` tags every live allocation with what it holds and the profiler frame, fn or top level
+ * form, that was evaluating when it was made. It needs the xmalloc hooks of basic.h, so like the
+ * stats counters it only exists in builds with KATIE_ALLOCS, every build but Release unless it also
+ * defines Allocs.
+ */
+#if !defined(Release) || defined(Allocs)
+#define KATIE_ALLOCS
+#endif
+
+typedef enum Katie_AllocKind {
+  Katie_AllocKind_Other,
+  Katie_AllocKind_Tokens,
+  Katie_AllocKind_AstNode,
+  Katie_AllocKind_Value,
+  Katie_AllocKind_Env,
+  Katie_AllocKind_String,
+  Katie_AllocKind_Count,
+} Katie_AllocKind;
+
+/* Totals of one kind allocated under one frame */
+typedef struct Katie_AllocTag Katie_AllocTag;
+struct Katie_AllocTag {
+  Katie_AllocKind kind;
+  u32 frame;
+  u64 allocs, bytes;
+  u64 live, live_bytes, peak_bytes;
+};
+
+/* A live allocation, keyed by its address */
+typedef struct Katie_AllocEntry Katie_AllocEntry;
+struct Katie_AllocEntry {
+  void *ptr; /* NULL for an empty slot */
+  usize size;
+  u32 tag;
+};
+
+typedef struct Katie_Allocs Katie_Allocs;
+struct Katie_Allocs {
+  bool is_enabled;
+  pthread_mutex_t lock;
+
+  /* all of these are malloc'ed, the tracker can't allocate through xmalloc */
+  Katie_AllocTag *tags; /* tag 0 is unused */
+  u32 tags_count, tags_capacity;
+  u32 *tag_index;       /* by frame * Katie_AllocKind_Count + kind, 0 until first used */
+  u32 tag_index_capacity;
+  Katie_AllocEntry *entries; /* open addressing by address, power of two capacity */
+  u32 entries_count, entries_capacity;
+
+  u64 live_bytes, peak_bytes;
+};
+
+extern Katie_Allocs katie_allocs;
+
+bool katie_allocs_start(void);
+void katie_allocs_report(FILE *stream);
+
+#ifdef KATIE_ALLOCS
+u32 katie_alloc_kind_push(Katie_AllocKind kind);
+void katie_alloc_kind_pop(u32 saved);
+u32 katie_alloc_frame_push(u32 frame);
+void katie_alloc_frame_pop(u32 saved);
+#else
+/* functions rather than macros, so a push whose result is dropped does not warn */
+static inline u32 katie_alloc_kind_push(Katie_AllocKind kind) {
+  (void)kind;
+  return 0;
+}
+static inline void katie_alloc_kind_pop(u32 saved) {
+  (void)saved;
+}
+static inline u32 katie_alloc_frame_push(u32 frame) {
+  (void)frame;
+  return 0;
+}
+static inline void katie_alloc_frame_pop(u32 saved) {
+  (void)saved;
+}
+#endif
+
+/* Any of the tools which need to know the Katie frame being evaluated */
+#define katie_is_observed()                                                                    \
+  (katie_profiler.is_enabled || katie_tracer.is_enabled || katie_allocs.is_enabled)
+
 // --------------------------------------------------------------------------
 //                          - Error Reporting -
 // --------------------------------------------------------------------------
-void katie_syntax_error(char *filepath, Token *token, char *prefix, char *msg,
+void katie_syntax_error(String *errors, char *filepath, Token *token, char *prefix, char *msg,
                         ...);
+void katie_runtime_error(Katie *ctx, char *msg, ...);
 
 #endif
@@ -0,0 +1,88 @@
+#include "runtime.c"
+#include "libkatie.h"
+
+// --------------------------------------------------------------------------
+//                          - libkatie -
+// --------------------------------------------------------------------------
+/*
+ * The handle of a context is its Katie, the first member of what the library allocates. Modules
+ * stay alive with the context, the fns an eval defines keep pointing into the forms it read.
+ * Evals share a context's globals, so modules are optimized as the server's requests are.
+ */
+typedef struct Lib_Context Lib_Context;
+struct Lib_Context {
+    Katie ctx;
+    Array(Katie_Module *) modules;
+    Array(String) filepaths; /* sites point into them */
+};
+
+static KatieVal *lib_eval(Katie *k, char *filepath, String source) {
+    Lib_Context *lib = (Lib_Context *)k;
+    Katie_Module *module;
+
+    k->output = string_reset(k->output);
+    k->error = string_reset(k->error);
+    module = katie_read_source(filepath, source, Katie_OptimizeLevel_Module, &k->error);
+    if (!module) return NULL; /* k->error holds the syntax errors */
+    array_push(lib->modules, module);
+
+    if (!katie_try_eval_module(k, module)) return NULL;
+    return k->result ? k->result : alloc_nil();
+}
+
+Katie *katie_open(void) {
+    Lib_Context *lib = xmalloc(sizeof(Lib_Context));
+
+    init_katie_ctx(&lib->ctx);
+    init_array(lib->modules);
+    init_array(lib->filepaths);
+    return &lib->ctx;
+}
+
+void katie_close(Katie *k) {
+    Lib_Context *lib = (Lib_Context *)k;
+
+    deinit_katie_ctx(k);
+    array_for_each(lib->modules, i) { dealloc_val(lib->modules[i]); }
+    array_for_each(lib->filepaths, i) { free_string(lib->filepaths[i]); }
+    free_array(lib->modules);
+    free_array(lib->filepaths);
+    xfree(lib);
+}
+
+KatieVal *katie_eval_string(Katie *k, const char *source) {
+    String text = make_string((char *)source, strlen(source));
+    KatieVal *result = lib_eval(k, "<eval>", text);
+
+    free_string(text);
+    return result;
+}
+
+KatieVal *katie_eval_file(Katie *k, const char *filepath) {
+    Lib_Context *lib = (Lib_Context *)k;
+    String source = file_as_string((char *)filepath);
+    String path;
+    KatieVal *result;
+
+    if (!source) {
+        k->output = string_reset(k->output);
+        k->error = string_reset(k->error);
+        k->error = append_cstring(k->error, "failed to open: ");
+        k->error = append_cstring(k->error, (char *)filepath);
+        return NULL;
+    }
+
+    path = make_string((char *)filepath, strlen(filepath));
+    array_push(lib->filepaths, path);
+    result = lib_eval(k, path, source);
+    free_string(source);
+    return result;
+}
+
+const char *katie_output(Katie *k) {
+    return k->output;
+}
+
+const char *katie_error(Katie *k) {
+    return k->error;
+}
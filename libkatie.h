@@ -0,0 +1,123 @@
+#ifndef __libkatie_h__
+#define __libkatie_h__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// --------------------------------------------------------------------------
+//                          - libkatie -
+// --------------------------------------------------------------------------
+/*
+ * The API of libkatie.a and libkatie.so, `./build.sh lib` builds both. Nothing else the library
+ * defines is exported, and nothing here changes shape between releases: contexts and values are
+ * opaque, kinds are their own enum rather than the interpreter's. Native modules are written
+ * against it too, katie exports everything but the context functions for them.
+ *
+ * A context evaluates on one thread at a time, separate contexts may run on separate threads.
+ * Values are owned by the interpreter and live as long as the process, like every Katie value.
+ * Errors never exit nor print: the eval returns NULL and katie_error says why.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KATIE_API __attribute__((visibility("default")))
+#else
+#define KATIE_API
+#endif
+
+#ifndef __katie_h__ /* the interpreter's own header has these */
+typedef struct Katie Katie;
+typedef struct KatieVal KatieVal;
+#endif
+
+typedef enum Katie_ValueKind {
+    Katie_ValueKind_Nil,
+    Katie_ValueKind_Bool,
+    Katie_ValueKind_Int,    /* fits a long long */
+    Katie_ValueKind_BigInt, /* does not, katie_value_to_string has its digits */
+    Katie_ValueKind_Float,
+    Katie_ValueKind_String,
+    Katie_ValueKind_List,
+    Katie_ValueKind_Symbol,
+    Katie_ValueKind_Function, /* a fn or a native */
+    Katie_ValueKind_Other,
+} Katie_ValueKind;
+
+/* `argv` holds `argc` values, a native fails by returning katie_raise */
+typedef KatieVal *(*Katie_Native)(Katie *k, int argc, KatieVal **argv);
+
+KATIE_API Katie *katie_open(void);
+KATIE_API void katie_close(Katie *k);
+
+/* Value of the last form, NULL on a syntax or runtime error */
+KATIE_API KatieVal *katie_eval_string(Katie *k, const char *source);
+KATIE_API KatieVal *katie_eval_file(Katie *k, const char *filepath);
+
+/* Results of the forms of the last eval, printed one per line as the katie cli prints them */
+KATIE_API const char *katie_output(Katie *k);
+/* Why the last eval returned NULL, a line per syntax error or the runtime error */
+KATIE_API const char *katie_error(Katie *k);
+
+KATIE_API void katie_define_native(Katie *k, const char *name, Katie_Native native);
+
+#define KATIE_ANY_ARGS -1
+#define KATIE_DEF_ARGS 4 /* leading args a def may give kinds of their own */
+#define KATIE_VALUE_KIND(name) (1u << Katie_ValueKind_##name)
+
+/* Unboxed entry of a native on two ints, false when it has no int result for them */
+typedef bool (*Katie_NativeFixnum2)(long long a, long long b, long long *result);
+
+/* A native whose arity and argument kinds katie checks before calling it */
+typedef struct Katie_NativeDef {
+    const char *name;
+    Katie_Native native;
+    int min_args;
+    int max_args;                       /* KATIE_ANY_ARGS for no limit */
+    unsigned arg_kinds[KATIE_DEF_ARGS]; /* KATIE_VALUE_KIND masks of leading args, 0 for kinds */
+    unsigned kinds;                     /* of every other arg, 0 for any kind */
+    bool is_pure;                       /* no effects, the same result for the same args */
+    Katie_NativeFixnum2 fixnum2;        /* instead of `native` on two ints the def accepts */
+    bool is_predicate;                  /* fixnum2 results are bools */
+} Katie_NativeDef;
+
+KATIE_API void katie_define_native_defs(Katie *k, const Katie_NativeDef *defs, size_t count);
+/* Unwinds the eval calling the native, which then fails with `message` */
+KATIE_API KatieVal *katie_raise(Katie *k, const char *message);
+
+KATIE_API KatieVal *katie_make_nil(void);
+KATIE_API KatieVal *katie_make_bool(bool value);
+KATIE_API KatieVal *katie_make_int(long long value);
+KATIE_API KatieVal *katie_make_float(double value);
+KATIE_API KatieVal *katie_make_string(const char *text, size_t length);
+KATIE_API KatieVal *katie_make_list(KatieVal **items, size_t count);
+
+KATIE_API Katie_ValueKind katie_value_kind(KatieVal *val);
+/* False, leaving `out` as is, when the value is of another kind */
+KATIE_API bool katie_value_bool(KatieVal *val, bool *out);
+KATIE_API bool katie_value_int(KatieVal *val, long long *out);
+KATIE_API bool katie_value_float(KatieVal *val, double *out);
+/* Text of a string, valid as long as the value is, and NUL terminated */
+KATIE_API bool katie_value_string(KatieVal *val, const char **out, size_t *length);
+KATIE_API size_t katie_list_length(KatieVal *val); /* 0 unless a list */
+KATIE_API KatieVal *katie_list_at(KatieVal *val, size_t index); /* NULL past the length */
+
+/* Printed form of the value, free it with katie_free_string */
+KATIE_API char *katie_value_to_string(KatieVal *val);
+KATIE_API void katie_free_string(char *text);
+
+/*
+ * A native module is a shared object `(load-native "libfoo.so")` opens, it defines its natives
+ * on the context evaluating that form from:
+ *
+ *     KATIE_API void katie_native_init(Katie *k);
+ */
+#define KATIE_NATIVE_INIT_NAME "katie_native_init"
+typedef void (*Katie_NativeInit)(Katie *k);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,6 +1,24 @@
+#define _GNU_SOURCE
+
 #include "basic.c"
+#include "bignum.c"
+#include "env.c"
+#include "resolve.c"
+#include "optimize.c"
+#include "stats.c"
+#include "profile.c"
+#include "trace.c"
+#include "allocs.c"
 #include "cli.c"
 #include "katie.c"
+#include "vm.c"
+#include "jit.c"
+#include "pool.c"
+#include "native.c"
+#include "seq.c"
+#include "aot.c"
+#include "server.c"
+#include "batch.c"
 
 void repl() {
     bool is_quit = false;
@@ -27,13 +45,13 @@ void cli_dump_tokens(char *source_filepath) {
     free_array(tokens);
 }
 
-void cli_stringify_source(char *source_filepath) {
+void cli_stringify_source(char *source_filepath, bool is_optimized) {
     Katie_Reader r;
     Katie_Module *module;
     String strResult;
 
     String source = file_as_string(source_filepath);
-    katie_init_reader(&r, source_filepath, source);
+    katie_init_reader(&r, source_filepath, source, NULL);
 
     module = katie_read_module(&r);
     if (!module) {
@@ -43,6 +61,7 @@ void cli_stringify_source(char *source_filepath) {
         return;
     }
 
+    if (is_optimized) katie_optimize_module(module, Katie_OptimizeLevel_Program);
     strResult = make_string_empty();
     strResult = katie_value_as_string(strResult, module);
     printf("%s", strResult);
@@ -54,21 +73,144 @@ void cli_stringify_source(char *source_filepath) {
 }
 #endif
 
+/* Evaluates one shared module in its own isolated context */
+typedef struct Cli_ContextJob Cli_ContextJob;
+struct Cli_ContextJob {
+    pthread_t thread;
+    Katie_Module *module;
+    bool is_parallel;
+    bool is_ok; /* false once a runtime error stopped the context */
+    Katie ctx;
+};
+
+static void *cli_context_job_run(void *arg) {
+    Cli_ContextJob *job = arg;
+    init_katie_ctx(&job->ctx);
+    job->ctx.parallel_forms = job->is_parallel;
+    job->is_ok = katie_try_eval_module(&job->ctx, job->module);
+    return NULL;
+}
+
+/*
+ * Runs the module in `count` contexts on as many threads, printing their output in order. A
+ * runtime error stops only the context raising it, the others run to their end.
+ */
+int cli_run_contexts(char *source_filepath, int count, bool is_parallel) {
+    Katie_CodeCache cache;
+    Katie_Module *module;
+    Array(Cli_ContextJob) jobs;
+    int status = 0;
+
+    init_katie_code_cache(&cache, Katie_OptimizeLevel_Program);
+    module = katie_code_cache_load(&cache, source_filepath);
+    if (!module) {
+        deinit_katie_code_cache(&cache);
+        return EXIT_FAILURE;
+    }
+
+    array_reserve(jobs, (usize)count);
+    for (int i = 0; i < count; ++i) {
+        Cli_ContextJob job = {.module = module, .is_parallel = is_parallel};
+        array_push(jobs, job);
+    }
+    array_for_each(jobs, i) {
+        if (pthread_create(&jobs[i].thread, NULL, cli_context_job_run, &jobs[i]) != 0)
+            die("pthread_create");
+    }
+
+    array_for_each(jobs, i) {
+        pthread_join(jobs[i].thread, NULL);
+        katie_flush_output(&jobs[i].ctx, stdout);
+        if (!jobs[i].is_ok) {
+            fflush(stdout);
+            fprintf(stderr, "context %zu: runtime error: %s\n", i, jobs[i].ctx.error);
+            status = EXIT_FAILURE;
+        }
+        deinit_katie_ctx(&jobs[i].ctx);
+    }
+
+    free_array(jobs);
+    deinit_katie_code_cache(&cache);
+    return status;
+}
+
+static char *cli_profile_filepath;
+
+static void cli_write_profile(void) {
+    katie_profile_write(cli_profile_filepath);
+}
+
+static char *cli_trace_filepath;
+
+static void cli_write_trace(void) {
+    katie_trace_write(cli_trace_filepath);
+}
+
+static void cli_report_stats(void) {
+    fflush(stdout);
+    katie_stats_report(stderr);
+}
+
+static void cli_report_allocs(void) {
+    fflush(stdout);
+    katie_allocs_report(stderr);
+}
+
 int main(int argc, char **argv) {
     char *source_filepath;
+    int contexts = 1;
+    bool is_parallel = false;
+    char *serve_socket = NULL;
+    bool is_batch = false;
+    bool is_length_prefixed = false;
+    bool is_stats = false;
+    bool is_allocs = false;
+    char *profile_filepath = NULL;
+    int profile_hz = 997;
+    char *trace_filepath = NULL;
+    int trace_every = 16;
+    int trace_depth = 64;
+    bool is_jit = false;
+    int jit_threshold = 1000;
+    bool is_emit_c = false;
 
 #ifdef Debug
     bool is_lex_tokens = false;
     bool is_stringify = false;
+    bool is_dump_optimized = false;
 #endif
 
     Cli_Flag positionals[] = {
         Flag_CString_Positional(&source_filepath, "SOURCE_FILEPATH", "lisp filepath")};
 
     Cli_Flag optionals[] = {
+        Flag_Int(&contexts, "c", "contexts", "evaluate in N isolated contexts, one thread each"),
+        Flag_Bool(&is_parallel, "p", "parallel",
+                  "evaluate independent top level forms concurrently"),
+        Flag_CString(&serve_socket, "S", "serve",
+                     "serve eval requests on a unix socket, SOURCE_FILEPATH is the prelude"),
+        Flag_Bool(&is_batch, "b", "batch",
+                  "evaluate SOURCE_FILEPATH ('-' for stdin) as requests, one per line"),
+        Flag_Bool(&is_length_prefixed, "L", "length-prefixed",
+                  "batch requests are framed by a u32 big endian length"),
+        Flag_Bool(&is_stats, "t", "stats", "print phase timings and counters at exit"),
+        Flag_Bool(&is_allocs, "A", "allocs",
+                  "print allocations by kind and katie source site at exit"),
+        Flag_CString(&profile_filepath, "P", "profile",
+                     "sample the katie call stack, write folded stacks to the file at exit"),
+        Flag_Int(&profile_hz, "H", "profile-hz", "profiler samples per second of cpu time"),
+        Flag_CString(&trace_filepath, "T", "trace",
+                     "trace forms and fn calls, write chrome trace_event json to the file at exit"),
+        Flag_Int(&trace_every, "E", "trace-every", "record one fn call in N"),
+        Flag_Int(&trace_depth, "D", "trace-depth", "do not record calls nested deeper than N"),
+        Flag_Bool(&is_jit, "J", "jit", "compile hot fns to x86-64 machine code"),
+        Flag_Int(&jit_threshold, "j", "jit-threshold", "calls of a fn before it is compiled"),
+        Flag_Bool(&is_emit_c, "C", "emit-c", "write SOURCE_FILEPATH as a C program to stdout"),
 #ifdef Debug
         Flag_Bool(&is_lex_tokens, "l", "lex-tokens", "output lexical tokens"),
         Flag_Bool(&is_stringify, "s", "stringify", "convert source into string repr"),
+        Flag_Bool(&is_dump_optimized, "O", "dump-optimized",
+                  "convert source into string repr after constant folding"),
 #endif
     };
 
@@ -84,16 +226,60 @@ int main(int argc, char **argv) {
     if (is_lex_tokens) {
         cli_dump_tokens(source_filepath);
         return 0;
-    } else if (is_stringify) {
-        cli_stringify_source(source_filepath);
+    } else if (is_stringify || is_dump_optimized) {
+        cli_stringify_source(source_filepath, is_dump_optimized);
         return 0;
     }
 #endif
 
+    if (is_emit_c) {
+        return katie_emit_c(stdout, source_filepath);
+    }
+
+    if (profile_filepath) {
+        cli_profile_filepath = profile_filepath;
+        if (!katie_profile_start(profile_hz)) die("profile");
+        atexit(cli_write_profile);
+    }
+
+    if (trace_filepath) {
+        cli_trace_filepath = trace_filepath;
+        katie_trace_start(trace_every > 0 ? (u32)trace_every : 1,
+                          trace_depth > 0 ? (u32)trace_depth : 0);
+        atexit(cli_write_trace);
+    }
+
+    if (is_jit && !katie_jit_start(jit_threshold > 0 ? (u32)jit_threshold : 1)) {
+        eprintln("warning: the jit needs x86-64 linux, running the interpreter");
+    }
+
+    if (is_stats) {
+        katie_stats.is_enabled = true;
+        atexit(cli_report_stats);
+    }
+
+    if (is_allocs) {
+        katie_allocs_start();
+        atexit(cli_report_allocs);
+    }
+
+    if (contexts < 1) {
+        eprintln("error: expected at least one context, got %d", contexts);
+        exit(EXIT_FAILURE);
+    } else if (is_batch) {
+        return katie_batch(source_filepath, is_length_prefixed);
+    } else if (serve_socket) {
+        int workers = contexts > 1 ? contexts : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        return katie_serve(serve_socket, source_filepath, workers > 0 ? workers : 1);
+    } else if (contexts > 1) {
+        return cli_run_contexts(source_filepath, contexts, is_parallel);
+    }
+
     Katie k;
     String source = file_as_string(source_filepath);
 
     init_katie_ctx(&k);
+    k.parallel_forms = is_parallel;
     katie_take_file_source(&k, source_filepath, source);
 
     deinit_katie_ctx(&k);
@@ -0,0 +1,95 @@
+#include "../libkatie.h"
+
+#include <limits.h>
+
+// --------------------------------------------------------------------------
+//                          - Sample Native Module -
+// --------------------------------------------------------------------------
+/*
+ * Built by `./build.sh modules` into modules/libsample.so, modules/sample.kat loads it. It knows
+ * katie only through libkatie.h, a module built once loads into any katie of the same API.
+ */
+
+/* (dot xs ys), the sum of the products of two lists of ints */
+static KatieVal *sample_dot(Katie *k, int argc, KatieVal **argv) {
+    long long sum = 0, x, y;
+    size_t length = katie_list_length(argv[0]);
+
+    (void)argc;
+    if (katie_list_length(argv[1]) != length) {
+        return katie_raise(k, "dot expects lists of one length");
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        if (!katie_value_int(katie_list_at(argv[0], i), &x) ||
+            !katie_value_int(katie_list_at(argv[1], i), &y)) {
+            return katie_raise(k, "dot expects lists of ints");
+        }
+        if (__builtin_mul_overflow(x, y, &x) || __builtin_add_overflow(sum, x, &sum)) {
+            return katie_raise(k, "dot overflowed");
+        }
+    }
+    return katie_make_int(sum);
+}
+
+/* (clamp x lo hi), its def lets only ints through */
+static KatieVal *sample_clamp(Katie *k, int argc, KatieVal **argv) {
+    long long x = 0, lo = 0, hi = 0;
+
+    (void)k;
+    (void)argc;
+    katie_value_int(argv[0], &x);
+    katie_value_int(argv[1], &lo);
+    katie_value_int(argv[2], &hi);
+    return katie_make_int(x < lo ? lo : x > hi ? hi : x);
+}
+
+/* (gcd a b), katie calls sample_gcd_ints on it without boxing anything */
+static bool sample_gcd_ints(long long a, long long b, long long *result) {
+    if (a == LLONG_MIN || b == LLONG_MIN) return false; /* no int result, sample_gcd says why */
+    a = a < 0 ? -a : a;
+    b = b < 0 ? -b : b;
+    while (b) {
+        long long rest = a % b;
+        a = b;
+        b = rest;
+    }
+    *result = a;
+    return true;
+}
+
+static KatieVal *sample_gcd(Katie *k, int argc, KatieVal **argv) {
+    long long a = 0, b = 0, result;
+
+    (void)argc;
+    katie_value_int(argv[0], &a);
+    katie_value_int(argv[1], &b);
+    if (!sample_gcd_ints(a, b, &result)) return katie_raise(k, "gcd overflowed");
+    return katie_make_int(result);
+}
+
+/* (string-length s) */
+static KatieVal *sample_string_length(Katie *k, int argc, KatieVal **argv) {
+    const char *text = "";
+    size_t length = 0;
+
+    (void)k;
+    (void)argc;
+    katie_value_string(argv[0], &text, &length);
+    return katie_make_int((long long)length);
+}
+
+static const Katie_NativeDef sample_natives[] = {
+    {.name = "dot", .native = sample_dot, .min_args = 2, .max_args = 2,
+     .kinds = KATIE_VALUE_KIND(List)},
+    {.name = "clamp", .native = sample_clamp, .min_args = 3, .max_args = 3,
+     .kinds = KATIE_VALUE_KIND(Int), .is_pure = true},
+    {.name = "gcd", .native = sample_gcd, .min_args = 2, .max_args = 2,
+     .kinds = KATIE_VALUE_KIND(Int), .is_pure = true, .fixnum2 = sample_gcd_ints},
+    {.name = "string-length", .native = sample_string_length, .min_args = 1, .max_args = 1,
+     .arg_kinds = {KATIE_VALUE_KIND(String)}, .is_pure = true},
+};
+
+KATIE_API void katie_native_init(Katie *k) {
+    katie_define_native_defs(k, sample_natives, sizeof(sample_natives) / sizeof(sample_natives[0]));
+}
@@ -0,0 +1,197 @@
+#include "katie.h"
+#include "libkatie.h"
+
+#include <dlfcn.h>
+
+// --------------------------------------------------------------------------
+//                          - Native Modules -
+// --------------------------------------------------------------------------
+/*
+ * `(load-native "libfoo.so")` opens a shared object and calls its katie_native_init, which defines
+ * its natives in the context evaluating the form. Modules are written against libkatie.h, whose
+ * functions katie itself defines and exports (build.sh links with -rdynamic), as does libkatie.so
+ * for programs embedding it. A path without a '/' is searched for as dlopen searches.
+ *
+ * Modules are never closed, the natives they define may be held by any value.
+ */
+static KatieVal *native_load_native(Katie *ctx, int argc, KatieVal **argv) {
+    char *filepath = argv[0]->as.string;
+    Katie_NativeInit init;
+    void *handle;
+
+    (void)argc;
+    if (strlen(filepath) != string_length(filepath)) {
+        katie_runtime_error(ctx, "load-native: path holds a NUL");
+    }
+
+    handle = dlopen(filepath, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) katie_runtime_error(ctx, "load-native: %s", dlerror());
+
+    *(void **)&init = dlsym(handle, KATIE_NATIVE_INIT_NAME);
+    if (!init) {
+        katie_runtime_error(ctx, "load-native: %s has no " KATIE_NATIVE_INIT_NAME, filepath);
+    }
+    init(ctx);
+    return alloc_nil();
+}
+
+static Katie_NativeSpec module_natives[] = {
+    {.name = "load-native", .proc = native_load_native, .min_args = 1, .max_args = 1,
+     .arg_kinds = {KATIE_KIND(String)}},
+};
+
+void katie_define_module_natives(Katie *ctx) {
+    katie_define_natives(ctx, module_natives, array_sizeof(module_natives, Katie_NativeSpec));
+}
+
+// ------------------------------ API --------------------------------------
+
+static Katie_ValueKind native_value_kind(KatieValKind kind) {
+    switch (kind) {
+    case KatieValKind_Nil: return Katie_ValueKind_Nil;
+    case KatieValKind_Bool: return Katie_ValueKind_Bool;
+    case KatieValKind_Number: return Katie_ValueKind_Int;
+    case KatieValKind_BigNum: return Katie_ValueKind_BigInt;
+    case KatieValKind_Float: return Katie_ValueKind_Float;
+    case KatieValKind_String: return Katie_ValueKind_String;
+    case KatieValKind_List: return Katie_ValueKind_List;
+    case KatieValKind_Symbol: return Katie_ValueKind_Symbol;
+    case KatieValKind_Function:
+    case KatieValKind_NativeFunction: return Katie_ValueKind_Function;
+    default: return Katie_ValueKind_Other;
+    }
+}
+
+/* KATIE_KIND mask of the kinds a KATIE_VALUE_KIND mask names */
+static u32 native_kinds(unsigned value_kinds) {
+    u32 kinds = 0;
+
+    for (u32 kind = 0; kind < array_sizeof(katie_val_kind_to_cstring, char *); ++kind) {
+        if (value_kinds & (1u << native_value_kind((KatieValKind)kind))) kinds |= 1u << kind;
+    }
+    return kinds;
+}
+
+/* Whether a call with two ints passes the checks of `spec`, the fixnum2 fast path skips them */
+static bool native_takes_fixnums(Katie_NativeSpec *spec) {
+    if (spec->min_args > 2 || (spec->max_args != KATIE_VARIADIC && spec->max_args < 2))
+        return false;
+    for (int i = 0; i < 2; ++i) {
+        u32 kinds = spec->arg_kinds[i] ? spec->arg_kinds[i] : spec->kinds;
+        if (kinds && !(kinds & KATIE_KIND(Number))) return false;
+    }
+    return true;
+}
+
+void katie_define_native(Katie *k, const char *name, Katie_Native native) {
+    katie_define_global(k, katie_intern_cstring((char *)name), alloc_native_proc(native));
+}
+
+/* Specs live as long as the natives made of them, which is as long as the process */
+void katie_define_native_defs(Katie *k, const Katie_NativeDef *defs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        Katie_NativeSpec *spec = xmalloc(sizeof(Katie_NativeSpec));
+
+        *spec = (Katie_NativeSpec){
+            .name = make_string((char *)defs[i].name, strlen(defs[i].name)),
+            .proc = defs[i].native,
+            .min_args = defs[i].min_args,
+            .max_args = defs[i].max_args < 0 ? KATIE_VARIADIC : defs[i].max_args,
+            .kinds = native_kinds(defs[i].kinds),
+            .is_pure = defs[i].is_pure,
+            .module_fixnum2 = defs[i].fixnum2,
+            .is_predicate = defs[i].is_predicate,
+        };
+        for (int j = 0; j < KATIE_DEF_ARGS && j < KATIE_NATIVE_ARGS; ++j) {
+            spec->arg_kinds[j] = native_kinds(defs[i].arg_kinds[j]);
+        }
+        if (!native_takes_fixnums(spec)) spec->module_fixnum2 = NULL;
+        katie_define_global(k, katie_intern_cstring(spec->name), alloc_native(spec));
+    }
+}
+
+KatieVal *katie_raise(Katie *k, const char *message) {
+    katie_runtime_error(k, "%s", message);
+    return NULL;
+}
+
+KatieVal *katie_make_nil(void) {
+    return alloc_nil();
+}
+
+KatieVal *katie_make_bool(bool value) {
+    return alloc_bool(value);
+}
+
+KatieVal *katie_make_int(long long value) {
+    return alloc_number((i64)value);
+}
+
+KatieVal *katie_make_float(double value) {
+    return alloc_float(value);
+}
+
+KatieVal *katie_make_string(const char *text, size_t length) {
+    return alloc_string(make_string((char *)text, length));
+}
+
+KatieVal *katie_make_list(KatieVal **items, size_t count) {
+    Array(KatieVal *) list;
+
+    array_reserve(list, count);
+    for (size_t i = 0; i < count; ++i) {
+        array_push(list, items[i]);
+    }
+    return alloc_list(list);
+}
+
+Katie_ValueKind katie_value_kind(KatieVal *val) {
+    return native_value_kind(val->kind);
+}
+
+bool katie_value_bool(KatieVal *val, bool *out) {
+    if (val->kind != KatieValKind_Bool) return false;
+    *out = val->as._bool;
+    return true;
+}
+
+bool katie_value_int(KatieVal *val, long long *out) {
+    if (val->kind != KatieValKind_Number) return false;
+    *out = val->as.number;
+    return true;
+}
+
+bool katie_value_float(KatieVal *val, double *out) {
+    if (val->kind != KatieValKind_Float) return false;
+    *out = val->as._float;
+    return true;
+}
+
+bool katie_value_string(KatieVal *val, const char **out, size_t *length) {
+    if (val->kind != KatieValKind_String) return false;
+    *out = val->as.string;
+    *length = string_length(val->as.string);
+    return true;
+}
+
+size_t katie_list_length(KatieVal *val) {
+    return val->kind == KatieValKind_List ? array_length(val->as.list) : 0;
+}
+
+KatieVal *katie_list_at(KatieVal *val, size_t index) {
+    if (index >= katie_list_length(val)) return NULL; /* a host bug must not abort the host */
+    return val->as.list[index];
+}
+
+char *katie_value_to_string(KatieVal *val) {
+    String text = katie_value_as_string(make_string_empty(), val);
+    char *cstring = xmalloc(string_length(text) + 1);
+
+    memcpy(cstring, text, string_length(text) + 1);
+    free_string(text);
+    return cstring;
+}
+
+void katie_free_string(char *text) {
+    xfree(text);
+}
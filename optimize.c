@@ -0,0 +1,601 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Optimize -
+// --------------------------------------------------------------------------
+/*
+ * Constant folding over a module as read, before it is resolved. Constants are number, float,
+ * bool and nil literals. A `let*` binding to a constant is substituted into its body and dropped,
+ * an `if` on a constant condition is replaced by the branch it takes, constant forms are dropped
+ * from the middle of a `do`.
+ *
+ * Only for a whole program are globals known: the builtin natives, pure when their spec says so,
+ * and `true` and `false` are what init_katie_ctx defines them as unless the module defines them,
+ * and a global the module defines exactly once, by a top level `(def name constant)`, holds that
+ * constant in the forms after it. Calls of pure natives on constants are then evaluated, a call
+ * which fails is left to fail at runtime.
+ *
+ * A global fn defined the same way, whose body is small, binds no names and never calls the fn
+ * itself, is inlined at the calls after its def: the call is replaced by a copy of the body with
+ * the arguments in place of the params. An argument other than a constant or a symbol is only
+ * moved into the body when the body evaluates it exactly once and in the order of the params,
+ * which only a body of pure native calls guarantees.
+ */
+#define KATIE_OPTIMIZE_INLINE_BUDGET 24 /* ast nodes of a fn body small enough to inline */
+#define KATIE_OPTIMIZE_INLINE_DEPTH 16  /* inlines nested in the bodies of inlines */
+
+typedef struct Katie_OptimizeBinding Katie_OptimizeBinding;
+struct Katie_OptimizeBinding {
+    Katie_SymbolId name;
+    KatieVal *constant;  /* NULL when the value is only known at runtime */
+    KatieVal *inline_fn; /* the `fn` form of a global inlined at its calls */
+};
+
+typedef struct Katie_Optimizer Katie_Optimizer;
+struct Katie_Optimizer {
+    Katie_OptimizeLevel level;
+    Katie builtins;                        /* calls the pure natives, for a program only */
+    Array(Katie_OptimizeBinding) bindings; /* of local scopes, innermost last */
+    Array(Katie_OptimizeBinding) globals;  /* per symbol id, known after the global's def */
+    u32 inline_depth;
+    Array(u32) global_defs;                /* per symbol id, defs outside of fn bodies */
+    Katie_SymbolId true_id, false_id;
+};
+
+static bool optimize_is_constant(KatieVal *val) {
+    switch (val->kind) {
+    case KatieValKind_Nil:
+    case KatieValKind_Number:
+    case KatieValKind_BigNum:
+    case KatieValKind_Float:
+    case KatieValKind_String:
+    case KatieValKind_Bool: return true;
+    default: return false;
+    }
+}
+
+static KatieVal *optimize_copy_constant(KatieVal *val) {
+    switch (val->kind) {
+    case KatieValKind_Nil: return alloc_nil();
+    case KatieValKind_Number: return alloc_number(val->as.number);
+    case KatieValKind_BigNum: return alloc_bignum(bignum_copy(val->as.bignum));
+    case KatieValKind_Float: return alloc_float(val->as._float);
+    case KatieValKind_String:
+        return alloc_string(make_string(val->as.string, string_length(val->as.string)));
+    case KatieValKind_Bool: return alloc_bool(val->as._bool);
+    default: Unreachable();
+    }
+}
+
+static u32 optimize_global_defs(Katie_Optimizer *o, Katie_SymbolId id) {
+    return id < array_length(o->global_defs) ? o->global_defs[id] : 0;
+}
+
+/* Counts the defs of globals, those outside of fn bodies */
+static void optimize_count_global_defs(Katie_Optimizer *o, KatieVal *val) {
+    if (val->kind != KatieValKind_List || is_special_form(val, Katie_Special_Fn)) return;
+
+    if (is_special_form(val, Katie_Special_Def) && array_length(val->as.list) >= 2 &&
+        val->as.list[1]->kind == KatieValKind_Symbol) {
+        Katie_SymbolId id = val->as.list[1]->as.symbol.id;
+        while (array_length(o->global_defs) <= id)
+            array_push(o->global_defs, 0);
+        o->global_defs[id] += 1;
+    }
+    array_for_each(val->as.list, i) { optimize_count_global_defs(o, val->as.list[i]); }
+}
+
+/* Binds the def targets of a fn body to runtime values, nested fns bind their own */
+static void optimize_bind_local_defs(Katie_Optimizer *o, KatieVal *val) {
+    if (val->kind != KatieValKind_List || is_special_form(val, Katie_Special_Fn)) return;
+
+    if (is_special_form(val, Katie_Special_Def) && array_length(val->as.list) >= 2 &&
+        val->as.list[1]->kind == KatieValKind_Symbol) {
+        Katie_OptimizeBinding binding = {.name = val->as.list[1]->as.symbol.id};
+        array_push(o->bindings, binding);
+    }
+    array_for_each(val->as.list, i) { optimize_bind_local_defs(o, val->as.list[i]); }
+}
+
+static Katie_OptimizeBinding *optimize_lookup_local(Katie_Optimizer *o, Katie_SymbolId id) {
+    for (usize i = array_length(o->bindings); i > 0; --i) {
+        if (o->bindings[i - 1].name == id) return &o->bindings[i - 1];
+    }
+    return NULL;
+}
+
+/* Only local scopes are searched, a program may define any number of known globals */
+static Katie_OptimizeBinding *optimize_lookup(Katie_Optimizer *o, Katie_SymbolId id) {
+    Katie_OptimizeBinding *binding = optimize_lookup_local(o, id);
+
+    if (binding || id >= array_length(o->globals)) return binding;
+    binding = &o->globals[id];
+    return binding->constant || binding->inline_fn ? binding : NULL;
+}
+
+/* Whether `id` still names what init_katie_ctx defined it as */
+static bool optimize_is_builtin(Katie_Optimizer *o, Katie_SymbolId id) {
+    return o->level == Katie_OptimizeLevel_Program && !optimize_lookup(o, id) &&
+           !optimize_global_defs(o, id);
+}
+
+/* A builtin native whose spec declares it pure */
+static bool optimize_is_pure_native(Katie_Optimizer *o, KatieVal *head) {
+    Katie_Global *global;
+
+    if (head->kind != KatieValKind_Symbol || !optimize_is_builtin(o, head->as.symbol.id))
+        return false;
+    global = katie_find_global(&o->builtins, head->as.symbol);
+    return global && global->value && global->value->kind == KatieValKind_NativeFunction &&
+           global->value->as.native.spec && global->value->as.native.spec->is_pure;
+}
+
+/* Removes the `index`th form of a list and hands it over */
+static KatieVal *optimize_take(KatieVal *list, usize index) {
+    KatieVal *val = list->as.list[index];
+    memmove(&list->as.list[index], &list->as.list[index + 1],
+            (array_length(list->as.list) - index - 1) * sizeof(KatieVal *));
+    array_length(list->as.list) -= 1;
+    return val;
+}
+
+static KatieVal *optimize_form(Katie_Optimizer *o, KatieVal *val);
+
+static KatieVal *optimize_symbol(Katie_Optimizer *o, KatieVal *val) {
+    Katie_SymbolId id = val->as.symbol.id;
+    Katie_OptimizeBinding *binding = optimize_lookup(o, id);
+    KatieVal *constant = NULL;
+
+    if (binding) {
+        if (binding->constant) constant = optimize_copy_constant(binding->constant);
+    } else if ((id == o->true_id || id == o->false_id) && optimize_is_builtin(o, id)) {
+        constant = alloc_bool(id == o->true_id);
+    }
+
+    if (!constant) return val;
+    dealloc_val(val);
+    return constant;
+}
+
+/* Evaluates a pure native on constants, the call stays as is when it fails */
+static KatieVal *optimize_fold_call(Katie_Optimizer *o, KatieVal *call) {
+    Katie *ctx = &o->builtins;
+    Array(KatieVal *) list = call->as.list;
+    Katie_Global *native = katie_find_global(ctx, list[0]->as.symbol);
+    KatieVal *result;
+    jmp_buf recover;
+
+    if (!native || !native->value || native->value->kind != KatieValKind_NativeFunction)
+        return call;
+
+    ctx->recover = &recover;
+    if (setjmp(recover) != 0) {
+        ctx->recover = NULL;
+        return call;
+    }
+    result = katie_call_native(ctx, native->value, (int)array_length(list) - 1, &list[1]);
+    ctx->recover = NULL;
+
+    if (!optimize_is_constant(result)) return call;
+    for (usize i = 1; i < array_length(list); ++i) {
+        if (list[i] == result) { /* natives may hand back an argument */
+            result = optimize_take(call, i);
+            break;
+        }
+    }
+    dealloc_val(call);
+    return result;
+}
+
+static usize optimize_size(KatieVal *val) {
+    usize size = 1;
+
+    if (val->kind == KatieValKind_List) {
+        array_for_each(val->as.list, i) { size += optimize_size(val->as.list[i]); }
+    }
+    return size;
+}
+
+/* A body which binds no names of its own, so nothing in it can capture an argument */
+static bool optimize_is_inlinable_body(KatieVal *val, Katie_SymbolId self) {
+    switch (val->kind) {
+    case KatieValKind_Symbol: return val->as.symbol.id != self;
+    case KatieValKind_Special: return val->as.special == Katie_Special_If;
+    case KatieValKind_List:
+        array_for_each(val->as.list, i) {
+            if (!optimize_is_inlinable_body(val->as.list[i], self)) return false;
+        }
+        return true;
+    default: return optimize_is_constant(val);
+    }
+}
+
+/* `(def name (fn (param ...) body))`, the fn when it may be inlined */
+static KatieVal *optimize_inline_candidate(Katie_Optimizer *o, KatieVal *def) {
+    KatieVal *fn = def->as.list[2];
+    Array(KatieVal *) params;
+
+    if (fn->kind != KatieValKind_List || !is_special_form(fn, Katie_Special_Fn) ||
+        array_length(fn->as.list) != 3 || fn->as.list[1]->kind != KatieValKind_List)
+        return NULL;
+    if (optimize_global_defs(o, def->as.list[1]->as.symbol.id) != 1) return NULL;
+
+    params = fn->as.list[1]->as.list;
+    array_for_each(params, i) {
+        if (params[i]->kind != KatieValKind_Symbol) return NULL;
+        for (usize j = 0; j < i; ++j) {
+            if (params[j]->as.symbol.id == params[i]->as.symbol.id) return NULL;
+        }
+    }
+
+    if (optimize_size(fn->as.list[2]) > KATIE_OPTIMIZE_INLINE_BUDGET ||
+        !optimize_is_inlinable_body(fn->as.list[2], def->as.list[1]->as.symbol.id))
+        return NULL;
+    return fn;
+}
+
+static isize optimize_param_index(KatieVal *params, KatieVal *symbol) {
+    array_for_each(params->as.list, i) {
+        if (params->as.list[i]->as.symbol.id == symbol->as.symbol.id) return (isize)i;
+    }
+    return -1;
+}
+
+/* Whether the globals the body names are not shadowed at the call */
+static bool optimize_sees_globals(Katie_Optimizer *o, KatieVal *val, KatieVal *params) {
+    if (val->kind == KatieValKind_Symbol) {
+        return optimize_param_index(params, val) >= 0 ||
+               !optimize_lookup_local(o, val->as.symbol.id);
+    }
+    if (val->kind == KatieValKind_List) {
+        array_for_each(val->as.list, i) {
+            if (!optimize_sees_globals(o, val->as.list[i], params)) return false;
+        }
+    }
+    return true;
+}
+
+/* Whether the body is nothing but calls of pure natives, evaluating every operand once */
+static bool optimize_is_pure_body(Katie_Optimizer *o, KatieVal *val) {
+    if (val->kind != KatieValKind_List) return val->kind != KatieValKind_Special;
+    if (array_is_empty(val->as.list) || !optimize_is_pure_native(o, val->as.list[0])) return false;
+
+    for (usize i = 1; i < array_length(val->as.list); ++i) {
+        if (!optimize_is_pure_body(o, val->as.list[i])) return false;
+    }
+    return true;
+}
+
+/* Checks the arguments which are not constants are first read in parameter order, so inlining
+   keeps their evaluation order. `next` is the param after the last one read, `moved` the last
+   one whose argument is not a symbol. A symbol may be read again while no later argument ran. */
+static bool optimize_moves_in_order(KatieVal *val, KatieVal *params, KatieVal **args,
+                                    usize *next, isize *moved) {
+    if (val->kind == KatieValKind_Symbol) {
+        isize i = optimize_param_index(params, val);
+        if (i < 0 || optimize_is_constant(args[i])) return true;
+        if ((usize)i < *next) return args[i]->kind == KatieValKind_Symbol && *moved < i;
+        for (usize skipped = *next; skipped < (usize)i; ++skipped) {
+            if (!optimize_is_constant(args[skipped])) return false;
+        }
+        *next = (usize)i + 1;
+        if (args[i]->kind != KatieValKind_Symbol) *moved = i;
+        return true;
+    }
+    if (val->kind == KatieValKind_List) {
+        array_for_each(val->as.list, i) {
+            if (!optimize_moves_in_order(val->as.list[i], params, args, next, moved))
+                return false;
+        }
+    }
+    return true;
+}
+
+static usize optimize_count_uses(KatieVal *val, KatieVal *param) {
+    usize uses = 0;
+
+    if (val->kind == KatieValKind_Symbol) return val->as.symbol.id == param->as.symbol.id;
+    if (val->kind == KatieValKind_List) {
+        array_for_each(val->as.list, i) { uses += optimize_count_uses(val->as.list[i], param); }
+    }
+    return uses;
+}
+
+/* Copies a body to inline, the params replaced by copies of the arguments */
+static KatieVal *optimize_instantiate(KatieVal *val, KatieVal *params, KatieVal **args) {
+    switch (val->kind) {
+    case KatieValKind_Symbol: {
+        isize i = params ? optimize_param_index(params, val) : -1;
+        Katie_SymbolSite *site;
+
+        if (i >= 0) return optimize_instantiate(args[i], NULL, NULL);
+        site = KATIE_SYMBOL_SITE(
+            alloc_symbol(val->as.symbol.name, string_length(val->as.symbol.name)));
+        site->filepath = KATIE_SYMBOL_SITE(val)->filepath;
+        site->pos = KATIE_SYMBOL_SITE(val)->pos;
+        return &site->val;
+    }
+    case KatieValKind_Special: return alloc_special(val->as.special);
+    case KatieValKind_List: {
+        Array(KatieVal *) list;
+
+        init_array(list);
+        array_for_each(val->as.list, i) {
+            array_push(list, optimize_instantiate(val->as.list[i], params, args));
+        }
+        return alloc_list(list);
+    }
+    default: return optimize_copy_constant(val);
+    }
+}
+
+/* Replaces a call of an inlined fn by its body, the call stays as is when it can't be */
+static KatieVal *optimize_inline_call(Katie_Optimizer *o, KatieVal *call, KatieVal *fn) {
+    KatieVal *params = fn->as.list[1];
+    KatieVal *body = fn->as.list[2];
+    KatieVal **args = &call->as.list[1];
+    KatieVal *inlined;
+    usize next = 0;
+    isize moved = -1;
+
+    if (array_length(call->as.list) - 1 != array_length(params->as.list)) return call;
+    if (o->inline_depth >= KATIE_OPTIMIZE_INLINE_DEPTH || !optimize_sees_globals(o, body, params))
+        return call;
+
+    /* an argument which is not a constant is evaluated exactly as the call would, symbols too:
+       an unbound one still raises and a def in an earlier argument is still seen */
+    array_for_each(params->as.list, i) {
+        usize uses;
+
+        if (optimize_is_constant(args[i])) continue;
+        if (!optimize_is_pure_body(o, body)) return call;
+        uses = optimize_count_uses(body, params->as.list[i]);
+        if (uses == 0 || (uses > 1 && args[i]->kind != KatieValKind_Symbol)) return call;
+    }
+    if (!optimize_moves_in_order(body, params, args, &next, &moved)) return call;
+
+    inlined = optimize_instantiate(body, params, args);
+    dealloc_val(call);
+
+    o->inline_depth += 1;
+    inlined = optimize_form(o, inlined);
+    o->inline_depth -= 1;
+    return inlined;
+}
+
+/* `(+ (+ a b) c)` is `(+ a b c)`, the natives fold their operands from the left */
+static void optimize_flatten_call(Katie_Optimizer *o, KatieVal *val) {
+    Array(KatieVal *) list = val->as.list;
+    Array(KatieVal *) flat;
+    KatieVal *inner;
+    Katie_Symbol op;
+
+    if (array_length(list) < 2 || !optimize_is_pure_native(o, list[0])) return;
+    op = list[0]->as.symbol;
+    if (strcmp(op.name, "+") && strcmp(op.name, "-") && strcmp(op.name, "*")) return;
+
+    inner = list[1];
+    if (inner->kind != KatieValKind_List || array_length(inner->as.list) < 2 ||
+        inner->as.list[0]->kind != KatieValKind_Symbol || inner->as.list[0]->as.symbol.id != op.id)
+        return;
+
+    init_array(flat);
+    array_push(flat, list[0]);
+    for (usize i = 1; i < array_length(inner->as.list); ++i) {
+        array_push(flat, inner->as.list[i]);
+    }
+    for (usize i = 2; i < array_length(list); ++i) {
+        array_push(flat, list[i]);
+    }
+
+    array_length(inner->as.list) = 1; /* the operands moved */
+    dealloc_val(inner);
+    free_array(val->as.list);
+    val->as.list = flat;
+}
+
+static KatieVal *optimize_call(Katie_Optimizer *o, KatieVal *val) {
+    KatieVal *head;
+    bool is_constant = true;
+
+    array_for_each(val->as.list, i) {
+        val->as.list[i] = optimize_form(o, val->as.list[i]);
+    }
+
+    head = val->as.list[0];
+    if (head->kind == KatieValKind_Symbol) {
+        Katie_OptimizeBinding *binding = optimize_lookup(o, head->as.symbol.id);
+        if (binding && binding->inline_fn) return optimize_inline_call(o, val, binding->inline_fn);
+    }
+    optimize_flatten_call(o, val);
+
+    for (usize i = 1; i < array_length(val->as.list); ++i) {
+        if (!optimize_is_constant(val->as.list[i])) is_constant = false;
+    }
+    if (is_constant && optimize_is_pure_native(o, val->as.list[0]))
+        return optimize_fold_call(o, val);
+    return val;
+}
+
+static KatieVal *optimize_fn(Katie_Optimizer *o, KatieVal *val) {
+    Array(KatieVal *) list = val->as.list;
+    usize mark = array_length(o->bindings);
+
+    if (array_length(list) != 3 || list[1]->kind != KatieValKind_List) return val;
+
+    array_for_each(list[1]->as.list, i) {
+        if (list[1]->as.list[i]->kind == KatieValKind_Symbol) {
+            Katie_OptimizeBinding param = {.name = list[1]->as.list[i]->as.symbol.id};
+            array_push(o->bindings, param);
+        }
+    }
+    optimize_bind_local_defs(o, list[2]);
+    list[2] = optimize_form(o, list[2]);
+
+    array_length(o->bindings) = mark;
+    return val;
+}
+
+static KatieVal *optimize_if(Katie_Optimizer *o, KatieVal *val) {
+    KatieVal *cond;
+    usize taken;
+
+    if (array_length(val->as.list) < 3) return val;
+    val->as.list[1] = optimize_form(o, val->as.list[1]);
+    cond = val->as.list[1];
+
+    if (!optimize_is_constant(cond)) {
+        for (usize i = 2; i < array_length(val->as.list); ++i)
+            val->as.list[i] = optimize_form(o, val->as.list[i]);
+        return val;
+    }
+
+    /* only `true` is truthy */
+    taken = cond->kind == KatieValKind_Bool && cond->as._bool ? 2 : 3;
+    if (taken >= array_length(val->as.list)) {
+        dealloc_val(val);
+        return alloc_nil();
+    }
+
+    cond = optimize_take(val, taken);
+    dealloc_val(val);
+    return optimize_form(o, cond);
+}
+
+/* Drops the constants before the last form of an optimized `do`, which evaluate to nothing */
+static KatieVal *optimize_do_body(KatieVal *val) {
+    for (usize i = 1; i + 1 < array_length(val->as.list);) {
+        if (optimize_is_constant(val->as.list[i])) {
+            dealloc_val(optimize_take(val, i));
+        } else {
+            i += 1;
+        }
+    }
+
+    if (array_length(val->as.list) == 2) {
+        KatieVal *last = optimize_take(val, 1);
+        dealloc_val(val);
+        return last;
+    }
+    return val;
+}
+
+static KatieVal *optimize_do(Katie_Optimizer *o, KatieVal *val) {
+    for (usize i = 1; i < array_length(val->as.list); ++i)
+        val->as.list[i] = optimize_form(o, val->as.list[i]);
+    return optimize_do_body(val);
+}
+
+/* `(let* (name value ...) body ...)`, bindings see the ones before them */
+static KatieVal *optimize_let(Katie_Optimizer *o, KatieVal *val) {
+    Array(KatieVal *) list = val->as.list;
+    Array(KatieVal *) pairs;
+    Array(KatieVal *) kept;
+    Array(KatieVal *) dropped;
+    usize mark = array_length(o->bindings);
+
+    if (array_length(list) < 3 || list[1]->kind != KatieValKind_List ||
+        array_length(list[1]->as.list) % 2 != 0)
+        return val;
+    pairs = list[1]->as.list;
+    array_for_each(pairs, i) {
+        if (i % 2 == 0 && pairs[i]->kind != KatieValKind_Symbol) return val;
+    }
+
+    init_array(kept);
+    init_array(dropped);
+    for (usize i = 0; i < array_length(pairs); i += 2) {
+        Katie_OptimizeBinding binding = {.name = pairs[i]->as.symbol.id};
+        KatieVal *value = optimize_form(o, pairs[i + 1]);
+
+        if (optimize_is_constant(value)) {
+            binding.constant = value;
+            array_push(dropped, pairs[i]);
+            array_push(dropped, value);
+        } else {
+            array_push(kept, pairs[i]);
+            array_push(kept, value);
+        }
+        array_push(o->bindings, binding);
+    }
+    free_array(list[1]->as.list);
+    list[1]->as.list = kept;
+
+    for (usize i = 2; i < array_length(list); ++i)
+        list[i] = optimize_form(o, list[i]);
+
+    array_length(o->bindings) = mark;
+    array_for_each(dropped, i) { dealloc_val(dropped[i]); }
+    free_array(dropped);
+    if (!array_is_empty(kept)) return val;
+
+    /* every binding was substituted, only the body is left */
+    dealloc_val(optimize_take(val, 1));
+    dealloc_val(val->as.list[0]);
+    val->as.list[0] = alloc_special(Katie_Special_Do);
+    return optimize_do_body(val);
+}
+
+/* Returns the optimized form, `val` itself or what replaces it, `val` is then deallocated */
+static KatieVal *optimize_form(Katie_Optimizer *o, KatieVal *val) {
+    KatieVal *first;
+
+    if (val->kind == KatieValKind_Symbol) return optimize_symbol(o, val);
+    if (val->kind != KatieValKind_List || array_is_empty(val->as.list)) return val;
+
+    first = val->as.list[0];
+    if (first->kind != KatieValKind_Special) return optimize_call(o, val);
+
+    switch (first->as.special) {
+    case Katie_Special_Def:
+        if (array_length(val->as.list) == 3) val->as.list[2] = optimize_form(o, val->as.list[2]);
+        return val;
+    case Katie_Special_Fn: return optimize_fn(o, val);
+    case Katie_Special_If: return optimize_if(o, val);
+    case Katie_Special_Do: return optimize_do(o, val);
+    case Katie_Special_Let: return optimize_let(o, val);
+    default: return val;
+    }
+}
+
+void katie_optimize_module(Katie_Module *module, Katie_OptimizeLevel level) {
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_AstNode);
+    Katie_Optimizer o = {.level = level};
+
+    init_array(o.bindings);
+    init_array(o.globals);
+    init_array(o.global_defs);
+    if (level == Katie_OptimizeLevel_Program) {
+        init_katie_ctx(&o.builtins);
+        o.true_id = katie_intern_cstring("true").id;
+        o.false_id = katie_intern_cstring("false").id;
+        array_for_each(module->as.list, i) { optimize_count_global_defs(&o, module->as.list[i]); }
+    }
+
+    array_for_each(module->as.list, i) {
+        KatieVal *form = optimize_form(&o, module->as.list[i]);
+        module->as.list[i] = form;
+
+        /* forms after a global's only def see its value */
+        if (level == Katie_OptimizeLevel_Program && is_special_form(form, Katie_Special_Def) &&
+            array_length(form->as.list) == 3 && form->as.list[1]->kind == KatieValKind_Symbol) {
+            Katie_OptimizeBinding global = {.name = form->as.list[1]->as.symbol.id};
+
+            if (optimize_global_defs(&o, global.name) != 1) continue;
+            if (optimize_is_constant(form->as.list[2])) global.constant = form->as.list[2];
+            else global.inline_fn = optimize_inline_candidate(&o, form);
+
+            if (global.constant || global.inline_fn) {
+                while (array_length(o.globals) <= global.name)
+                    array_push(o.globals, ((Katie_OptimizeBinding){0}));
+                o.globals[global.name] = global;
+            }
+        }
+    }
+
+    if (level == Katie_OptimizeLevel_Program) deinit_katie_ctx(&o.builtins);
+    free_array(o.global_defs);
+    free_array(o.globals);
+    free_array(o.bindings);
+    katie_alloc_kind_pop(kindSave);
+}
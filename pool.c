@@ -0,0 +1,629 @@
+#include "katie.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------
+//                          - Work Stealing Pool -
+// --------------------------------------------------------------------------
+/*
+ * One process wide pool, started on first use with a worker per online cpu. Every worker owns a
+ * Chase-Lev deque, it pushes and pops tasks at the bottom while idle workers steal from the top.
+ * Threads which are not workers hand their tasks over through a locked injection queue.
+ *
+ * Each worker evaluates in its own Katie context, so workers never share mutable state. A task
+ * carries a snapshot of the globals of the context which spawned it, the worker copies it into
+ * its own globals before running the task. Values are immutable except for boxes, a closure
+ * handed to a task gets fresh boxes holding the values of its captures at spawn time.
+ */
+struct Katie_Task {
+    KatieVal *form; /* top level form to evaluate instead of applying `fn` */
+    KatieVal *fn;
+    int argc;
+    KatieVal **argv;
+    Katie_Snapshot *globals;
+    Katie_ModuleHold *hold; /* of the spawning context, NULL if it has none */
+    KatieVal *result;
+    String error;     /* set instead of `result` when the task failed */
+    u32 is_done;      /* set once `result` is written */
+    Katie_Task *next; /* injection queue link */
+};
+
+typedef struct Katie_DequeBuffer Katie_DequeBuffer;
+struct Katie_DequeBuffer {
+    i64 capacity; /* power of two */
+    Katie_Task *tasks[];
+};
+
+typedef struct Katie_Deque Katie_Deque;
+struct Katie_Deque {
+    i64 top;
+    i64 bottom;
+    Katie_DequeBuffer *buffer;
+};
+
+typedef struct Katie_Pool Katie_Pool;
+
+struct Katie_Worker {
+    Katie_Pool *pool;
+    pthread_t thread;
+    Katie_Deque deque;
+    Katie ctx;
+    Katie_Snapshot *synced; /* snapshot the globals of `ctx` currently hold */
+    u32 depth;              /* tasks running on this worker, nested ones help while waiting */
+    u64 seed;               /* picks steal victims */
+};
+
+struct Katie_Pool {
+    Katie_Worker *workers;
+    u32 worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond; /* signaled when tasks are queued */
+    pthread_cond_t done_cond; /* signaled when a task is done and a non worker waits */
+    Katie_Task *injected_head, *injected_tail;
+    u32 queued;  /* tasks waiting in any queue, a hint for sleeping workers */
+    u32 waiters; /* non worker threads blocked on done_cond */
+};
+
+#define KATIE_DEQUE_INITIAL_CAPACITY 64
+
+static Katie_Pool katie_pool;
+static pthread_once_t katie_pool_once = PTHREAD_ONCE_INIT;
+
+// ------------------------------ Snapshot ---------------------------------
+
+static Katie_Snapshot *snapshot_take(Katie *ctx) {
+    /* a worker's globals always match the snapshot they were synced to */
+    if (ctx->worker && ctx->worker->synced) {
+        katie_snapshot_acquire(ctx->worker->synced);
+        return ctx->worker->synced;
+    }
+    return katie_snapshot_globals(ctx);
+}
+
+static void worker_sync_globals(Katie_Worker *worker, Katie_Snapshot *snapshot) {
+    if (worker->synced == snapshot) return;
+
+    katie_restore_globals(&worker->ctx, snapshot);
+    katie_snapshot_acquire(snapshot);
+    if (worker->synced) katie_snapshot_release(worker->synced);
+    worker->synced = snapshot;
+}
+
+// ------------------------------ Deque ------------------------------------
+
+static Katie_DequeBuffer *deque_buffer_alloc(i64 capacity) {
+    Katie_DequeBuffer *buffer =
+        xmalloc(sizeof(Katie_DequeBuffer) + (usize)capacity * sizeof(Katie_Task *));
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+static void deque_init(Katie_Deque *deque) {
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->buffer = deque_buffer_alloc(KATIE_DEQUE_INITIAL_CAPACITY);
+}
+
+#define deque_slot(buffer, i) (&(buffer)->tasks[(i) & ((buffer)->capacity - 1)])
+
+/* Owner only */
+static void deque_push(Katie_Deque *deque, Katie_Task *task) {
+    i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    i64 top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    Katie_DequeBuffer *buffer = __atomic_load_n(&deque->buffer, __ATOMIC_RELAXED);
+
+    if (bottom - top > buffer->capacity - 1) {
+        /* the old buffer is never freed, a thief may still be reading from it */
+        Katie_DequeBuffer *grown = deque_buffer_alloc(buffer->capacity * 2);
+        for (i64 i = top; i < bottom; ++i) {
+            __atomic_store_n(deque_slot(grown, i),
+                             __atomic_load_n(deque_slot(buffer, i), __ATOMIC_RELAXED),
+                             __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&deque->buffer, grown, __ATOMIC_RELEASE);
+        buffer = grown;
+    }
+
+    __atomic_store_n(deque_slot(buffer, bottom), task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+/* Owner only, takes the most recently pushed task */
+static Katie_Task *deque_pop(Katie_Deque *deque) {
+    i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    Katie_DequeBuffer *buffer = __atomic_load_n(&deque->buffer, __ATOMIC_RELAXED);
+    Katie_Task *task = NULL;
+    i64 top;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top <= bottom) {
+        task = __atomic_load_n(deque_slot(buffer, bottom), __ATOMIC_RELAXED);
+        if (top == bottom) { /* last task, race the thieves for it */
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                task = NULL;
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/* Any thread, takes the oldest task */
+static Katie_Task *deque_steal(Katie_Deque *deque) {
+    i64 top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    i64 bottom;
+    Katie_DequeBuffer *buffer;
+    Katie_Task *task;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return NULL;
+
+    buffer = __atomic_load_n(&deque->buffer, __ATOMIC_ACQUIRE);
+    task = __atomic_load_n(deque_slot(buffer, top), __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED))
+        return NULL;
+    return task;
+}
+
+// ------------------------------ Scheduling -------------------------------
+
+static void pool_notify_work(Katie_Pool *pool) {
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_submit(Katie *ctx, Katie_Task *task) {
+    Katie_Pool *pool = &katie_pool;
+
+    if (ctx->worker) {
+        deque_push(&ctx->worker->deque, task);
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        task->next = NULL;
+        if (pool->injected_tail) pool->injected_tail->next = task;
+        else __atomic_store_n(&pool->injected_head, task, __ATOMIC_RELAXED);
+        pool->injected_tail = task;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pool_notify_work(pool);
+}
+
+static Katie_Task *pool_take_injected(Katie_Pool *pool) {
+    Katie_Task *task;
+
+    pthread_mutex_lock(&pool->lock);
+    task = pool->injected_head;
+    if (task) {
+        __atomic_store_n(&pool->injected_head, task->next, __ATOMIC_RELAXED);
+        if (!pool->injected_head) pool->injected_tail = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return task;
+}
+
+/* Own deque first, then a random victim's, then the injection queue */
+static Katie_Task *worker_find_task(Katie_Worker *worker) {
+    Katie_Pool *pool = worker->pool;
+    Katie_Task *task = deque_pop(&worker->deque);
+
+    if (!task) {
+        worker->seed ^= worker->seed << 13, worker->seed ^= worker->seed >> 7,
+            worker->seed ^= worker->seed << 17;
+        for (u32 i = 0; i < pool->worker_count && !task; ++i) {
+            Katie_Worker *victim = &pool->workers[(worker->seed + i) % pool->worker_count];
+            if (victim != worker) task = deque_steal(&victim->deque);
+        }
+    }
+    if (!task && __atomic_load_n(&pool->injected_head, __ATOMIC_RELAXED))
+        task = pool_take_injected(pool);
+
+    if (task) __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    return task;
+}
+
+static void worker_run_task(Katie_Worker *worker, Katie_Task *task) {
+    Katie_Pool *pool = worker->pool;
+    Katie_Snapshot *outer = worker->synced;
+    KatieEnv *envSave = worker->ctx.env;
+    Katie_ModuleHold *holdSave = worker->ctx.hold;
+    jmp_buf *recoverSave = worker->ctx.recover;
+    u32 profileDepthSave = katie_profile_depth();
+    u32 traceDepthSave = katie_trace_depth();
+    u32 allocKindSave = katie_alloc_kind_push(Katie_AllocKind_Value);
+    u32 allocFrameSave = katie_alloc_frame_push(0);
+    jmp_buf recover;
+
+    if (outer) katie_snapshot_acquire(outer);
+    worker_sync_globals(worker, task->globals);
+
+    /* runtime errors fail the task, they are raised again in the context which joins it */
+    worker->depth += 1;
+    worker->ctx.hold = task->hold; /* tasks spawned by this one keep its module alive too */
+    worker->ctx.recover = &recover;
+    if (setjmp(recover) == 0) {
+        if (task->form) {
+            worker->ctx.env = NULL;
+            task->result = katie_eval(&worker->ctx, task->form);
+        } else {
+            task->result = katie_apply(&worker->ctx, task->fn, task->argc, task->argv);
+        }
+    } else {
+        task->result = NULL;
+        task->error = make_string(worker->ctx.error, string_length(worker->ctx.error));
+        katie_profile_unwind(profileDepthSave);
+        katie_trace_unwind(traceDepthSave);
+    }
+    worker->ctx.env = envSave;
+    worker->ctx.hold = holdSave;
+    worker->ctx.recover = recoverSave;
+    worker->depth -= 1;
+    katie_alloc_kind_pop(allocKindSave);
+    katie_alloc_frame_pop(allocFrameSave);
+
+    /* a task run while waiting inside another one gives the outer task its globals back */
+    if (outer) {
+        if (worker->depth > 0) worker_sync_globals(worker, outer);
+        katie_snapshot_release(outer);
+    }
+
+    katie_snapshot_release(task->globals);
+    task->globals = NULL;
+    if (task->argv) xfree(task->argv);
+    task->argv = NULL;
+    if (task->hold) katie_module_hold_release(task->hold);
+    task->hold = NULL;
+
+    __atomic_store_n(&task->is_done, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&pool->waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *worker_main(void *arg) {
+    Katie_Worker *worker = arg;
+    Katie_Pool *pool = worker->pool;
+    Katie_Task *task;
+
+    init_katie_ctx(&worker->ctx);
+    worker->ctx.worker = worker;
+
+    for (;;) {
+        task = worker_find_task(worker);
+        if (task) {
+            worker_run_task(worker, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (!__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+static void pool_start(void) {
+    Katie_Pool *pool = &katie_pool;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    pool->worker_count = cpus > 0 ? (u32)cpus : 1;
+    pool->workers = xmalloc(pool->worker_count * sizeof(Katie_Worker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->injected_head = pool->injected_tail = NULL;
+    pool->queued = 0;
+    pool->waiters = 0;
+
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        Katie_Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->synced = NULL;
+        worker->depth = 0;
+        worker->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+        deque_init(&worker->deque);
+    }
+    /* deques must all exist before any worker may steal */
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0)
+            die("pthread_create");
+        pthread_detach(pool->workers[i].thread);
+    }
+}
+
+/* Workers run other tasks while they wait, any other thread blocks */
+static void task_wait(Katie *ctx, Katie_Task *task) {
+    Katie_Pool *pool = &katie_pool;
+
+    while (!__atomic_load_n(&task->is_done, __ATOMIC_ACQUIRE)) {
+        if (ctx->worker) {
+            Katie_Task *other = worker_find_task(ctx->worker);
+            if (other) worker_run_task(ctx->worker, other);
+            else sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&task->is_done, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        __atomic_sub_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// ------------------------------ Tasks ------------------------------------
+
+/* Closures get fresh boxes, so a frame which later rebinds a captured local can't race a task */
+static KatieVal *katie_share_value(KatieVal *val) {
+    Katie_Function *fn;
+    KatieVal *copy;
+
+    if (val->kind != KatieValKind_Function) return val;
+
+    fn = &val->as.function;
+    copy = NULL;
+    array_for_each(fn->info->captures, i) {
+        if (fn->captured[i]->kind != KatieValKind_Box) continue;
+        if (!copy) {
+            copy = alloc_function(fn->info, fn->name, fn->params, fn->body);
+            memcpy(copy->as.function.captured, fn->captured,
+                   array_length(fn->info->captures) * sizeof(KatieVal *));
+        }
+        copy->as.function.captured[i] = alloc_box(fn->captured[i]->as.box);
+    }
+    return copy ? copy : val;
+}
+
+Katie_ModuleHold *katie_hold_module(Katie_Module *module) {
+    Katie_ModuleHold *hold = xmalloc(sizeof(Katie_ModuleHold));
+    hold->refs = 1;
+    hold->module = module;
+    return hold;
+}
+
+void katie_module_hold_release(Katie_ModuleHold *hold) {
+    if (__atomic_sub_fetch(&hold->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    dealloc_val(hold->module);
+    xfree(hold);
+}
+
+static Katie_Task *task_alloc(Katie *ctx, Katie_Snapshot *globals) {
+    Katie_Task *task = xmalloc(sizeof(Katie_Task));
+
+    pthread_once(&katie_pool_once, pool_start);
+
+    task->form = NULL;
+    task->fn = NULL;
+    task->argc = 0;
+    task->argv = NULL;
+    task->globals = globals;
+    katie_snapshot_acquire(globals);
+    task->hold = ctx->hold;
+    if (task->hold) __atomic_add_fetch(&task->hold->refs, 1, __ATOMIC_RELAXED);
+    task->result = NULL;
+    task->error = NULL;
+    task->is_done = 0;
+    task->next = NULL;
+    return task;
+}
+
+static Katie_Task *katie_spawn(Katie *ctx, Katie_Snapshot *globals, KatieVal *fn, int argc,
+                               KatieVal **argv) {
+    Katie_Task *task = task_alloc(ctx, globals);
+
+    task->fn = katie_share_value(fn);
+    task->argc = argc;
+    task->argv = argc ? xmalloc((usize)argc * sizeof(KatieVal *)) : NULL;
+    for (int i = 0; i < argc; ++i)
+        task->argv[i] = katie_share_value(argv[i]);
+
+    pool_submit(ctx, task);
+    return task;
+}
+
+/* Module forms are read only, so they are shared as is */
+static Katie_Task *katie_spawn_form(Katie *ctx, Katie_Snapshot *globals, KatieVal *form) {
+    Katie_Task *task = task_alloc(ctx, globals);
+    task->form = form;
+    pool_submit(ctx, task);
+    return task;
+}
+
+/* Waits for and frees `task`. Its error, unless `error` already holds an earlier one, moves to
+ * `error`, the caller raises it once every task it spawned is joined. */
+static KatieVal *katie_task_join(Katie *ctx, Katie_Task *task, String *error) {
+    KatieVal *result;
+
+    task_wait(ctx, task);
+    result = task->result;
+    if (task->error) {
+        if (*error) free_string(task->error);
+        else *error = task->error;
+    }
+    xfree(task);
+    return result;
+}
+
+/* Frees `error` and raises it */
+static void katie_raise_task_error(Katie *ctx, String error) {
+    char msg[512]; /* the raise never returns to free `error` */
+
+    snprintf(msg, sizeof(msg), "%s", error);
+    free_string(error);
+    katie_runtime_error(ctx, "%s", msg);
+}
+
+/* Joins and frees every task, then raises the first error in spawn order */
+static KatieVal *katie_join_list(Katie *ctx, Array(Katie_Task *) tasks) {
+    Array(KatieVal *) results;
+    String error = NULL;
+
+    array_reserve(results, array_length(tasks) + 1);
+    array_for_each(tasks, i) { array_push(results, katie_task_join(ctx, tasks[i], &error)); }
+    free_array(tasks);
+
+    if (error) {
+        free_array(results);
+        katie_raise_task_error(ctx, error);
+    }
+    return alloc_list(results);
+}
+
+// ------------------------------ Natives ----------------------------------
+
+/* (pmap f list), applies `f` to every element in parallel */
+static KatieVal *native_pmap(Katie *ctx, int argc, KatieVal **argv) {
+    Array(Katie_Task *) tasks;
+    Katie_Snapshot *globals;
+
+    (void)argc;
+    globals = snapshot_take(ctx);
+    array_reserve(tasks, array_length(argv[1]->as.list) + 1);
+    array_for_each(argv[1]->as.list, i) {
+        array_push(tasks, katie_spawn(ctx, globals, argv[0], 1, &argv[1]->as.list[i]));
+    }
+    katie_snapshot_release(globals);
+    return katie_join_list(ctx, tasks);
+}
+
+/* (pcall f g ...), calls every function without arguments in parallel */
+static KatieVal *native_pcall(Katie *ctx, int argc, KatieVal **argv) {
+    Array(Katie_Task *) tasks;
+    Katie_Snapshot *globals;
+
+    globals = snapshot_take(ctx);
+    array_reserve(tasks, (usize)argc + 1);
+    for (int i = 0; i < argc; ++i)
+        array_push(tasks, katie_spawn(ctx, globals, argv[i], 0, NULL));
+    katie_snapshot_release(globals);
+    return katie_join_list(ctx, tasks);
+}
+
+/* (future f), calls `f` without arguments in the background */
+static KatieVal *native_future(Katie *ctx, int argc, KatieVal **argv) {
+    Katie_Snapshot *globals;
+    KatieVal *future;
+
+    (void)argc;
+    globals = snapshot_take(ctx);
+    future = alloc_val(KatieValKind_Future);
+    future->as.future = katie_spawn(ctx, globals, argv[0], 0, NULL);
+    katie_snapshot_release(globals);
+    return future;
+}
+
+/* (deref future), waits for the result of a future */
+static KatieVal *native_deref(Katie *ctx, int argc, KatieVal **argv) {
+    Katie_Task *task = argv[0]->as.future;
+
+    (void)argc;
+    task_wait(ctx, task);
+    if (task->error) katie_runtime_error(ctx, "%s", task->error);
+    return task->result;
+}
+
+static Katie_NativeSpec pool_natives[] = {
+    {.name = "pmap", .proc = native_pmap, .min_args = 2, .max_args = 2,
+     .arg_kinds = {KATIE_KINDS_CALLABLE, KATIE_KIND(List)}},
+    {.name = "pcall", .proc = native_pcall, .max_args = KATIE_VARIADIC,
+     .kinds = KATIE_KINDS_CALLABLE},
+    {.name = "future", .proc = native_future, .min_args = 1, .max_args = 1,
+     .kinds = KATIE_KINDS_CALLABLE},
+    {.name = "deref", .proc = native_deref, .min_args = 1, .max_args = 1,
+     .kinds = KATIE_KIND(Future)},
+};
+
+void katie_define_parallel_natives(Katie *ctx) {
+    katie_define_natives(ctx, pool_natives, array_sizeof(pool_natives, Katie_NativeSpec));
+}
+
+// ------------------------------ Module -----------------------------------
+
+/*
+ * Top level forms are evaluated in batches. A batch is a run of forms which define nothing but
+ * their own top level `def`, and read no name an earlier form of the batch defines. Its forms all
+ * see the globals as they were before the batch, so they run concurrently, then their results and
+ * definitions are committed in source order.
+ */
+void katie_eval_module_parallel(Katie *ctx, Katie_Module *module) {
+    Array(KatieVal *) forms = module->as.list;
+    Array(Katie_FormDeps) deps = katie_module_deps(module);
+    Array(u32) defined_in; /* per symbol id, batch which defined it, plus one */
+    Array(Katie_Task *) tasks;
+    Array(KatieVal *) results; /* of the batch being joined, NULL where its task failed */
+    String error = NULL;       /* of the first failed form */
+    u32 batch = 0;
+    usize begin, end;
+
+    init_array(defined_in);
+    init_array(tasks);
+    init_array(results);
+
+    for (begin = 0; begin < array_length(forms); begin = end) {
+        batch += 1;
+        for (end = begin; end < array_length(forms) && deps[end].is_independent; ++end) {
+            bool is_dependent = false;
+            array_for_each(deps[end].reads, i) {
+                Katie_SymbolId id = deps[end].reads[i];
+                if (id < array_length(defined_in) && defined_in[id] == batch) {
+                    is_dependent = true;
+                    break;
+                }
+            }
+            if (is_dependent) break;
+
+            if (deps[end].defines != KATIE_SYMBOL_NONE) {
+                while (array_length(defined_in) <= deps[end].defines)
+                    array_push(defined_in, 0);
+                defined_in[deps[end].defines] = batch;
+            }
+        }
+
+        if (end - begin < 2) { /* nothing to overlap with */
+            end = begin + 1;
+            katie_output_result(ctx, katie_eval(ctx, forms[begin]));
+            continue;
+        }
+
+        Katie_Snapshot *globals = snapshot_take(ctx);
+        array_length(tasks) = 0;
+        array_length(results) = 0;
+        for (usize i = begin; i < end; ++i) {
+            KatieVal *form = forms[i];
+            if (deps[i].defines != KATIE_SYMBOL_NONE) form = form->as.list[2];
+            array_push(tasks, katie_spawn_form(ctx, globals, form));
+            array_push(results, NULL);
+        }
+        katie_snapshot_release(globals);
+
+        /* the whole batch is joined first, forms before the first failed one still commit */
+        array_for_each(tasks, i) { results[i] = katie_task_join(ctx, tasks[i], &error); }
+        for (usize i = begin; i < end && results[i - begin]; ++i) {
+            if (deps[i].defines != KATIE_SYMBOL_NONE)
+                katie_define_global(ctx, forms[i]->as.list[1]->as.symbol, results[i - begin]);
+            katie_output_result(ctx, results[i - begin]);
+        }
+        if (error) break;
+    }
+
+    free_array(results);
+    free_array(tasks);
+    free_array(defined_in);
+    katie_free_module_deps(deps);
+    if (error) katie_raise_task_error(ctx, error);
+}
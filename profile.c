@@ -0,0 +1,227 @@
+#include "katie.h"
+
+#include <signal.h>
+#include <sys/time.h>
+
+// --------------------------------------------------------------------------
+//                          - Profiler -
+// --------------------------------------------------------------------------
+/*
+ * Every thread keeps a shadow stack of the Katie frames it is evaluating, calls of user fns and
+ * top level forms, each one a frame id naming its source position. A SIGPROF timer interrupts
+ * whichever thread is running, the handler copies that thread's stack into a preallocated sample
+ * buffer and nothing else, so it never allocates or locks. At exit the samples are folded into
+ * `root;caller;callee count` lines, the input format of flamegraph tools.
+ */
+#define KATIE_PROFILE_SAMPLES_CAPACITY (4u << 20) /* u32s, 16 MiB */
+
+Katie_Profiler katie_profiler = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread u32 profile_stack[KATIE_PROFILE_MAX_DEPTH];
+static __thread volatile u32 profile_depth;
+
+static u32 profile_register(Katie_ProfileFrame frame) {
+    Katie_Profiler *p = &katie_profiler;
+    u32 id;
+
+    pthread_mutex_lock(&p->lock);
+    if (!p->frames) {
+        Katie_ProfileFrame none = {.name = KATIE_SYMBOL_NONE};
+        init_array(p->frames);
+        array_push(p->frames, none);
+    }
+    id = (u32)array_length(p->frames);
+    array_push(p->frames, frame);
+    pthread_mutex_unlock(&p->lock);
+    return id;
+}
+
+u32 katie_profile_fn_frame(Katie_FnInfo *info) {
+    u32 frame = __atomic_load_n(&info->profile_frame, __ATOMIC_ACQUIRE);
+
+    if (!frame) { /* racing threads may both register, either id names the same fn */
+        Katie_ProfileFrame fn = {.name = info->name, .filepath = info->filepath, .pos = info->pos};
+        frame = profile_register(fn);
+        __atomic_store_n(&info->profile_frame, frame, __ATOMIC_RELEASE);
+    }
+    return frame;
+}
+
+/* Names a top level form after the position of its first symbol */
+static KatieVal *profile_first_symbol(KatieVal *val) {
+    if (val->kind == KatieValKind_Symbol) return val;
+    if (val->kind != KatieValKind_List) return NULL;
+
+    array_for_each(val->as.list, i) {
+        KatieVal *symbol = profile_first_symbol(val->as.list[i]);
+        if (symbol) return symbol;
+    }
+    return NULL;
+}
+
+u32 katie_profile_form_frame(KatieVal *form) {
+    Katie_ProfileFrame toplevel = {.name = KATIE_SYMBOL_NONE, .is_toplevel = true};
+    KatieVal *symbol = profile_first_symbol(form);
+
+    if (symbol) {
+        toplevel.filepath = KATIE_SYMBOL_SITE(symbol)->filepath;
+        toplevel.pos = KATIE_SYMBOL_SITE(symbol)->pos;
+    }
+    return profile_register(toplevel);
+}
+
+void katie_profile_push(u32 frame) {
+    u32 depth = profile_depth;
+
+    if (depth < KATIE_PROFILE_MAX_DEPTH) profile_stack[depth] = frame;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST); /* the frame is in place before the handler sees it */
+    profile_depth = depth + 1;
+}
+
+void katie_profile_pop(void) {
+    profile_depth -= 1;
+}
+
+u32 katie_profile_depth(void) {
+    return profile_depth;
+}
+
+/* Drops the frames a runtime error unwound past */
+void katie_profile_unwind(u32 depth) {
+    profile_depth = depth;
+}
+
+static void profile_on_signal(int signal) {
+    Katie_Profiler *p = &katie_profiler;
+    u32 depth = profile_depth;
+    u32 count = depth < KATIE_PROFILE_MAX_DEPTH ? depth : KATIE_PROFILE_MAX_DEPTH;
+    u32 at = __atomic_fetch_add(&p->samples_used, count + 1, __ATOMIC_RELAXED);
+
+    (void)signal;
+    if (at + count + 1 > p->samples_capacity) {
+        __atomic_fetch_add(&p->samples_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    p->samples[at] = depth;
+    for (u32 i = 0; i < count; ++i)
+        p->samples[at + 1 + i] = profile_stack[i];
+}
+
+/* Samples every thread's CPU time `hz` times per second, false if the timer can't be set */
+bool katie_profile_start(int hz) {
+    Katie_Profiler *p = &katie_profiler;
+    struct sigaction action;
+    struct itimerval timer;
+
+    p->samples = xmalloc(KATIE_PROFILE_SAMPLES_CAPACITY * sizeof(u32));
+    p->samples_capacity = KATIE_PROFILE_SAMPLES_CAPACITY;
+    p->samples_used = 0;
+    p->is_enabled = true;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) < 0) return false;
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz >= 1000000 ? 1 : 1000000 / (hz > 0 ? hz : 1);
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+static String profile_append_frame(String out, Katie_ProfileFrame *frame) {
+    char buf[64];
+
+    if (frame->is_toplevel) out = append_cstring(out, "toplevel");
+    else if (frame->name == KATIE_SYMBOL_NONE) out = append_cstring(out, "fn");
+    else out = append_cstring(out, katie_symbol_from_id(frame->name).name);
+
+    if (frame->filepath) {
+        out = append_cstring(out, " (");
+        out = append_cstring(out, frame->filepath);
+        sprintf(buf, ":%zu:%zu)", frame->pos.row, frame->pos.col);
+        out = append_cstring(out, buf);
+    }
+    return out;
+}
+
+static int profile_compare_stacks(const void *lhs, const void *rhs) {
+    return strcmp(*(String const *)lhs, *(String const *)rhs);
+}
+
+/* Appends the label of a frame id, as it appears in the folded stacks */
+String katie_profile_append_label(String out, u32 frame) {
+    Katie_Profiler *p = &katie_profiler;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->frames && frame < array_length(p->frames))
+        out = profile_append_frame(out, &p->frames[frame]);
+    pthread_mutex_unlock(&p->lock);
+    return out;
+}
+
+/* Stops sampling and writes the folded stacks, one line per distinct stack */
+void katie_profile_write(char *out_filepath) {
+    Katie_Profiler *p = &katie_profiler;
+    struct itimerval timer;
+    Array(String) labels;
+    Array(String) stacks;
+    u32 used;
+    FILE *out;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+
+    out = fopen(out_filepath, "w");
+    if (!out) {
+        perror(out_filepath);
+        return;
+    }
+
+    init_array(labels);
+    if (p->frames) {
+        array_for_each(p->frames, i) {
+            array_push(labels, profile_append_frame(make_string_empty(), &p->frames[i]));
+        }
+    }
+
+    init_array(stacks);
+    used = p->samples_used < p->samples_capacity ? p->samples_used : p->samples_capacity;
+    for (u32 at = 0; at < used;) {
+        u32 depth = p->samples[at];
+        u32 count = depth < KATIE_PROFILE_MAX_DEPTH ? depth : KATIE_PROFILE_MAX_DEPTH;
+        String stack = append_cstring(make_string_empty(), "katie");
+
+        if (at + 1 + count > used) break;
+        for (u32 i = 0; i < count; ++i) {
+            u32 frame = p->samples[at + 1 + i];
+            stack = append_cstring(stack, ";");
+            if (frame < array_length(labels))
+                stack = append_string_length(stack, labels[frame], string_length(labels[frame]));
+        }
+        if (depth > count) stack = append_cstring(stack, ";[truncated]");
+
+        array_push(stacks, stack);
+        at += 1 + count;
+    }
+
+    qsort(stacks, array_length(stacks), sizeof(String), profile_compare_stacks);
+    for (usize i = 0; i < array_length(stacks);) {
+        usize same = i + 1;
+        while (same < array_length(stacks) && !strcmp(stacks[same], stacks[i]))
+            same += 1;
+        fprintf(out, "%s %zu\n", stacks[i], same - i);
+        i = same;
+    }
+    if (p->samples_dropped)
+        eprintln("profile: sample buffer full, dropped %u samples", p->samples_dropped);
+
+    fclose(out);
+    array_for_each(stacks, i) { free_string(stacks[i]); }
+    array_for_each(labels, i) { free_string(labels[i]); }
+    free_array(stacks);
+    free_array(labels);
+}
@@ -0,0 +1,265 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Resolve -
+// --------------------------------------------------------------------------
+/*
+ * Free variable analysis run over a module before it is evaluated. Every `fn` form gets a
+ * Katie_FnInfo listing the names its closure has to capture, i.e free names of its body bound
+ * by an enclosing fn, and the locals of its own frame which have to live in a box because an
+ * inner fn captures them while `def` may rebind them. Names no enclosing fn binds are globals.
+ */
+typedef struct Katie_Scope Katie_Scope;
+struct Katie_Scope {
+    Katie_Scope *outer; /* NULL for a fn at top level */
+    Katie_FnInfo *info;
+    Array(Katie_SymbolId) params;
+    Array(Katie_SymbolId) defs; /* names bound by def directly in this fn */
+};
+
+static bool ids_contain(Array(Katie_SymbolId) ids, Katie_SymbolId id) {
+    array_for_each(ids, i) {
+        if (ids[i] == id) return true;
+    }
+    return false;
+}
+
+static void symbols_add_unique(Array(Katie_Symbol) * symbols, Katie_Symbol symbol) {
+    array_for_each(*symbols, i) {
+        if ((*symbols)[i].id == symbol.id) return;
+    }
+    array_push((*symbols), symbol);
+}
+
+static bool scope_has_local(Katie_Scope *scope, Katie_SymbolId id) {
+    return ids_contain(scope->params, id) || ids_contain(scope->defs, id);
+}
+
+static bool is_special_form(KatieVal *val, Katie_SpecialKind kind) {
+    return val->kind == KatieValKind_List && !array_is_empty(val->as.list) &&
+           val->as.list[0]->kind == KatieValKind_Special && val->as.list[0]->as.special == kind;
+}
+
+/* Collects def targets of a fn body, nested fns bind their own */
+static void scope_collect_defs(Katie_Scope *scope, KatieVal *val) {
+    if (val->kind != KatieValKind_List) return;
+    if (is_special_form(val, Katie_Special_Fn)) return;
+
+    if (is_special_form(val, Katie_Special_Def) && array_length(val->as.list) >= 2 &&
+        val->as.list[1]->kind == KatieValKind_Symbol) {
+        if (!ids_contain(scope->defs, val->as.list[1]->as.symbol.id))
+            array_push(scope->defs, val->as.list[1]->as.symbol.id);
+    }
+
+    array_for_each(val->as.list, i) { scope_collect_defs(scope, val->as.list[i]); }
+}
+
+/* Returns whether `symbol` is lexically bound at `scope`, capturing it on the way down */
+static bool scope_resolve(Katie_Scope *scope, Katie_Symbol symbol) {
+    if (!scope) return false;
+    if (scope_has_local(scope, symbol.id)) return true;
+    if (!scope_resolve(scope->outer, symbol)) return false;
+
+    symbols_add_unique(&scope->info->captures, symbol);
+    if (ids_contain(scope->outer->defs, symbol.id)) {
+        symbols_add_unique(&scope->outer->info->boxed, symbol);
+    }
+    return true;
+}
+
+static void resolve_form(Katie_Scope *scope, KatieVal *val);
+
+static void resolve_fn(Katie_Scope *outer, KatieVal *val) {
+    Katie_Scope scope;
+    Katie_FnInfo *info;
+    Array(KatieVal *) list = val->as.list;
+
+    if (array_length(list) != 3 || list[1]->kind != KatieValKind_List) return;
+
+    info = xmalloc(sizeof(Katie_FnInfo));
+    init_array(info->captures);
+    init_array(info->boxed);
+    info->name = KATIE_SYMBOL_NONE;
+    info->filepath = KATIE_FN_SITE(list[0])->filepath;
+    info->pos = KATIE_FN_SITE(list[0])->pos;
+    info->profile_frame = 0;
+    info->code = NULL;
+    KATIE_FN_SITE(list[0])->info = info;
+
+    scope.outer = outer;
+    scope.info = info;
+    init_array(scope.params);
+    init_array(scope.defs);
+
+    array_for_each(list[1]->as.list, i) {
+        if (list[1]->as.list[i]->kind == KatieValKind_Symbol)
+            array_push(scope.params, list[1]->as.list[i]->as.symbol.id);
+    }
+    scope_collect_defs(&scope, list[2]);
+    resolve_form(&scope, list[2]);
+
+    free_array(scope.defs);
+    free_array(scope.params);
+}
+
+static void resolve_form(Katie_Scope *scope, KatieVal *val) {
+    switch (val->kind) {
+    case KatieValKind_Symbol: scope_resolve(scope, val->as.symbol); break;
+
+    case KatieValKind_List: {
+        if (is_special_form(val, Katie_Special_Fn)) {
+            resolve_fn(scope, val);
+            break;
+        }
+
+        array_for_each(val->as.list, i) {
+            /* def targets are bindings, not references */
+            if (i == 1 && is_special_form(val, Katie_Special_Def)) continue;
+            resolve_form(scope, val->as.list[i]);
+        }
+
+        /* `(def name (fn ...))` names the fn, for profiles */
+        if (is_special_form(val, Katie_Special_Def) && array_length(val->as.list) == 3 &&
+            val->as.list[1]->kind == KatieValKind_Symbol &&
+            is_special_form(val->as.list[2], Katie_Special_Fn) &&
+            KATIE_FN_SITE(val->as.list[2]->as.list[0])->info) {
+            KATIE_FN_SITE(val->as.list[2]->as.list[0])->info->name = val->as.list[1]->as.symbol.id;
+        }
+    } break;
+
+    default: break;
+    }
+}
+
+void katie_resolve_module(Katie_Module *module) {
+    u64 start_ns = katie_stats_begin();
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_AstNode);
+    array_for_each(module->as.list, i) { resolve_form(NULL, module->as.list[i]); }
+    katie_alloc_kind_pop(kindSave);
+    katie_stats_end(resolve_ns, start_ns);
+}
+
+// --------------------------------------------------------------------------
+//                          - Dependencies -
+// --------------------------------------------------------------------------
+/*
+ * Conservative read sets of top level forms. A form reads every name it references, and through
+ * calls, every name the definitions of those names reference. A `def` of a fn literal reads
+ * nothing, its body only runs once called. Lexical bindings are not told apart from globals,
+ * which only costs some false dependencies.
+ */
+typedef struct Katie_DepsBuilder Katie_DepsBuilder;
+struct Katie_DepsBuilder {
+    Array(Array(Katie_SymbolId)) refs; /* per form, every name referenced anywhere */
+    Array(Array(u32)) definers;        /* per symbol id, forms defining it */
+    Array(u32) seen;                   /* per symbol id, last form which visited it */
+};
+
+/*
+ * `defs` counts the def forms which bind globals, those outside of fn bodies. A load-native
+ * counts too, it binds the natives of its module.
+ */
+static void collect_refs(KatieVal *val, Array(Katie_SymbolId) * refs, u32 *defs,
+                         Katie_SymbolId load_native) {
+    switch (val->kind) {
+    case KatieValKind_Symbol:
+        array_push((*refs), val->as.symbol.id);
+        if (val->as.symbol.id == load_native && defs) *defs += 1;
+        break;
+
+    case KatieValKind_List: {
+        bool is_fn = is_special_form(val, Katie_Special_Fn);
+        bool is_def = is_special_form(val, Katie_Special_Def);
+
+        if (is_def && defs) *defs += 1;
+        array_for_each(val->as.list, i) {
+            if (i == 1 && is_def) continue;
+            collect_refs(val->as.list[i], refs, is_fn ? NULL : defs, load_native);
+        }
+    } break;
+
+    default: break;
+    }
+}
+
+static void deps_reserve(Katie_DepsBuilder *b, Katie_SymbolId id) {
+    while (array_length(b->seen) <= id)
+        array_push(b->seen, U32_MAX);
+    while (array_length(b->definers) <= id) {
+        Array(u32) none = NULL;
+        array_push(b->definers, none);
+    }
+}
+
+/* Adds `id` and everything its definitions reference to `reads`, once per form */
+static void deps_close_over(Katie_DepsBuilder *b, Katie_SymbolId id, u32 form,
+                            Array(Katie_SymbolId) * reads) {
+    deps_reserve(b, id);
+    if (b->seen[id] == form) return;
+    b->seen[id] = form;
+    array_push((*reads), id);
+
+    if (!b->definers[id]) return;
+    array_for_each(b->definers[id], i) {
+        Array(Katie_SymbolId) refs = b->refs[b->definers[id][i]];
+        array_for_each(refs, k) { deps_close_over(b, refs[k], form, reads); }
+    }
+}
+
+Array(Katie_FormDeps) katie_module_deps(Katie_Module *module) {
+    Katie_DepsBuilder b;
+    Array(Katie_FormDeps) deps;
+    Array(KatieVal *) forms = module->as.list;
+    Katie_SymbolId load_native = katie_intern_cstring("load-native").id;
+
+    init_array(b.refs);
+    init_array(b.definers);
+    init_array(b.seen);
+    array_reserve(deps, array_length(forms) + 1);
+
+    array_for_each(forms, i) {
+        Katie_FormDeps form = {.defines = KATIE_SYMBOL_NONE};
+        Array(Katie_SymbolId) refs;
+        KatieVal *evaluated = forms[i];
+        u32 defs = 0;
+
+        if (is_special_form(forms[i], Katie_Special_Def) && array_length(forms[i]->as.list) == 3 &&
+            forms[i]->as.list[1]->kind == KatieValKind_Symbol) {
+            form.defines = forms[i]->as.list[1]->as.symbol.id;
+            evaluated = forms[i]->as.list[2];
+
+            deps_reserve(&b, form.defines);
+            if (!b.definers[form.defines]) init_array(b.definers[form.defines]);
+            array_push(b.definers[form.defines], (u32)i);
+        }
+
+        init_array(refs);
+        collect_refs(evaluated, &refs, &defs, load_native);
+        array_push(b.refs, refs);
+
+        form.is_independent = defs == 0;
+        form.is_fn_literal = is_special_form(evaluated, Katie_Special_Fn);
+        array_push(deps, form);
+    }
+
+    /* only now are all definitions known, close the references over them */
+    array_for_each(deps, i) {
+        init_array(deps[i].reads);
+        if (deps[i].is_fn_literal) continue;
+        array_for_each(b.refs[i], k) { deps_close_over(&b, b.refs[i][k], (u32)i, &deps[i].reads); }
+    }
+
+    array_for_each(b.refs, i) { free_array(b.refs[i]); }
+    array_for_each(b.definers, i) {
+        if (b.definers[i]) free_array(b.definers[i]);
+    }
+    free_array(b.refs);
+    free_array(b.definers);
+    free_array(b.seen);
+    return deps;
+}
+
+void katie_free_module_deps(Array(Katie_FormDeps) deps) {
+    array_for_each(deps, i) { free_array(deps[i].reads); }
+    free_array(deps);
+}
@@ -0,0 +1,19 @@
+#define _GNU_SOURCE
+
+/* The runtime without a main, the unity build of libkatie and of `katie --emit-c` programs */
+#include "basic.c"
+#include "bignum.c"
+#include "env.c"
+#include "resolve.c"
+#include "optimize.c"
+#include "stats.c"
+#include "profile.c"
+#include "trace.c"
+#include "allocs.c"
+#include "katie.c"
+#include "vm.c"
+#include "jit.c"
+#include "pool.c"
+#include "native.c"
+#include "seq.c"
+#include "aot.c"
@@ -0,0 +1,305 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Lazy Sequences -
+// --------------------------------------------------------------------------
+/*
+ * A seq is a thunk and, once forced, the chunk it realized: up to KATIE_SEQ_CHUNK values and the
+ * seq of the values after them. range, map, filter and take make seqs without reading anything.
+ *
+ * Printing forces the chunks it shows and publishes them on the seq, the first to publish wins
+ * when threads race. Every other read, reduce's and those of a seq realizing its own values from
+ * its source, goes through a cursor: an unrealized seq it reaches is copied and the copy stepped
+ * in place, a value at a time, publishing nothing and freed once read. `(reduce + 0 (range n))`
+ * then allocates no seq at all whatever n is.
+ *
+ * Thunks are read only once a seq is made, so a seq read twice realizes the same values twice.
+ */
+static bool seq_range_has(Katie_SeqThunk *range) {
+    if (range->is_unbounded) return true;
+    return range->step > 0 ? range->from < range->to : range->from > range->to;
+}
+
+/* Steps a range to its next value, a range ends where its fixnums do */
+static bool seq_range_next(Katie_SeqThunk *range, i64 *out) {
+    if (!seq_range_has(range)) return false;
+    *out = range->from;
+    if (__builtin_add_overflow(range->from, range->step, &range->from)) {
+        range->is_unbounded = false;
+        range->from = range->to = *out; /* empty */
+    }
+    return true;
+}
+
+/* Whether the thunk is known to have no values left, without stepping it */
+static bool seq_is_done(Katie_SeqThunk *thunk) {
+    switch (thunk->kind) {
+    case Katie_SeqKind_Range: return !seq_range_has(thunk);
+    case Katie_SeqKind_Take: return thunk->count == 0;
+    default: return false;
+    }
+}
+
+/* Frees the private seqs the cursor owns, nothing else can reach them */
+static void seq_cursor_drop(Katie_SeqCursor *cursor) {
+    if (cursor->is_owned) dealloc_val(cursor->coll);
+    cursor->coll = NULL;
+    cursor->is_owned = false;
+}
+
+static bool seq_cursor_next(Katie *ctx, Katie_SeqCursor *cursor, KatieVal **out);
+
+/* Steps a thunk in place to its next value, false once it has none */
+static bool seq_step(Katie *ctx, Katie_SeqThunk *thunk, KatieVal **out) {
+    KatieVal *val, *is_kept;
+    i64 number;
+
+    switch (thunk->kind) {
+    case Katie_SeqKind_Range:
+        if (!seq_range_next(thunk, &number)) return false;
+        *out = alloc_number(number);
+        return true;
+
+    case Katie_SeqKind_Map:
+        if (!seq_cursor_next(ctx, &thunk->source, &val)) return false;
+        *out = katie_apply(ctx, thunk->fn, 1, &val);
+        return true;
+
+    case Katie_SeqKind_Filter:
+        while (seq_cursor_next(ctx, &thunk->source, &val)) {
+            is_kept = katie_apply(ctx, thunk->fn, 1, &val);
+            if (is_kept->kind == KatieValKind_Bool && is_kept->as._bool) {
+                *out = val;
+                return true;
+            }
+        }
+        return false;
+
+    case Katie_SeqKind_Take:
+        if (thunk->count == 0 || !seq_cursor_next(ctx, &thunk->source, out)) return false;
+        thunk->count -= 1;
+        return true;
+
+    default: Unreachable();
+    }
+    return false;
+}
+
+/* The next value of the cursor into `out`, false once past the last */
+static bool seq_cursor_next(Katie *ctx, Katie_SeqCursor *cursor, KatieVal **out) {
+    Katie_SeqChunk *chunk;
+
+    while (cursor->coll) {
+        if (cursor->coll->kind == KatieValKind_List) {
+            if (cursor->index < array_length(cursor->coll->as.list)) {
+                *out = cursor->coll->as.list[cursor->index++];
+                return true;
+            }
+            cursor->coll = NULL;
+        } else if (cursor->is_owned) {
+            if (seq_step(ctx, &cursor->coll->as.seq->thunk, out)) return true;
+            seq_cursor_drop(cursor);
+        } else if ((chunk = __atomic_load_n(&cursor->coll->as.seq->chunk, __ATOMIC_ACQUIRE))) {
+            if (cursor->index < array_length(chunk->values)) {
+                *out = chunk->values[cursor->index++];
+                return true;
+            }
+            cursor->coll = chunk->rest;
+            cursor->index = 0;
+        } else {
+            cursor->coll = alloc_seq(cursor->coll->as.seq->thunk);
+            cursor->is_owned = true;
+        }
+    }
+    return false;
+}
+
+Katie_SeqChunk *katie_seq_force(Katie *ctx, KatieVal *seq) {
+    Katie_SeqChunk *chunk = __atomic_load_n(&seq->as.seq->chunk, __ATOMIC_ACQUIRE);
+    Katie_SeqChunk *published = NULL;
+    Katie_SeqThunk next;
+    KatieVal *val;
+
+    if (chunk) return chunk;
+
+    next = seq->as.seq->thunk;
+    chunk = xmalloc(sizeof(Katie_SeqChunk));
+    array_reserve(chunk->values, KATIE_SEQ_CHUNK);
+    while (array_length(chunk->values) < KATIE_SEQ_CHUNK && seq_step(ctx, &next, &val)) {
+        array_push(chunk->values, val);
+    }
+
+    /* a chunk short of full read its source to the end */
+    if (array_length(chunk->values) == KATIE_SEQ_CHUNK && !seq_is_done(&next)) {
+        chunk->rest = alloc_seq(next); /* holds the private seqs `next` stepped, if any */
+    } else {
+        chunk->rest = NULL;
+        seq_cursor_drop(&next.source);
+    }
+
+    if (!__atomic_compare_exchange_n(&seq->as.seq->chunk, &published, chunk, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (chunk->rest) {
+            dealloc_val(chunk->rest);
+            seq_cursor_drop(&next.source);
+        }
+        free_array(chunk->values);
+        xfree(chunk);
+        return published;
+    }
+    return chunk;
+}
+
+/*
+ * Realizes the values of `val` which print, those of its lists and the first KATIE_SEQ_PRINT of
+ * its seqs, so printing it calls nothing. Unbounded seqs print a chunk and "...".
+ */
+void katie_seq_realize_printed(Katie *ctx, KatieVal *val) {
+    Katie_SeqChunk *chunk;
+    usize printed = 0;
+
+    if (val->kind == KatieValKind_List) {
+        array_for_each(val->as.list, i) { katie_seq_realize_printed(ctx, val->as.list[i]); }
+        return;
+    }
+    if (val->kind != KatieValKind_Seq) return;
+
+    for (KatieVal *seq = val; seq && printed < KATIE_SEQ_PRINT; seq = chunk->rest) {
+        chunk = katie_seq_force(ctx, seq);
+        for (usize i = 0; i < array_length(chunk->values) && printed < KATIE_SEQ_PRINT; ++i) {
+            katie_seq_realize_printed(ctx, chunk->values[i]);
+            printed += 1;
+        }
+    }
+}
+
+/* The seq's own chunk and the private seqs its thunk steps, never values others may hold */
+void katie_seq_free(Katie_Seq *seq) {
+    seq_cursor_drop(&seq->thunk.source);
+    if (seq->chunk) {
+        free_array(seq->chunk->values);
+        xfree(seq->chunk);
+    }
+    xfree(seq);
+}
+
+// ------------------------------ Natives ----------------------------------
+
+/* (range), (range to), (range from to) or (range from to step) */
+static KatieVal *native_range(Katie *ctx, int argc, KatieVal **argv) {
+    Katie_SeqThunk range = {.kind = Katie_SeqKind_Range, .step = 1, .is_unbounded = argc == 0};
+
+    switch (argc) {
+    case 1: range.to = argv[0]->as.number; break;
+    case 3: range.step = argv[2]->as.number; /* fallthrough */
+    case 2:
+        range.from = argv[0]->as.number;
+        range.to = argv[1]->as.number;
+        break;
+    default: break;
+    }
+
+    if (range.step == 0) katie_runtime_error(ctx, "range expects a step other than 0");
+    return alloc_seq(range);
+}
+
+static KatieVal *native_map(Katie *ctx, int argc, KatieVal **argv) {
+    (void)ctx;
+    (void)argc;
+    return alloc_seq((Katie_SeqThunk){
+        .kind = Katie_SeqKind_Map, .fn = argv[0], .source = {.coll = argv[1]}});
+}
+
+static KatieVal *native_filter(Katie *ctx, int argc, KatieVal **argv) {
+    (void)ctx;
+    (void)argc;
+    return alloc_seq((Katie_SeqThunk){
+        .kind = Katie_SeqKind_Filter, .fn = argv[0], .source = {.coll = argv[1]}});
+}
+
+static KatieVal *native_take(Katie *ctx, int argc, KatieVal **argv) {
+    i64 count = argv[0]->as.number;
+
+    (void)ctx;
+    (void)argc;
+    return alloc_seq((Katie_SeqThunk){
+        .kind = Katie_SeqKind_Take, .count = count < 0 ? 0 : count, .source = {.coll = argv[1]}});
+}
+
+/*
+ * Folds fixnums into the fixnum `acc` through the fixnum entry of the native `fn`, reading the
+ * ranges the cursor steps without boxing them. Returns the first result which is no fixnum, the
+ * fold then goes on boxed.
+ */
+static KatieVal *seq_reduce_fixnums(Katie *ctx, KatieVal *fn, KatieVal *acc,
+                                    Katie_SeqCursor *cursor) {
+    Katie_NativeSpec *spec = fn->as.native.spec;
+    KatieVal *args[2] = {acc, NULL};
+    i64 folded = acc->as.number, number, result;
+    bool is_folded = false;
+
+    for (;;) {
+        if (cursor->is_owned && cursor->coll->as.seq->thunk.kind == Katie_SeqKind_Range) {
+            if (!seq_range_next(&cursor->coll->as.seq->thunk, &number)) {
+                seq_cursor_drop(cursor);
+                break;
+            }
+            args[1] = NULL;
+        } else if (!seq_cursor_next(ctx, cursor, &args[1])) {
+            break;
+        } else if (args[1]->kind == KatieValKind_Number) {
+            number = args[1]->as.number;
+        } else {
+            args[0] = is_folded ? alloc_number(folded) : acc;
+            return katie_apply(ctx, fn, 2, args);
+        }
+
+        if (katie_spec_fixnum2(spec, folded, number, &result)) {
+            katie_stat_native_call(fn);
+            folded = result;
+            is_folded = true;
+            continue;
+        }
+        args[0] = is_folded ? alloc_number(folded) : acc;
+        if (!args[1]) args[1] = alloc_number(number);
+        return katie_apply(ctx, fn, 2, args);
+    }
+    return is_folded ? alloc_number(folded) : acc;
+}
+
+/* (reduce fn init coll), reads coll through a cursor, realizing none of it on coll */
+static KatieVal *native_reduce(Katie *ctx, int argc, KatieVal **argv) {
+    Katie_SeqCursor cursor = {.coll = argv[2], .index = 0, .is_owned = false};
+    KatieVal *fn = argv[0], *args[2] = {argv[1], NULL};
+    bool is_fixnum2 = fn->kind == KatieValKind_NativeFunction && fn->as.native.spec &&
+                      katie_spec_has_fixnum2(fn->as.native.spec) &&
+                      !fn->as.native.spec->is_predicate;
+
+    (void)argc;
+    while (cursor.coll) {
+        if (is_fixnum2 && args[0]->kind == KatieValKind_Number) {
+            args[0] = seq_reduce_fixnums(ctx, fn, args[0], &cursor);
+        } else if (seq_cursor_next(ctx, &cursor, &args[1])) {
+            args[0] = katie_apply(ctx, fn, 2, args);
+        }
+    }
+    return args[0];
+}
+
+#define KATIE_KINDS_SEQUENCE (KATIE_KIND(List) | KATIE_KIND(Seq))
+
+static Katie_NativeSpec seq_natives[] = {
+    {.name = "range", .proc = native_range, .max_args = 3, .kinds = KATIE_KIND(Number)},
+    {.name = "map", .proc = native_map, .min_args = 2, .max_args = 2,
+     .arg_kinds = {KATIE_KINDS_CALLABLE, KATIE_KINDS_SEQUENCE}},
+    {.name = "filter", .proc = native_filter, .min_args = 2, .max_args = 2,
+     .arg_kinds = {KATIE_KINDS_CALLABLE, KATIE_KINDS_SEQUENCE}},
+    {.name = "take", .proc = native_take, .min_args = 2, .max_args = 2,
+     .arg_kinds = {KATIE_KIND(Number), KATIE_KINDS_SEQUENCE}},
+    {.name = "reduce", .proc = native_reduce, .min_args = 3, .max_args = 3,
+     .arg_kinds = {KATIE_KINDS_CALLABLE, 0, KATIE_KINDS_SEQUENCE}},
+};
+
+void katie_define_seq_natives(Katie *ctx) {
+    katie_define_natives(ctx, seq_natives, array_sizeof(seq_natives, Katie_NativeSpec));
+}
@@ -0,0 +1,439 @@
+#include "katie.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------
+//                          - Eval Server -
+// --------------------------------------------------------------------------
+/*
+ * `katie --serve <socket> prelude.kat` keeps one warmed context per worker thread, each one has
+ * already evaluated the shared prelude module. One thread multiplexes every client with epoll and
+ * hands complete requests over to the workers. After a request a worker restores the globals the
+ * prelude left, so requests never see each other's definitions.
+ *
+ * Every message is framed by a 32-bit big endian length:
+ *   request:  u32 length, `length` bytes of source
+ *   response: u32 length, u8 status, `length - 1` bytes of payload
+ *
+ * A status of KATIE_SERVE_OK carries the printed result of every form, one per line, any other
+ * status carries the error message. A client may pipeline requests, they are answered in order.
+ */
+#define KATIE_SERVE_OK 0
+#define KATIE_SERVE_ERROR 1
+#define KATIE_SERVE_MAX_REQUEST (64u << 20)
+#define KATIE_SERVE_MAX_EVENTS 64
+
+typedef struct Katie_Connection Katie_Connection;
+typedef struct Katie_ServeJob Katie_ServeJob;
+
+struct Katie_Connection {
+    int fd;
+    String in;        /* received bytes, `in_begin` of them already handed out */
+    usize in_begin;
+    String out;       /* framed responses, `out_sent` of them already written */
+    usize out_sent;
+    u32 events;       /* epoll interest */
+    bool is_busy;     /* a worker is evaluating one of its requests */
+    bool is_closing;  /* the peer shut down its side, close once answered */
+    bool is_hung_up;  /* unusable and out of epoll, close once no job refers to it */
+};
+
+struct Katie_ServeJob {
+    Katie_Connection *conn;
+    String source;
+    String response; /* framed, written by the worker */
+    Katie_ServeJob *next;
+};
+
+typedef struct Katie_ServeQueue Katie_ServeQueue;
+struct Katie_ServeQueue {
+    Katie_ServeJob *head, *tail;
+};
+
+typedef struct Katie_Server Katie_Server;
+struct Katie_Server {
+    int epoll_fd;
+    int listen_fd;
+    int done_fd; /* eventfd, workers bump it once a job is answered */
+    Katie_Module *prelude;
+
+    pthread_mutex_t lock;
+    pthread_cond_t jobs_cond;
+    Katie_ServeQueue jobs; /* waiting for a worker */
+    Katie_ServeQueue done; /* answered, waiting for the epoll thread */
+};
+
+static volatile sig_atomic_t katie_serve_is_stopping;
+
+static void serve_queue_push(Katie_ServeQueue *queue, Katie_ServeJob *job) {
+    job->next = NULL;
+    if (queue->tail) queue->tail->next = job;
+    else queue->head = job;
+    queue->tail = job;
+}
+
+static Katie_ServeJob *serve_queue_pop(Katie_ServeQueue *queue) {
+    Katie_ServeJob *job = queue->head;
+    if (job) {
+        queue->head = job->next;
+        if (!queue->head) queue->tail = NULL;
+    }
+    return job;
+}
+
+static void serve_put_u32(u8 *bytes, u32 number) {
+    bytes[0] = (u8)(number >> 24);
+    bytes[1] = (u8)(number >> 16);
+    bytes[2] = (u8)(number >> 8);
+    bytes[3] = (u8)number;
+}
+
+static u32 serve_get_u32(u8 *bytes) {
+    return (u32)bytes[0] << 24 | (u32)bytes[1] << 16 | (u32)bytes[2] << 8 | (u32)bytes[3];
+}
+
+static String serve_frame_response(u8 status, char *payload, usize length) {
+    u8 header[5];
+    String response = string_reserve(sizeof(header) + length);
+
+    serve_put_u32(header, (u32)(length + 1));
+    header[4] = status;
+    response = append_string_length(response, (char *)header, sizeof(header));
+    return append_string_length(response, payload, length);
+}
+
+// ------------------------------ Workers ----------------------------------
+
+static void serve_eval_job(Katie *ctx, Katie_Snapshot *prelude_globals, Katie_ServeJob *job) {
+    Katie_Module *module =
+        katie_read_source("<request>", job->source, Katie_OptimizeLevel_Module, NULL);
+
+    if (!module) {
+        char *msg = "syntax error";
+        job->response = serve_frame_response(KATIE_SERVE_ERROR, msg, strlen(msg));
+        return;
+    }
+
+    /* futures the request leaves running still read its forms */
+    ctx->hold = katie_hold_module(module);
+    if (katie_try_eval_module(ctx, module)) {
+        job->response =
+            serve_frame_response(KATIE_SERVE_OK, ctx->output, string_length(ctx->output));
+    } else {
+        job->response =
+            serve_frame_response(KATIE_SERVE_ERROR, ctx->error, string_length(ctx->error));
+    }
+    ctx->output = string_reset(ctx->output);
+
+    katie_restore_globals(ctx, prelude_globals);
+    katie_module_hold_release(ctx->hold);
+    ctx->hold = NULL;
+}
+
+static void *serve_worker_main(void *arg) {
+    Katie_Server *server = arg;
+    Katie_Snapshot *prelude_globals;
+    Katie_ServeJob *job;
+    Katie ctx;
+    u64 one = 1;
+
+    init_katie_ctx(&ctx);
+    if (!katie_try_eval_module(&ctx, server->prelude)) {
+        eprintln("error: prelude failed: %s", ctx.error);
+        exit(EXIT_FAILURE);
+    }
+    ctx.output = string_reset(ctx.output);
+    prelude_globals = katie_snapshot_globals(&ctx);
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (!(job = serve_queue_pop(&server->jobs)))
+            pthread_cond_wait(&server->jobs_cond, &server->lock);
+        pthread_mutex_unlock(&server->lock);
+
+        serve_eval_job(&ctx, prelude_globals, job);
+
+        pthread_mutex_lock(&server->lock);
+        serve_queue_push(&server->done, job);
+        pthread_mutex_unlock(&server->lock);
+        if (write(server->done_fd, &one, sizeof(one)) < 0) die("write");
+    }
+    return NULL;
+}
+
+// ------------------------------ Connections ------------------------------
+
+static void serve_close(Katie_Server *server, Katie_Connection *conn) {
+    if (!conn->is_hung_up) epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free_string(conn->in);
+    free_string(conn->out);
+    xfree(conn);
+}
+
+static void serve_hang_up(Katie_Server *server, Katie_Connection *conn) {
+    if (conn->is_hung_up) return;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->is_hung_up = true;
+}
+
+static void serve_write(Katie_Server *server, Katie_Connection *conn) {
+    while (conn->out_sent < string_length(conn->out)) {
+        isize sent = write(conn->fd, conn->out + conn->out_sent,
+                           string_length(conn->out) - conn->out_sent);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) serve_hang_up(server, conn);
+            return;
+        }
+        conn->out_sent += (usize)sent;
+    }
+
+    conn->out = string_reset(conn->out);
+    conn->out_sent = 0;
+}
+
+/* Hands the next complete request to the workers, one at a time so answers stay in order */
+static void serve_dispatch(Katie_Server *server, Katie_Connection *conn) {
+    usize available = string_length(conn->in) - conn->in_begin;
+    Katie_ServeJob *job;
+    u32 length;
+
+    if (conn->is_busy || conn->is_hung_up || available < 4) return;
+
+    length = serve_get_u32((u8 *)conn->in + conn->in_begin);
+    if (length > KATIE_SERVE_MAX_REQUEST) {
+        serve_hang_up(server, conn);
+        return;
+    }
+    if (available - 4 < length) return;
+
+    job = xmalloc(sizeof(Katie_ServeJob));
+    job->conn = conn;
+    job->source = make_string(conn->in + conn->in_begin + 4, length);
+    job->response = NULL;
+    conn->in_begin += 4 + length;
+    conn->is_busy = true;
+
+    /* compact once everything received was handed out */
+    if (conn->in_begin == string_length(conn->in)) {
+        conn->in = string_reset(conn->in);
+        conn->in_begin = 0;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    serve_queue_push(&server->jobs, job);
+    pthread_cond_signal(&server->jobs_cond);
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* Writes what it can, then closes the connection once nothing is left to do for it */
+static void serve_settle(Katie_Server *server, Katie_Connection *conn) {
+    struct epoll_event event;
+    u32 events = 0;
+
+    serve_dispatch(server, conn);
+    if (!conn->is_hung_up) serve_write(server, conn);
+
+    if (!conn->is_busy && (conn->is_hung_up || (conn->is_closing && !string_length(conn->out)))) {
+        serve_close(server, conn);
+        return;
+    }
+    if (conn->is_hung_up) return;
+
+    if (!conn->is_closing) events |= EPOLLIN | EPOLLRDHUP;
+    if (string_length(conn->out)) events |= EPOLLOUT;
+    if (events != conn->events) {
+        event.events = events;
+        event.data.ptr = conn;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->events = events;
+    }
+}
+
+static void serve_read(Katie_Server *server, Katie_Connection *conn) {
+    char buf[16384];
+
+    while (!conn->is_closing) {
+        isize received = read(conn->fd, buf, sizeof(buf));
+        if (received > 0) {
+            conn->in = append_string_length(conn->in, buf, (usize)received);
+        } else if (received == 0) {
+            conn->is_closing = true; /* answer what was sent before the peer shut down */
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            serve_hang_up(server, conn);
+            break;
+        }
+    }
+}
+
+static void serve_accept(Katie_Server *server) {
+    struct epoll_event event;
+    Katie_Connection *conn;
+    int fd;
+
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        conn = xmalloc(sizeof(Katie_Connection));
+        conn->fd = fd;
+        conn->in = make_string_empty();
+        conn->in_begin = 0;
+        conn->out = make_string_empty();
+        conn->out_sent = 0;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        conn->is_busy = false;
+        conn->is_closing = false;
+        conn->is_hung_up = false;
+
+        event.events = conn->events;
+        event.data.ptr = conn;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) die("epoll_ctl");
+    }
+}
+
+static void serve_collect_done(Katie_Server *server) {
+    Katie_ServeQueue done;
+    Katie_ServeJob *job;
+    u64 count;
+
+    if (read(server->done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) die("read");
+
+    pthread_mutex_lock(&server->lock);
+    done = server->done;
+    server->done.head = server->done.tail = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while ((job = serve_queue_pop(&done))) {
+        Katie_Connection *conn = job->conn;
+
+        if (!conn->is_hung_up) {
+            conn->out =
+                append_string_length(conn->out, job->response, string_length(job->response));
+        }
+        conn->is_busy = false;
+        free_string(job->source);
+        free_string(job->response);
+        xfree(job);
+
+        serve_settle(server, conn);
+    }
+}
+
+// ------------------------------ Main Loop --------------------------------
+
+static void serve_on_signal(int signal) {
+    (void)signal;
+    katie_serve_is_stopping = 1;
+}
+
+static int serve_listen(char *socket_path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        eprintln("error: socket path too long: %s", socket_path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) die("socket");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serves until SIGINT or SIGTERM, `worker_count` contexts evaluate requests */
+int katie_serve(char *socket_path, char *prelude_filepath, int worker_count) {
+    Katie_Server server;
+    Katie_CodeCache cache;
+    struct epoll_event event, events[KATIE_SERVE_MAX_EVENTS];
+    struct sigaction action;
+
+    init_katie_code_cache(&cache, Katie_OptimizeLevel_Module);
+    server.prelude = katie_code_cache_load(&cache, prelude_filepath);
+    if (!server.prelude) return EXIT_FAILURE;
+
+    server.listen_fd = serve_listen(socket_path);
+    if (server.listen_fd < 0) return EXIT_FAILURE;
+
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server.epoll_fd < 0 || server.done_fd < 0) die("epoll");
+
+    event.events = EPOLLIN;
+    event.data.ptr = &server.listen_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+    event.data.ptr = &server.done_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.done_fd, &event);
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.jobs_cond, NULL);
+    server.jobs.head = server.jobs.tail = NULL;
+    server.done.head = server.done.tail = NULL;
+
+    for (int i = 0; i < worker_count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_worker_main, &server) != 0)
+            die("pthread_create");
+        pthread_detach(thread);
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serve_on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    eprintln("katie: serving %s with %d contexts", socket_path, worker_count);
+
+    while (!katie_serve_is_stopping) {
+        int count = epoll_wait(server.epoll_fd, events, KATIE_SERVE_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            die("epoll_wait");
+        }
+
+        bool has_done = false;
+        for (int i = 0; i < count; ++i) {
+            void *ptr = events[i].data.ptr;
+            Katie_Connection *conn;
+
+            if (ptr == &server.listen_fd) {
+                serve_accept(&server);
+                continue;
+            }
+            if (ptr == &server.done_fd) {
+                has_done = true; /* after this batch, answering may close connections in it */
+                continue;
+            }
+
+            conn = ptr;
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) serve_hang_up(&server, conn);
+            else if (events[i].events & (EPOLLIN | EPOLLRDHUP)) serve_read(&server, conn);
+            serve_settle(&server, conn);
+        }
+        if (has_done) serve_collect_done(&server);
+    }
+
+    /* workers may still be evaluating, the process exit reclaims them */
+    close(server.listen_fd);
+    unlink(socket_path);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "katie.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+// --------------------------------------------------------------------------
+//                          - Stats -
+// --------------------------------------------------------------------------
+Katie_Stats katie_stats = {.natives_lock = PTHREAD_MUTEX_INITIALIZER};
+
+u64 katie_stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+void katie_stats_add_time(u64 *field, u64 start_ns) {
+    __atomic_fetch_add(field, katie_stats_now_ns() - start_ns, __ATOMIC_RELAXED);
+}
+
+/*
+ * Natives are only known by their globals, remember the first name each one gets. Every context
+ * defining the same proc shares its stat, calls count into it without taking the lock.
+ */
+Katie_NativeStat *katie_stats_name_native(Katie_Proc proc, Katie_Symbol name) {
+    Katie_NativeStat *stat = NULL;
+
+    pthread_mutex_lock(&katie_stats.natives_lock);
+    if (!katie_stats.natives) init_array(katie_stats.natives);
+    array_for_each(katie_stats.natives, i) {
+        if (katie_stats.natives[i]->proc == proc) stat = katie_stats.natives[i];
+    }
+    if (!stat) {
+        stat = xmalloc(sizeof(Katie_NativeStat));
+        *stat = (Katie_NativeStat){.proc = proc, .name = name, .calls = 0};
+        array_push(katie_stats.natives, stat);
+    }
+    pthread_mutex_unlock(&katie_stats.natives_lock);
+    return stat;
+}
+
+static void stats_report_time(FILE *stream, char *name, u64 ns) {
+    fprintf(stream, "  %-16s %12.3f ms\n", name, (f64)ns / 1e6);
+}
+
+static void stats_report_count(FILE *stream, char *name, u64 count) {
+    fprintf(stream, "  %-16s %12llu\n", name, (unsigned long long)count);
+}
+
+void katie_stats_report(FILE *stream) {
+    Katie_Stats *s = &katie_stats;
+    struct rusage usage;
+
+    fprintf(stream, "stats:\n");
+    stats_report_time(stream, "lex", s->lex_ns);
+    stats_report_time(stream, "read", s->read_ns);
+    stats_report_time(stream, "resolve", s->resolve_ns);
+    stats_report_time(stream, "eval", s->eval_ns);
+    stats_report_time(stream, "print", s->print_ns);
+
+#ifdef KATIE_STATS
+    stats_report_count(stream, "tokens", s->tokens);
+    stats_report_count(stream, "ast nodes", s->ast_nodes);
+    stats_report_count(stream, "vals allocated", s->vals_allocated);
+    stats_report_count(stream, "vals freed", s->vals_freed);
+    stats_report_count(stream, "env lookups", s->env_lookups);
+    fprintf(stream, "  %-16s %12.2f\n", "avg lookup depth",
+            s->env_lookups ? (f64)s->env_depth / (f64)s->env_lookups : 0.0);
+
+    fprintf(stream, "  native calls:\n");
+    if (s->natives) {
+        array_for_each(s->natives, i) {
+            if (!s->natives[i]->calls) continue;
+            fprintf(stream, "    %-14s %12llu\n", s->natives[i]->name.name,
+                    (unsigned long long)s->natives[i]->calls);
+        }
+    }
+#else
+    fprintf(stream, "  counters compiled out, build with -DStats\n");
+#endif
+
+    if (katie_jit.is_enabled) {
+        stats_report_count(stream, "jit compiled", katie_jit.compiled);
+        stats_report_count(stream, "jit deopts", katie_jit.deopts);
+    }
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(stream, "  %-16s %12ld KiB\n", "peak rss", usage.ru_maxrss);
+    }
+}
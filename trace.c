@@ -0,0 +1,158 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Tracer -
+// --------------------------------------------------------------------------
+/*
+ * `katie --trace out.json` records a begin and an end event around every top level form and user
+ * fn call, and at exit writes them as Chrome trace_event JSON, for chrome://tracing or Perfetto.
+ * Spans are named by the profiler's frame ids, so a fn reads the same in both outputs.
+ *
+ * Each thread appends to its own ring buffer and is the only writer of it, so recording takes no
+ * lock and no atomic read-modify-write. To keep the overhead down only one call in `every` is
+ * recorded, and calls nested deeper than `max_depth` are not recorded at all.
+ */
+Katie_Tracer katie_tracer;
+
+static __thread Katie_TraceBuffer *trace_buffer;
+static __thread u32 trace_depth;
+static __thread u32 trace_skip; /* calls left until the next recorded one */
+
+/* Frame of the span recorded at each depth, 0 where the call was not recorded */
+static __thread u32 trace_open[KATIE_TRACE_MAX_DEPTH];
+
+void katie_trace_start(u32 every, u32 max_depth) {
+    Katie_Tracer *t = &katie_tracer;
+
+    t->every = every > 0 ? every : 1;
+    t->max_depth = max_depth < KATIE_TRACE_MAX_DEPTH ? max_depth : KATIE_TRACE_MAX_DEPTH;
+    t->start_ns = katie_stats_now_ns();
+    t->is_enabled = true;
+}
+
+static Katie_TraceBuffer *trace_register(void) {
+    Katie_Tracer *t = &katie_tracer;
+    Katie_TraceBuffer *b = xmalloc(sizeof(Katie_TraceBuffer));
+
+    b->events = xmalloc(KATIE_TRACE_CAPACITY * sizeof(Katie_TraceEvent));
+    b->head = 0;
+    b->tid = __atomic_add_fetch(&t->threads, 1, __ATOMIC_RELAXED);
+    b->next = __atomic_load_n(&t->buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&t->buffers, &b->next, b, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+    return b;
+}
+
+static void trace_record(u32 frame, Katie_TracePhase phase) {
+    Katie_TraceBuffer *b = trace_buffer;
+    Katie_TraceEvent *event;
+
+    if (!b) b = trace_buffer = trace_register();
+    event = &b->events[b->head & (KATIE_TRACE_CAPACITY - 1)];
+    event->ts_ns = katie_stats_now_ns();
+    event->frame = frame;
+    event->phase = phase;
+    __atomic_store_n(&b->head, b->head + 1, __ATOMIC_RELEASE);
+}
+
+void katie_trace_push(u32 frame, bool is_form) {
+    u32 depth = trace_depth++;
+
+    if (depth >= katie_tracer.max_depth) return;
+    if (!is_form && trace_skip) {
+        trace_skip -= 1;
+        trace_open[depth] = 0;
+        return;
+    }
+    if (!is_form) trace_skip = katie_tracer.every - 1;
+
+    trace_open[depth] = frame;
+    trace_record(frame, Katie_TracePhase_Begin);
+}
+
+void katie_trace_pop(void) {
+    u32 depth = --trace_depth;
+
+    if (depth < katie_tracer.max_depth && trace_open[depth])
+        trace_record(trace_open[depth], Katie_TracePhase_End);
+}
+
+u32 katie_trace_depth(void) {
+    return trace_depth;
+}
+
+/* Ends the spans a runtime error unwound past */
+void katie_trace_unwind(u32 depth) {
+    while (trace_depth > depth)
+        katie_trace_pop();
+}
+
+static void trace_write_json_string(FILE *out, String s) {
+    fputc('"', out);
+    for (usize i = 0; i < string_length(s); ++i) {
+        u8 c = (u8)s[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* Stops tracing and writes every buffered event, ends whose begin was overwritten are dropped */
+void katie_trace_write(char *out_filepath) {
+    Katie_Tracer *t = &katie_tracer;
+    Array(String) labels;
+    usize frame_count;
+    bool is_first = true;
+    FILE *out;
+
+    t->is_enabled = false;
+    out = fopen(out_filepath, "w");
+    if (!out) {
+        perror(out_filepath);
+        return;
+    }
+
+    pthread_mutex_lock(&katie_profiler.lock);
+    frame_count = katie_profiler.frames ? array_length(katie_profiler.frames) : 0;
+    pthread_mutex_unlock(&katie_profiler.lock);
+
+    init_array(labels);
+    for (u32 i = 0; i < frame_count; ++i) {
+        array_push(labels, katie_profile_append_label(make_string_empty(), i));
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (Katie_TraceBuffer *b = __atomic_load_n(&t->buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+        u64 head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+        u64 begin = head > KATIE_TRACE_CAPACITY ? head - KATIE_TRACE_CAPACITY : 0;
+        u32 open = 0;
+
+        for (u64 at = begin; at < head; ++at) {
+            Katie_TraceEvent *event = &b->events[at & (KATIE_TRACE_CAPACITY - 1)];
+
+            if (event->phase == Katie_TracePhase_End) {
+                if (!open) continue;
+                open -= 1;
+            } else {
+                open += 1;
+            }
+
+            fprintf(out, "%s\n{\"name\":", is_first ? "" : ",");
+            if (event->frame < array_length(labels))
+                trace_write_json_string(out, labels[event->frame]);
+            else
+                fprintf(out, "\"?\"");
+            fprintf(out, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    event->phase == Katie_TracePhase_Begin ? 'B' : 'E',
+                    (f64)(event->ts_ns - t->start_ns) / 1e3, b->tid);
+            is_first = false;
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    fclose(out);
+    array_for_each(labels, i) { free_string(labels[i]); }
+    free_array(labels);
+}
@@ -0,0 +1,512 @@
+#include "katie.h"
+
+// --------------------------------------------------------------------------
+//                          - Bytecode -
+// --------------------------------------------------------------------------
+/*
+ * A fn body is compiled on its first call into instructions for a stack machine, which then runs
+ * every call of it instead of walking the body's forms. An instruction is an opcode followed by
+ * its operands, indices into the code's vals, the constants, symbol sites and forms it reads from
+ * the module. Forms the compiler does not handle are left to katie_eval by an Eval instruction.
+ *
+ * Frames stay the env of katie_apply_function, the machine only replaces how a body is walked.
+ * Params and captures are bound in the frame before the body runs, so loading one of them probes
+ * the frame alone, any other name is resolved through its site by katie_lookup.
+ *
+ * Superinstructions fuse the most common sequences of fn bodies: `(+ x 1)` where x is a param
+ * loads, adds and stores in one dispatch, and `(if (< a b) ...)` branches on the comparison without
+ * allocating its bool. Both check their native is still what the builtin was and take the generic
+ * call on anything but fixnums, so a rebound `+` or an overflow behaves as before.
+ */
+typedef enum Katie_Op {
+    Katie_Op_Const,            /* val: push it */
+    Katie_Op_Nil,              /* push a new nil */
+    Katie_Op_Load,             /* symbol: push what it resolves to */
+    Katie_Op_LoadLocal,        /* symbol: push its binding in the frame */
+    Katie_Op_Def,              /* symbol: bind it to the top */
+    Katie_Op_Pop,
+    Katie_Op_Jump,             /* target */
+    Katie_Op_JumpIfFalse,      /* target: pop, jump unless it is true */
+    Katie_Op_Call,             /* argc: apply the fn below the args to them */
+    Katie_Op_MakeFn,           /* fn form: push its closure */
+    Katie_Op_Eval,             /* form: push what katie_eval makes of it */
+    Katie_Op_Return,
+    Katie_Op_ArithConst,       /* number: `(op top number)` of the fn below the top, + or - */
+    Katie_Op_LoadLocalArith,   /* symbol, number: LoadLocal then ArithConst */
+    Katie_Op_CompareJump,      /* target: `(op a b)` of the top three, jump unless true */
+    Katie_Op_Count,
+} Katie_Op;
+
+/* How many operands follow each opcode */
+static u32 katie_op_operands[Katie_Op_Count] = {
+    [Katie_Op_Const] = 1,      [Katie_Op_Nil] = 0,         [Katie_Op_Load] = 1,
+    [Katie_Op_LoadLocal] = 1,  [Katie_Op_Def] = 1,         [Katie_Op_Pop] = 0,
+    [Katie_Op_Jump] = 1,       [Katie_Op_JumpIfFalse] = 1, [Katie_Op_Call] = 1,
+    [Katie_Op_MakeFn] = 1,     [Katie_Op_Eval] = 1,        [Katie_Op_Return] = 0,
+    [Katie_Op_ArithConst] = 1, [Katie_Op_LoadLocalArith] = 2, [Katie_Op_CompareJump] = 1,
+};
+
+struct Katie_Code {
+    Array(u32) ops;         /* opcodes, each followed by its operands */
+    Array(KatieVal *) vals; /* owned by the module */
+    u32 max_stack;
+
+    u32 calls;        /* counted while the jit is enabled, until compiled */
+    u32 deopts;       /* calls the machine code left to the interpreter */
+    Katie_JitFn jit;  /* NULL until compiled, by the jit or ahead of time */
+    usize jit_size;   /* of its mapping, 0 when compiled ahead of time */
+};
+
+typedef struct Katie_Compiler Katie_Compiler;
+struct Katie_Compiler {
+    Katie_Code *code;
+    Array(KatieVal *) params;
+    Katie_FnInfo *info;
+    u32 depth;
+    usize last_op;  /* offset of the last instruction emitted */
+    bool can_fuse;  /* nothing jumps between the last instruction and the next one */
+};
+
+static u32 compile_val(Katie_Compiler *c, KatieVal *val) {
+    array_push(c->code->vals, val);
+    return (u32)array_length(c->code->vals) - 1;
+}
+
+/* `effect` is how many values it leaves on the stack, less those it takes */
+static void compile_op(Katie_Compiler *c, Katie_Op op, int effect) {
+    c->last_op = array_length(c->code->ops);
+    c->can_fuse = true;
+    array_push(c->code->ops, op);
+
+    c->depth = (u32)((int)c->depth + effect);
+    if (c->depth > c->code->max_stack) c->code->max_stack = c->depth;
+}
+
+static void compile_operand(Katie_Compiler *c, u32 operand) {
+    array_push(c->code->ops, operand);
+}
+
+/* Emits a jump to be patched, returns the offset of its target */
+static usize compile_jump(Katie_Compiler *c, Katie_Op op, int effect) {
+    compile_op(c, op, effect);
+    compile_operand(c, 0);
+    return array_length(c->code->ops) - 1;
+}
+
+static void compile_patch(Katie_Compiler *c, usize target) {
+    c->code->ops[target] = (u32)array_length(c->code->ops);
+    c->can_fuse = false;
+}
+
+static bool compile_is_local(Katie_Compiler *c, KatieVal *symbol) {
+    array_for_each(c->params, i) {
+        if (c->params[i]->kind == KatieValKind_Symbol &&
+            c->params[i]->as.symbol.id == symbol->as.symbol.id)
+            return true;
+    }
+    array_for_each(c->info->captures, i) {
+        if (c->info->captures[i].id == symbol->as.symbol.id) return true;
+    }
+    return false;
+}
+
+static bool compile_is_named(KatieVal *val, char *name) {
+    return val->kind == KatieValKind_Symbol && !strcmp(val->as.symbol.name, name);
+}
+
+/* `(op a b)` for an op the machine compares fixnums of inline */
+static bool compile_is_comparison(KatieVal *val) {
+    KatieVal *op;
+
+    if (val->kind != KatieValKind_List || array_length(val->as.list) != 3) return false;
+    op = val->as.list[0];
+    return compile_is_named(op, "<") || compile_is_named(op, ">") || compile_is_named(op, "<=") ||
+           compile_is_named(op, ">=");
+}
+
+static void compile_form(Katie_Compiler *c, KatieVal *val);
+
+static void compile_eval(Katie_Compiler *c, KatieVal *val) {
+    compile_op(c, Katie_Op_Eval, 1);
+    compile_operand(c, compile_val(c, val));
+}
+
+static void compile_if(Katie_Compiler *c, KatieVal *val) {
+    Array(KatieVal *) list = val->as.list;
+    KatieVal *cond = list[1];
+    usize to_else, to_end;
+
+    if (compile_is_comparison(cond)) {
+        array_for_each(cond->as.list, i) { compile_form(c, cond->as.list[i]); }
+        to_else = compile_jump(c, Katie_Op_CompareJump, -3);
+    } else {
+        compile_form(c, cond);
+        to_else = compile_jump(c, Katie_Op_JumpIfFalse, -1);
+    }
+
+    compile_form(c, list[2]);
+    to_end = compile_jump(c, Katie_Op_Jump, 0);
+    c->depth -= 1; /* only one of the branches runs */
+
+    compile_patch(c, to_else);
+    if (array_length(list) < 4) compile_op(c, Katie_Op_Nil, 1);
+    else compile_form(c, list[3]);
+    compile_patch(c, to_end);
+}
+
+static void compile_call(Katie_Compiler *c, KatieVal *val) {
+    Array(KatieVal *) list = val->as.list;
+
+    if (array_length(list) == 3 &&
+        (compile_is_named(list[0], "+") || compile_is_named(list[0], "-")) &&
+        list[2]->kind == KatieValKind_Number) {
+        compile_form(c, list[0]);
+        compile_form(c, list[1]);
+
+        if (c->can_fuse && c->code->ops[c->last_op] == Katie_Op_LoadLocal) {
+            c->code->ops[c->last_op] = Katie_Op_LoadLocalArith;
+            c->depth -= 1;
+        } else {
+            compile_op(c, Katie_Op_ArithConst, -1);
+        }
+        compile_operand(c, compile_val(c, list[2]));
+        return;
+    }
+
+    array_for_each(list, i) { compile_form(c, list[i]); }
+    compile_op(c, Katie_Op_Call, -(int)(array_length(list) - 1));
+    compile_operand(c, (u32)array_length(list) - 1);
+}
+
+static void compile_form(Katie_Compiler *c, KatieVal *val) {
+    Array(KatieVal *) list;
+
+    switch (val->kind) {
+    case KatieValKind_Symbol:
+        compile_op(c, compile_is_local(c, val) ? Katie_Op_LoadLocal : Katie_Op_Load, 1);
+        compile_operand(c, compile_val(c, val));
+        return;
+
+    case KatieValKind_Nil:
+    case KatieValKind_Number:
+    case KatieValKind_BigNum:
+    case KatieValKind_Float:
+    case KatieValKind_String:
+    case KatieValKind_Bool:
+    case KatieValKind_Special:
+        compile_op(c, Katie_Op_Const, 1);
+        compile_operand(c, compile_val(c, val));
+        return;
+
+    case KatieValKind_List: break;
+    default: compile_eval(c, val); return;
+    }
+
+    list = val->as.list;
+    if (array_is_empty(list)) {
+        compile_eval(c, val);
+        return;
+    }
+    if (list[0]->kind != KatieValKind_Special) {
+        compile_call(c, val);
+        return;
+    }
+
+    switch (list[0]->as.special) {
+    case Katie_Special_Do:
+        if (array_length(list) == 1) compile_op(c, Katie_Op_Nil, 1);
+        for (usize i = 1; i < array_length(list); ++i) {
+            if (i > 1) compile_op(c, Katie_Op_Pop, -1);
+            compile_form(c, list[i]);
+        }
+        return;
+
+    case Katie_Special_Def:
+        if (array_length(list) < 3 || list[1]->kind != KatieValKind_Symbol) break;
+        compile_form(c, list[2]);
+        compile_op(c, Katie_Op_Def, 0);
+        compile_operand(c, compile_val(c, list[1]));
+        return;
+
+    case Katie_Special_If:
+        if (array_length(list) < 3) break;
+        compile_if(c, val);
+        return;
+
+    case Katie_Special_Fn:
+        if (array_length(list) != 3 || list[1]->kind != KatieValKind_List ||
+            !KATIE_FN_SITE(list[0])->info)
+            break;
+        compile_op(c, Katie_Op_MakeFn, 1);
+        compile_operand(c, compile_val(c, val));
+        return;
+
+    default: break;
+    }
+    compile_eval(c, val);
+}
+
+static Katie_Code *compile_fn(Katie_FnInfo *info, KatieVal *params, KatieVal *body) {
+    Katie_Compiler c = {.params = params->as.list, .info = info};
+    u32 kindSave = katie_alloc_kind_push(Katie_AllocKind_AstNode);
+
+    c.code = xmalloc(sizeof(Katie_Code));
+    init_array(c.code->ops);
+    init_array(c.code->vals);
+    c.code->max_stack = 0;
+    c.code->calls = 0;
+    c.code->deopts = 0;
+    c.code->jit = NULL;
+    c.code->jit_size = 0;
+
+    compile_form(&c, body);
+    compile_op(&c, Katie_Op_Return, -1);
+
+    katie_alloc_kind_pop(kindSave);
+    return c.code;
+}
+
+void katie_free_code(Katie_Code *code) {
+    if (code->jit_size) katie_jit_free(code); /* compiled C of `--emit-c` is not mapped */
+    free_array(code->ops);
+    free_array(code->vals);
+    xfree(code);
+}
+
+/* The code of a fn, compiled on first use. Racing threads may both compile, one code wins. */
+Katie_Code *katie_fn_code(Katie_FnInfo *info, KatieVal *params, KatieVal *body) {
+    Katie_Code *code = __atomic_load_n(&info->code, __ATOMIC_ACQUIRE);
+    Katie_Code *expected = NULL;
+
+    if (code) return code;
+    code = compile_fn(info, params, body);
+    if (!__atomic_compare_exchange_n(&info->code, &expected, code, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        katie_free_code(code);
+        code = expected;
+    }
+    return code;
+}
+
+// --------------------------------------------------------------------------
+//                          - Machine -
+// --------------------------------------------------------------------------
+static inline KatieVal *vm_load(Katie *ctx, KatieVal *symbol) {
+    KatieVal *val = katie_lookup(ctx, symbol);
+    if (!val) katie_runtime_error(ctx, "unbound symbol '%s'", symbol->as.symbol.name);
+    return val;
+}
+
+static inline KatieVal *vm_load_local(Katie *ctx, KatieVal *symbol) {
+    KatieVal *val = env_find_1level(ctx->env, symbol->as.symbol);
+
+    if (val && val->kind == KatieValKind_Box) val = val->as.box;
+    if (!val) katie_runtime_error(ctx, "unbound symbol '%s'", symbol->as.symbol.name);
+    katie_stat_add(env_lookups, 1);
+    katie_stat_add(env_depth, 1);
+    return val;
+}
+
+static inline bool vm_is_native(KatieVal *fn, Katie_Proc proc) {
+    return fn->kind == KatieValKind_NativeFunction && fn->as.native.proc == proc;
+}
+
+/* The unboxed entry of fn when it is a native with one */
+static inline Katie_NativeSpec *vm_fixnum2_spec(KatieVal *fn) {
+    if (fn->kind != KatieValKind_NativeFunction) return NULL;
+    return fn->as.native.spec && katie_spec_has_fixnum2(fn->as.native.spec) ? fn->as.native.spec
+                                                                            : NULL;
+}
+
+/* `(fn x number)`, unboxed for fixnums when fn is a native with a fixnum entry */
+static inline KatieVal *vm_arith_const(Katie *ctx, KatieVal *fn, KatieVal *x, KatieVal *number) {
+    KatieVal *argv[2] = {x, number};
+    Katie_NativeSpec *spec = vm_fixnum2_spec(fn);
+    i64 result;
+
+    if (spec && !spec->is_predicate && x->kind == KatieValKind_Number &&
+        katie_spec_fixnum2(spec, x->as.number, number->as.number, &result)) {
+        katie_stat_native_call(fn);
+        return alloc_number(result);
+    }
+    return katie_apply(ctx, fn, 2, argv);
+}
+
+/* `(fn a b)` is true, unboxed for fixnums when fn is a predicate with a fixnum entry */
+static inline bool vm_compare(Katie *ctx, KatieVal *fn, KatieVal *a, KatieVal *b) {
+    KatieVal *argv[2] = {a, b};
+    Katie_NativeSpec *spec = vm_fixnum2_spec(fn);
+    KatieVal *result;
+    i64 is_true;
+
+    if (spec && spec->is_predicate && a->kind == KatieValKind_Number &&
+        b->kind == KatieValKind_Number &&
+        katie_spec_fixnum2(spec, a->as.number, b->as.number, &is_true)) {
+        katie_stat_native_call(fn);
+        return is_true;
+    }
+
+    result = katie_apply(ctx, fn, 2, argv);
+    return result->kind == KatieValKind_Bool && result->as._bool;
+}
+
+/*
+ * Labels as values need GNU C, -Wpedantic would flag every dispatch. SwitchDispatch builds, and
+ * compilers without the extension, dispatch through a switch in a loop instead.
+ */
+#ifdef KATIE_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define VM_OP(name) vm_op_##name:
+#define VM_DISPATCH() goto *vm_labels[*ip++]
+#else
+#define VM_OP(name) case Katie_Op_##name:
+#define VM_DISPATCH() goto vm_dispatch
+#endif
+
+/* Runs a fn body in the frame katie_apply_function made for it */
+KatieVal *katie_run_code(Katie *ctx, Katie_Code *code) {
+#ifdef KATIE_THREADED_DISPATCH
+    static void *vm_labels[Katie_Op_Count] = {
+        [Katie_Op_Const] = &&vm_op_Const,
+        [Katie_Op_Nil] = &&vm_op_Nil,
+        [Katie_Op_Load] = &&vm_op_Load,
+        [Katie_Op_LoadLocal] = &&vm_op_LoadLocal,
+        [Katie_Op_Def] = &&vm_op_Def,
+        [Katie_Op_Pop] = &&vm_op_Pop,
+        [Katie_Op_Jump] = &&vm_op_Jump,
+        [Katie_Op_JumpIfFalse] = &&vm_op_JumpIfFalse,
+        [Katie_Op_Call] = &&vm_op_Call,
+        [Katie_Op_MakeFn] = &&vm_op_MakeFn,
+        [Katie_Op_Eval] = &&vm_op_Eval,
+        [Katie_Op_Return] = &&vm_op_Return,
+        [Katie_Op_ArithConst] = &&vm_op_ArithConst,
+        [Katie_Op_LoadLocalArith] = &&vm_op_LoadLocalArith,
+        [Katie_Op_CompareJump] = &&vm_op_CompareJump,
+    };
+#endif
+    KatieVal *stack[code->max_stack + 1];
+    KatieVal **sp = stack; /* next free slot */
+    KatieVal **vals = code->vals;
+    u32 *ops = code->ops;
+    u32 *ip = ops;
+    Katie_JitFn jit = __atomic_load_n(&code->jit, __ATOMIC_ACQUIRE);
+
+#ifdef KATIE_JIT
+    if (!jit && katie_jit.is_enabled &&
+        __atomic_add_fetch(&code->calls, 1, __ATOMIC_RELAXED) == katie_jit.threshold)
+        jit = katie_jit_compile(code);
+#endif
+    if (jit && __atomic_load_n(&code->deopts, __ATOMIC_RELAXED) < KATIE_JIT_MAX_DEOPTS) {
+        Katie_JitExit exit = {.sp = NULL};
+        KatieVal *result = jit(ctx, stack, vals, &exit);
+
+        if (!exit.sp) return result;
+        /* resume the instruction which deoptimized, with its operands on the stack */
+        __atomic_add_fetch(&code->deopts, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&katie_jit.deopts, 1, __ATOMIC_RELAXED);
+        ip = ops + exit.ip;
+        sp = exit.sp;
+    }
+
+#ifdef KATIE_THREADED_DISPATCH
+    VM_DISPATCH();
+#else
+vm_dispatch:
+    switch (*ip++) {
+#endif
+
+    VM_OP(Const) {
+        *sp++ = vals[*ip++];
+        VM_DISPATCH();
+    }
+
+    VM_OP(Nil) {
+        *sp++ = alloc_nil();
+        VM_DISPATCH();
+    }
+
+    VM_OP(Load) {
+        *sp++ = vm_load(ctx, vals[*ip++]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(LoadLocal) {
+        *sp++ = vm_load_local(ctx, vals[*ip++]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(Def) {
+        katie_define(ctx, ctx->env, vals[*ip++]->as.symbol, sp[-1]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(Pop) {
+        sp -= 1;
+        VM_DISPATCH();
+    }
+
+    VM_OP(Jump) {
+        ip = ops + *ip;
+        VM_DISPATCH();
+    }
+
+    VM_OP(JumpIfFalse) {
+        KatieVal *cond = *--sp;
+        if (cond->kind == KatieValKind_Bool && cond->as._bool) ip += 1;
+        else ip = ops + *ip;
+        VM_DISPATCH();
+    }
+
+    VM_OP(Call) {
+        u32 argc = *ip++;
+        sp -= argc;
+        sp[-1] = katie_apply(ctx, sp[-1], (int)argc, sp);
+        VM_DISPATCH();
+    }
+
+    VM_OP(MakeFn) {
+        *sp++ = katie_make_closure(ctx, vals[*ip++]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(Eval) {
+        *sp++ = katie_eval(ctx, vals[*ip++]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(ArithConst) {
+        sp -= 1;
+        sp[-1] = vm_arith_const(ctx, sp[-1], sp[0], vals[*ip++]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(LoadLocalArith) {
+        KatieVal *x = vm_load_local(ctx, vals[*ip++]);
+        sp[-1] = vm_arith_const(ctx, sp[-1], x, vals[*ip++]);
+        VM_DISPATCH();
+    }
+
+    VM_OP(CompareJump) {
+        sp -= 3;
+        if (vm_compare(ctx, sp[0], sp[1], sp[2])) ip += 1;
+        else ip = ops + *ip;
+        VM_DISPATCH();
+    }
+
+    VM_OP(Return) {
+        return sp[-1];
+    }
+
+#ifndef KATIE_THREADED_DISPATCH
+    default: Unreachable();
+    }
+    return NULL;
+#endif
+}
+
+#undef VM_OP
+#undef VM_DISPATCH
+#ifdef KATIE_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif